@@ -0,0 +1,120 @@
+#include "assetloader.h"
+#include "model.h"
+#include "texturecache.h"
+
+#include <iostream>
+#include <memory>
+
+AssetLoader::AssetLoader(ThreadPool &pool) : m_pool(pool) {}
+
+void AssetLoader::submit(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_pending;
+  }
+  m_pool.submit([this, job = std::move(job)] {
+    job();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      --m_pending;
+    }
+    m_condition.notify_all();
+  });
+}
+
+void AssetLoader::runOnGLThread(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_pending;
+    m_glTasks.push_back(std::move(task));
+  }
+  m_condition.notify_all();
+}
+
+void AssetLoader::load(Model &model, const std::string &path) {
+  if (m_modelCount++ == 0)
+    m_start = std::chrono::steady_clock::now();
+
+  submit([this, &model, path] {
+    if (!model.importMeshes(path))
+      return;
+
+    std::vector<std::string> texturePaths = model.getTexturePaths();
+    if (texturePaths.empty()) {
+      runOnGLThread([&model] { model.buildMeshes(); });
+      return;
+    }
+
+    // only touched on the GL thread, the last texture builds the meshes
+    model.m_pendingTextures = texturePaths.size();
+    auto textureDone = [&model](const std::string &texturePath, GLuint id) {
+      model.addTexture(texturePath, id);
+      if (--model.m_pendingTextures == 0)
+        model.buildMeshes();
+    };
+
+    TextureCache &cache = TextureCache::get();
+    for (const std::string &texturePath : texturePaths) {
+      std::string key = model.textureKey(texturePath);
+      GLuint id = 0;
+      switch (cache.acquire(key, id)) {
+      case TextureCache::Status::Ready:
+        runOnGLThread([=] { textureDone(texturePath, id); });
+        break;
+
+      case TextureCache::Status::Pending:
+        // runs inside the GL task of whoever publishes the texture
+        runOnGLThread([=, &cache] {
+          cache.whenReady(key,
+                          [=](GLuint id) { textureDone(texturePath, id); });
+        });
+        break;
+
+      case TextureCache::Status::Reserved:
+        submit([=, &model, &cache] {
+          auto image = std::make_shared<ImageData>(
+              model.decodeTexture(texturePath));
+
+          runOnGLThread([=, &model, &cache] {
+            size_t bytes = 0;
+            GLuint id = model.uploadTexture(texturePath, *image, bytes);
+            cache.publish(key, id, bytes);
+            textureDone(texturePath, id);
+          });
+        });
+        break;
+      }
+    }
+  });
+}
+
+void AssetLoader::finish() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock,
+                       [this] { return !m_glTasks.empty() || m_pending == 0; });
+      if (m_glTasks.empty())
+        break;
+      task = std::move(m_glTasks.front());
+      m_glTasks.pop_front();
+    }
+
+    task();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      --m_pending;
+    }
+  }
+
+  if (m_modelCount) {
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - m_start)
+                    .count();
+    std::cout << "Asset loader: " << m_modelCount << " models on "
+              << m_pool.getThreadCount() << " threads in " << ms << " ms"
+              << std::endl;
+  }
+  m_modelCount = 0;
+}
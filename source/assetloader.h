@@ -0,0 +1,47 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "threadpool.h"
+
+class Model;
+
+// Loads models in parallel: file I/O, Assimp / mesh cache parsing and image
+// decoding run on the pool, every GL call (buffer and texture uploads) is
+// queued and executed on the GL thread inside finish().
+class AssetLoader {
+public:
+  explicit AssetLoader(ThreadPool &pool);
+
+  AssetLoader(const AssetLoader &) = delete;
+  AssetLoader &operator=(const AssetLoader &) = delete;
+
+  // The model must stay at the same address until finish() returns.
+  void load(Model &model, const std::string &path);
+
+  // GL thread: runs queued uploads until every load has completed.
+  void finish();
+
+private:
+  ThreadPool &m_pool;
+
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<std::function<void()>> m_glTasks;
+  // CPU jobs in flight plus GL tasks not yet executed
+  size_t m_pending = 0;
+
+  unsigned int m_modelCount = 0;
+  std::chrono::steady_clock::time_point m_start;
+
+  void submit(std::function<void()> job);
+  void runOnGLThread(std::function<void()> task);
+};
+
+#endif // !ASSETLOADER_H
@@ -0,0 +1,212 @@
+#include "batchrenderer.h"
+#include "model.h"
+#include "renderstate.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+bool hasMultiDrawIndirect() {
+  return GLEW_VERSION_4_3 ||
+         (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+} // namespace
+
+BatchRenderer::BatchRenderer(size_t maxDraws, bool allowIndirect)
+    : m_Indirect(allowIndirect && hasMultiDrawIndirect()),
+      m_MaxDraws(maxDraws),
+      m_Matrices(GL_ARRAY_BUFFER, maxDraws * sizeof(glm::mat4)),
+      // the fallback never reads commands from the GPU
+      m_Commands(m_Indirect ? GL_DRAW_INDIRECT_BUFFER : GL_ARRAY_BUFFER,
+                 m_Indirect ? maxDraws * sizeof(DrawElementsIndirectCommand)
+                            : 16) {
+  std::cout << "BATCH RENDERER: "
+            << (m_Indirect ? "glMultiDrawElementsIndirect"
+                           : "glMultiDrawElementsBaseVertex")
+            << std::endl;
+
+  RenderState &state = RenderState::get();
+  for (int layout = 0; layout < (int)VertexLayout::Count; ++layout) {
+    m_VertexArrays[layout] =
+        GeometryPool::get().createVertexArray((VertexLayout)layout);
+    state.bindVertexArray(m_VertexArrays[layout]);
+    for (GLuint i = 0; i < 4; ++i) {
+      glEnableVertexAttribArray(kModelLocation + i);
+      glVertexAttribDivisor(kModelLocation + i, 1);
+    }
+  }
+  state.bindVertexArray(0);
+
+  m_FrameMatrices.reserve(maxDraws);
+  m_FrameCommands.reserve(maxDraws);
+}
+
+void BatchRenderer::destroy() {
+  m_Matrices.destroy();
+  m_Commands.destroy();
+  // the vertex arrays belong to the pool
+}
+
+void BatchRenderer::begin() {
+  m_Matrices.begin();
+  if (m_Indirect)
+    m_Commands.begin();
+  m_FrameMatrices.clear();
+  m_FrameCommands.clear();
+  m_Runs.clear();
+  m_Batches.clear();
+  m_Uploaded = false;
+  m_Overflowed = false;
+}
+
+size_t BatchRenderer::beginBatch() {
+  Batch batch;
+  batch.firstRun = m_Runs.size();
+  m_Batches.push_back(batch);
+  return m_Batches.size() - 1;
+}
+
+void BatchRenderer::add(const Model &model, const glm::mat4 &matrix) {
+  for (const Mesh &mesh : model.getMeshes())
+    add(mesh, matrix);
+}
+
+void BatchRenderer::add(const Model &model, const SceneGraph &scene,
+                        uint32_t root) {
+  const std::vector<MeshNode> &nodes = model.getNodes();
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const glm::mat4 &matrix = scene.getWorld(root + (uint32_t)i);
+    for (uint32_t mesh = 0; mesh < nodes[i].meshCount; ++mesh)
+      add(model.getMeshes()[nodes[i].firstMesh + mesh], matrix);
+  }
+}
+
+void BatchRenderer::add(const Mesh &mesh, const glm::mat4 &matrix) {
+  if (m_Batches.empty()) {
+    std::cout << "BATCH RENDERER: ADD WITHOUT beginBatch()" << std::endl;
+    return;
+  }
+  if (m_FrameCommands.size() >= m_MaxDraws) {
+    if (!m_Overflowed)
+      std::cout << "BATCH RENDERER: MORE THAN " << m_MaxDraws
+                << " DRAWS, THE REST OF THE FRAME IS DROPPED" << std::endl;
+    m_Overflowed = true;
+    return;
+  }
+  Batch &batch = m_Batches.back();
+  const GeometryRange &geometry = mesh.getGeometry();
+  bool firstOfBatch = batch.runCount == 0;
+  if (firstOfBatch || m_Runs.back().layout != geometry.layout) {
+    m_Runs.push_back({geometry.layout, m_FrameCommands.size(), 0});
+    ++batch.runCount;
+  }
+
+  // meshes of one model share their matrix slot
+  if (m_FrameMatrices.empty() || m_FrameMatrices.back() != matrix ||
+      firstOfBatch)
+    m_FrameMatrices.push_back(matrix);
+
+  const MeshLod &lod = mesh.getLods()[0];
+  DrawElementsIndirectCommand command;
+  command.count = lod.indexCount;
+  command.instanceCount = 1;
+  command.firstIndex = geometry.firstIndex + lod.indexOffset;
+  command.baseVertex = geometry.baseVertex;
+  command.baseInstance = (GLuint)m_FrameMatrices.size() - 1;
+  m_FrameCommands.push_back(command);
+  ++m_Runs.back().commandCount;
+}
+
+void BatchRenderer::commit() {
+  m_Uploaded = true;
+  if (!m_FrameMatrices.empty()) {
+    size_t bytes = m_FrameMatrices.size() * sizeof(glm::mat4);
+    void *matrices = m_Matrices.allocate(bytes, m_MatrixOffset);
+    if (matrices)
+      std::memcpy(matrices, m_FrameMatrices.data(), bytes);
+    m_Uploaded = matrices != nullptr;
+  }
+  if (m_Indirect && !m_FrameCommands.empty()) {
+    size_t bytes =
+        m_FrameCommands.size() * sizeof(DrawElementsIndirectCommand);
+    void *commands = m_Commands.allocate(bytes, m_CommandOffset);
+    if (commands)
+      std::memcpy(commands, m_FrameCommands.data(), bytes);
+    m_Uploaded = m_Uploaded && commands != nullptr;
+  }
+  m_Matrices.commit();
+  if (m_Indirect)
+    m_Commands.commit();
+}
+
+void BatchRenderer::draw(size_t index) {
+  // the stream buffers were full, nothing valid to draw from
+  if (!m_Uploaded)
+    return;
+  const Batch &batch = m_Batches[index];
+  for (size_t run = 0; run < batch.runCount; ++run)
+    drawRun(m_Runs[batch.firstRun + run]);
+}
+
+void BatchRenderer::drawRun(const Run &run) {
+  RenderState &state = RenderState::get();
+  state.bindVertexArray(m_VertexArrays[(int)run.layout]);
+  const DrawElementsIndirectCommand *commands =
+      &m_FrameCommands[run.firstCommand];
+
+  if (m_Indirect) {
+    pointModelAttribute(m_MatrixOffset);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_Commands.getBuffer());
+    glMultiDrawElementsIndirect(
+        GL_TRIANGLES, GL_UNSIGNED_INT,
+        (void *)(m_CommandOffset +
+                 run.firstCommand * sizeof(DrawElementsIndirectCommand)),
+        (GLsizei)run.commandCount, sizeof(DrawElementsIndirectCommand));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    state.countDraws(1);
+    return;
+  }
+
+  // GL 3.3 has neither base instance nor gl_DrawID: one multi draw per run
+  // of commands sharing a matrix slot, the attribute moved to that slot
+  size_t begin = 0;
+  while (begin < run.commandCount) {
+    GLuint slot = commands[begin].baseInstance;
+    m_Counts.clear();
+    m_Offsets.clear();
+    m_BaseVertices.clear();
+    size_t end = begin;
+    for (; end < run.commandCount && commands[end].baseInstance == slot;
+         ++end) {
+      m_Counts.push_back((GLsizei)commands[end].count);
+      m_Offsets.push_back(
+          (const void *)(commands[end].firstIndex * sizeof(GLuint)));
+      m_BaseVertices.push_back(commands[end].baseVertex);
+    }
+
+    pointModelAttribute(m_MatrixOffset + slot * sizeof(glm::mat4));
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, m_Counts.data(),
+                                  GL_UNSIGNED_INT, m_Offsets.data(),
+                                  (GLsizei)m_Counts.size(),
+                                  m_BaseVertices.data());
+    state.countDraws(1);
+    begin = end;
+  }
+}
+
+void BatchRenderer::end() {
+  m_Matrices.end();
+  if (m_Indirect)
+    m_Commands.end();
+}
+
+void BatchRenderer::pointModelAttribute(GLintptr offset) {
+  glBindBuffer(GL_ARRAY_BUFFER, m_Matrices.getBuffer());
+  for (GLuint i = 0; i < 4; ++i)
+    glVertexAttribPointer(kModelLocation + i, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(glm::mat4),
+                          (void *)(offset + i * sizeof(glm::vec4)));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
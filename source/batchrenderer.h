@@ -0,0 +1,100 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "geometrypool.h"
+#include "streambuffer.h"
+
+#include "glew/glew.h"
+#include "glm/mat4x4.hpp"
+
+class Mesh;
+class Model;
+class SceneGraph;
+
+// Merges draws of GeometryPool meshes that share a program, textures and
+// vertex layout into one call. Each draw's model matrix is an instanced
+// mat4 attribute at kModelLocation, picked by the base instance of its
+// glMultiDrawElementsIndirect command. Without GL 4.3 / ARB_multi_draw_
+// indirect a batch falls back to one glMultiDrawElementsBaseVertex per
+// model matrix, moving the attribute pointer in between.
+//
+// Per frame:
+//   begin() -> beginBatch() / add()... -> commit() -> draw()... -> end()
+class BatchRenderer {
+public:
+  static const GLuint kModelLocation = 3;
+
+  // maxDraws is the most meshes added between begin() and end(), more are
+  // dropped and logged. allowIndirect false forces the fallback path.
+  explicit BatchRenderer(size_t maxDraws, bool allowIndirect = true);
+
+  BatchRenderer(const BatchRenderer &) = delete;
+  BatchRenderer &operator=(const BatchRenderer &) = delete;
+
+  // Frees the GL objects, call while the context is still current.
+  void destroy();
+
+  void begin();
+  // Starts a batch, later add() calls go into it. Returns the batch to
+  // pass to draw().
+  size_t beginBatch();
+  // Every mesh of model, or one mesh, with matrix. Meshes are drawn in the
+  // order added; a change of vertex layout starts a new run of the batch,
+  // issued as a call of its own.
+  void add(const Model &model, const glm::mat4 &matrix);
+  void add(const Mesh &mesh, const glm::mat4 &matrix);
+  // Every mesh of model with its node's world matrix, see
+  // Model::addToScene
+  void add(const Model &model, const SceneGraph &scene, uint32_t root);
+  // Uploads the matrices and commands of every batch
+  void commit();
+  // Issues a committed batch with the program and textures currently bound
+  void draw(size_t batch);
+  void end();
+
+  bool isIndirect() const { return m_Indirect; }
+
+private:
+  // commands of one batch in one layout
+  struct Run {
+    VertexLayout layout;
+    size_t firstCommand;
+    size_t commandCount;
+  };
+
+  struct Batch {
+    size_t firstRun = 0;
+    size_t runCount = 0;
+  };
+
+  bool m_Indirect;
+  size_t m_MaxDraws;
+  StreamBuffer m_Matrices;
+  StreamBuffer m_Commands;
+  // one per layout, the pool attributes plus the model matrix
+  GLuint m_VertexArrays[(int)VertexLayout::Count];
+
+  std::vector<glm::mat4> m_FrameMatrices;
+  std::vector<DrawElementsIndirectCommand> m_FrameCommands;
+  std::vector<Run> m_Runs;
+  std::vector<Batch> m_Batches;
+  GLintptr m_MatrixOffset = 0;
+  GLintptr m_CommandOffset = 0;
+  // commit() found room in the stream buffers
+  bool m_Uploaded = false;
+  // logged once per frame
+  bool m_Overflowed = false;
+
+  // fallback scratch, per matrix slot
+  std::vector<GLsizei> m_Counts;
+  std::vector<const void *> m_Offsets;
+  std::vector<GLint> m_BaseVertices;
+
+  void pointModelAttribute(GLintptr offset);
+  void drawRun(const Run &run);
+};
+
+#endif // !BATCHRENDERER_H
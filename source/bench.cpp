@@ -0,0 +1,795 @@
+#include "bench.h"
+#include "blockcompress.h"
+#include "bvh.h"
+#include "culling.h"
+#include "model.h"
+#include "occlusion.h"
+#include "scenegraph.h"
+#include "threadpool.h"
+#include "transforms.h"
+#include "vertexformat.h"
+
+#include "glm/ext/matrix_clip_space.hpp"
+#include "glm/ext/matrix_transform.hpp"
+#include "glm/trigonometric.hpp"
+#include "stb/stb_image.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Best of `runs` timings of fn(), in milliseconds.
+template <typename Fn> double bestOfMs(int runs, Fn &&fn) {
+  double best = 1e30;
+  for (int run = 0; run < runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    best = std::min(best, ms);
+  }
+  return best;
+}
+
+void printRow(std::ostream &out, const char *name, size_t count, double ms) {
+  out << std::setw(12) << name << std::setw(10) << count << std::setw(12)
+      << ms << std::setw(14) << count / ms << std::endl;
+}
+
+bool benchFrustumCulling(std::ostream &out) {
+  out << "Frustum culling" << std::endl;
+  out << std::setw(12) << "path" << std::setw(10) << "spheres"
+      << std::setw(12) << "ms" << std::setw(14) << "spheres/ms" << std::endl;
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.f), 1.0f, 0.1f, 200.f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+  Frustum frustum = Frustum::fromMatrix(projection * view);
+
+  std::mt19937 engine(1337u);
+  std::uniform_real_distribution<float> positionDist(-100.0f, 100.0f);
+  std::uniform_real_distribution<float> radiusDist(0.05f, 2.0f);
+
+  bool ok = true;
+  for (size_t count : {30000u, 300000u, 3000000u}) {
+    SphereSet spheres;
+    spheres.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      glm::vec3 center{positionDist(engine), positionDist(engine),
+                       positionDist(engine)};
+      spheres.add(center, radiusDist(engine));
+    }
+
+    std::vector<uint32_t> scalarIndices(count), simdIndices(count);
+    size_t scalarVisible = 0, simdVisible = 0;
+    double scalarMs = bestOfMs(5, [&] {
+      scalarVisible = cullSpheresScalar(frustum, spheres, scalarIndices.data());
+    });
+    double simdMs = bestOfMs(5, [&] {
+      simdVisible = cullSpheres(frustum, spheres, simdIndices.data());
+    });
+
+    printRow(out, "scalar", count, scalarMs);
+    printRow(out, "simd", count, simdMs);
+    out << std::setw(12) << "visible" << std::setw(10) << simdVisible
+        << std::setw(12) << "speedup" << std::setw(14) << scalarMs / simdMs
+        << std::endl;
+
+    if (scalarVisible != simdVisible ||
+        !std::equal(scalarIndices.begin(),
+                    scalarIndices.begin() + scalarVisible,
+                    simdIndices.begin())) {
+      out << "MISMATCH: simd culling differs from the scalar reference"
+          << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool benchNormalMatrices(std::ostream &out) {
+  ThreadPool pool;
+  out << "Normal matrices (" << pool.getThreadCount() << " threads)"
+      << std::endl;
+  out << std::setw(12) << "path" << std::setw(10) << "instances"
+      << std::setw(12) << "ms" << std::setw(14) << "instances/ms"
+      << std::endl;
+
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, -4.0f),
+                               glm::vec3(-5.0f, 1.0f, 0.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+
+  std::mt19937 engine(1337u);
+  std::uniform_real_distribution<float> positionDist(-10.0f, 10.0f);
+  std::uniform_real_distribution<float> scaleDist(0.02f, 0.05f);
+  std::uniform_real_distribution<float> rotDist(0.0f, glm::two_pi<float>());
+
+  bool ok = true;
+  for (size_t count : {30000u, 300000u, 3000000u}) {
+    std::vector<glm::mat4> models(count);
+    for (glm::mat4 &model : models) {
+      model = glm::translate(glm::mat4(1.0f),
+                             glm::vec3(positionDist(engine),
+                                       positionDist(engine),
+                                       positionDist(engine)));
+      model = glm::scale(model, glm::vec3(scaleDist(engine)));
+      model = glm::rotate(model, rotDist(engine),
+                          glm::normalize(glm::vec3(0.3f, 0.6f, 0.8f)));
+    }
+
+    std::vector<glm::mat3> reference(count), result(count);
+    double scalarMs = bestOfMs(3, [&] {
+      normalMatricesScalar(view, models.data(), nullptr, count,
+                           reference.data());
+    });
+    double simdMs = bestOfMs(3, [&] {
+      normalMatrices(view, models.data(), nullptr, count, result.data());
+    });
+    double parallelMs = bestOfMs(3, [&] {
+      pool.parallelFor(count, 2048, [&](size_t begin, size_t end) {
+        normalMatrices(view, &models[begin], nullptr, end - begin,
+                       &result[begin]);
+      });
+    });
+
+    printRow(out, "glm", count, scalarMs);
+    printRow(out, "simd", count, simdMs);
+    printRow(out, "simd+pool", count, parallelMs);
+
+    // relative to the largest element, the matrices scale with 1 / scale
+    float maxError = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+      float magnitude = 0.0f, error = 0.0f;
+      for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+          magnitude = std::fmax(magnitude, std::fabs(reference[i][c][r]));
+          error = std::fmax(error,
+                            std::fabs(reference[i][c][r] - result[i][c][r]));
+        }
+      }
+      maxError = std::fmax(maxError, error / magnitude);
+    }
+    out << std::setw(12) << "max error" << std::setw(10) << ""
+        << std::setw(12) << std::scientific << maxError << std::fixed
+        << std::endl;
+    if (!(maxError < 1e-4f)) {
+      out << "MISMATCH: simd normal matrices differ from glm" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool benchVertexPacking(std::ostream &out) {
+  out << "Vertex packing (" << sizeof(Vertex) << " -> "
+      << sizeof(PackedVertex) << " bytes)" << std::endl;
+  out << std::setw(12) << "path" << std::setw(10) << "vertices"
+      << std::setw(12) << "ms" << std::setw(14) << "vertices/ms"
+      << std::endl;
+
+  const size_t count = 1000000;
+  std::mt19937 engine(1337u);
+  std::uniform_real_distribution<float> positionDist(-3.0f, 5.0f);
+  std::normal_distribution<float> normalDist;
+  std::uniform_real_distribution<float> uvDist(-8.0f, 8.0f);
+
+  std::vector<Vertex> vertices(count);
+  for (Vertex &vertex : vertices) {
+    vertex.Position = {positionDist(engine), positionDist(engine),
+                       positionDist(engine)};
+    vertex.Normal = glm::normalize(
+        glm::vec3(normalDist(engine), normalDist(engine), normalDist(engine)));
+    vertex.TexCoords = {uvDist(engine), uvDist(engine)};
+  }
+
+  PackedMesh packed;
+  double packMs = bestOfMs(3, [&] {
+    packVertices(vertices.data(), vertices.size(), packed);
+  });
+  printRow(out, "pack", count, packMs);
+
+  // snorm16 steps are scale / 32767 per axis; half floats keep 11 bits of
+  // mantissa; octahedral snorm16 normals stay below 0.01 degrees
+  float positionError = 0.0f, normalError = 0.0f, uvError = 0.0f;
+  float positionStep =
+      std::max({packed.scale.x, packed.scale.y, packed.scale.z}) / 32767.0f;
+  for (size_t i = 0; i < count; ++i) {
+    Vertex decoded;
+    unpackVertex(packed, i, decoded);
+    const Vertex &vertex = vertices[i];
+    positionError =
+        std::fmax(positionError,
+                  glm::length(decoded.Position - vertex.Position));
+    // atan2 stays exact for tiny angles where acos(dot) does not
+    float angle =
+        std::atan2(glm::length(glm::cross(decoded.Normal, vertex.Normal)),
+                   glm::dot(decoded.Normal, vertex.Normal));
+    normalError = std::fmax(normalError, glm::degrees(angle));
+    for (int c = 0; c < 2; ++c) {
+      float error = std::fabs(decoded.TexCoords[c] - vertex.TexCoords[c]);
+      uvError = std::fmax(
+          uvError, error / std::fmax(std::fabs(vertex.TexCoords[c]), 1.0f));
+    }
+  }
+
+  out << std::setw(12) << "position" << std::setw(10) << "" << std::setw(12)
+      << std::scientific << positionError << " (step " << positionStep << ")"
+      << std::endl;
+  out << std::setw(12) << "normal deg" << std::setw(10) << "" << std::setw(12)
+      << normalError << std::endl;
+  out << std::setw(12) << "uv" << std::setw(10) << "" << std::setw(12)
+      << uvError << std::fixed << std::endl;
+
+  if (!(positionError <= positionStep) || !(normalError < 0.01f) ||
+      !(uvError < 1e-3f)) {
+    out << "MISMATCH: packed vertices lose more than the format allows"
+        << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool benchSceneGraph(std::ostream &out) {
+  const size_t count = 100000;
+  // objects of 100 nodes, each node under a random earlier one of its
+  // object, so changed nodes drag subtrees of varying size along
+  const size_t objectSize = 100;
+  const size_t changedPerFrame = count / 100;
+  out << "Scene graph (" << count << " nodes, " << changedPerFrame
+      << " changed per frame)" << std::endl;
+  out << std::setw(12) << "path" << std::setw(10) << "updated"
+      << std::setw(12) << "ms" << std::setw(14) << "nodes/ms" << std::endl;
+
+  std::mt19937 engine(1337u);
+  std::uniform_real_distribution<float> offsetDist(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> angleDist(0.0f, glm::two_pi<float>());
+  auto randomLocal = [&] {
+    glm::mat4 local = glm::translate(
+        glm::mat4(1.0f), glm::vec3(offsetDist(engine), offsetDist(engine),
+                                   offsetDist(engine)));
+    return glm::rotate(local, angleDist(engine),
+                       glm::normalize(glm::vec3(0.3f, 0.6f, 0.8f)));
+  };
+
+  SceneGraph scene;
+  scene.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    size_t first = i - i % objectSize;
+    uint32_t parent = i == first
+                          ? SceneGraph::kNoParent
+                          : (uint32_t)(first + engine() % (i - first));
+    scene.addNode(parent, randomLocal());
+  }
+  scene.update();
+
+  // full: every root dirty, i.e. recomputing the whole graph every frame
+  size_t fullUpdated = 0;
+  double fullMs = bestOfMs(5, [&] {
+    for (size_t i = 0; i < count; i += objectSize)
+      scene.setLocal((uint32_t)i, scene.getLocal((uint32_t)i));
+    fullUpdated = scene.update();
+  });
+
+  // the changed nodes and locals are drawn up front, outside the timing
+  const int frames = 20;
+  std::vector<uint32_t> changed(frames * changedPerFrame);
+  std::vector<glm::mat4> locals(changed.size());
+  for (size_t i = 0; i < changed.size(); ++i) {
+    changed[i] = (uint32_t)(engine() % count);
+    locals[i] = randomLocal();
+  }
+  size_t dirtyUpdated = 0, dirtyFrames = 0;
+  double dirtyMs = bestOfMs(frames, [&] {
+    size_t begin = dirtyFrames++ * changedPerFrame;
+    for (size_t i = begin; i < begin + changedPerFrame; ++i)
+      scene.setLocal(changed[i], locals[i]);
+    dirtyUpdated = scene.update();
+  });
+
+  printRow(out, "full", fullUpdated, fullMs);
+  printRow(out, "dirty 1%", dirtyUpdated, dirtyMs);
+  out << std::setw(12) << "speedup" << std::setw(10) << ""
+      << std::setw(12) << fullMs / dirtyMs << std::endl;
+
+  // the incremental result must match a graph rebuilt from the same locals
+  SceneGraph reference;
+  reference.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    reference.addNode(scene.getParent((uint32_t)i),
+                      scene.getLocal((uint32_t)i));
+  reference.update();
+  for (uint32_t i = 0; i < count; ++i) {
+    if (scene.getWorld(i) != reference.getWorld(i) ||
+        scene.getNormal(i) != reference.getNormal(i)) {
+      out << "MISMATCH: incremental scene graph update differs from a full "
+             "one at node "
+          << i << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// slab test, the reference for Bvh::raycast
+bool rayHitsBox(const Aabb &box, const glm::vec3 &origin,
+                const glm::vec3 &direction, float maxDistance,
+                float &distance) {
+  float near = 0.0f, far = maxDistance;
+  for (int axis = 0; axis < 3; ++axis) {
+    float t0 = (box.min[axis] - origin[axis]) / direction[axis];
+    float t1 = (box.max[axis] - origin[axis]) / direction[axis];
+    near = std::fmax(near, std::fmin(t0, t1));
+    far = std::fmin(far, std::fmax(t0, t1));
+  }
+  distance = near;
+  return near <= far;
+}
+
+bool benchBvh(std::ostream &out) {
+  out << "BVH (1% of the objects moved per refit, ms per query)"
+      << std::endl;
+  out << std::setw(10) << "objects" << std::setw(10) << "nodes"
+      << std::setw(10) << "build" << std::setw(10) << "refit"
+      << std::setw(10) << "frustum" << std::setw(10) << "brute"
+      << std::setw(10) << "ray" << std::setw(10) << "sphere" << std::endl;
+
+  // the queries run on the refitted tree, so the checks cover refit too
+  const int queries = 16;
+  for (size_t count : {10000, 100000, 1000000}) {
+    // constant density, boxes of 0.5 to 2 units
+    float extent = 50.0f * std::cbrt(count / 10000.0f);
+    std::mt19937 engine(4242u);
+    std::uniform_real_distribution<float> positionDist(-extent, extent);
+    std::uniform_real_distribution<float> sizeDist(0.25f, 1.0f);
+    std::uniform_real_distribution<float> unitDist(-1.0f, 1.0f);
+    auto randomPoint = [&] {
+      return glm::vec3(positionDist(engine), positionDist(engine),
+                       positionDist(engine));
+    };
+    auto randomDirection = [&] {
+      glm::vec3 direction(unitDist(engine), unitDist(engine),
+                          unitDist(engine));
+      return glm::length(direction) > 0.01f ? glm::normalize(direction)
+                                            : glm::vec3(0.0f, 0.0f, 1.0f);
+    };
+    auto randomBox = [&](const glm::vec3 &center) {
+      glm::vec3 half(sizeDist(engine), sizeDist(engine), sizeDist(engine));
+      return Aabb{center - half, center + half};
+    };
+
+    std::vector<Aabb> boxes(count);
+    for (Aabb &box : boxes)
+      box = randomBox(randomPoint());
+
+    Bvh bvh;
+    double buildMs =
+        bestOfMs(3, [&] { bvh.build(boxes.data(), boxes.size()); });
+
+    // small moves, what refit is for
+    const int frames = 5;
+    size_t moved = count / 100;
+    std::vector<uint32_t> movedObjects(frames * moved);
+    for (uint32_t &object : movedObjects)
+      object = (uint32_t)(engine() % count);
+    int frame = 0;
+    double refitMs = bestOfMs(frames, [&] {
+      for (size_t i = frame * moved; i < (frame + 1) * moved; ++i) {
+        Aabb &box = boxes[movedObjects[i]];
+        glm::vec3 offset = randomDirection() * 0.5f;
+        box = {box.min + offset, box.max + offset};
+        bvh.update(movedObjects[i], box);
+      }
+      bvh.refit();
+      ++frame;
+    });
+
+    std::vector<Frustum> frustums;
+    std::vector<glm::vec3> origins, directions, centers;
+    for (int i = 0; i < queries; ++i) {
+      glm::vec3 eye = randomPoint();
+      glm::vec3 direction = randomDirection();
+      frustums.push_back(Frustum::fromMatrix(
+          glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f,
+                           extent * 0.5f) *
+          glm::lookAt(eye, eye + direction,
+                      glm::vec3(direction.y, direction.z, direction.x))));
+      origins.push_back(eye);
+      directions.push_back(direction);
+      centers.push_back(randomPoint());
+    }
+    float radius = extent * 0.1f;
+
+    std::vector<std::vector<uint32_t>> found(queries);
+    double frustumMs = bestOfMs(3, [&] {
+      for (int i = 0; i < queries; ++i) {
+        found[i].clear();
+        bvh.queryFrustum(frustums[i], found[i]);
+      }
+    });
+    std::vector<std::vector<uint32_t>> expected(queries);
+    double bruteMs = bestOfMs(3, [&] {
+      for (int i = 0; i < queries; ++i) {
+        expected[i].clear();
+        for (uint32_t object = 0; object < count; ++object)
+          if (classifyBox(frustums[i], boxes[object]) !=
+              Containment::Outside)
+            expected[i].push_back(object);
+      }
+    });
+    for (int i = 0; i < queries; ++i) {
+      std::sort(found[i].begin(), found[i].end());
+      if (found[i] != expected[i]) {
+        out << "MISMATCH: BVH frustum query " << i << " of " << count
+            << " objects found " << found[i].size() << ", brute force "
+            << expected[i].size() << std::endl;
+        return false;
+      }
+    }
+
+    std::vector<uint32_t> hitObjects(queries);
+    std::vector<float> hitDistances(queries);
+    std::vector<uint8_t> hits(queries);
+    double rayMs = bestOfMs(3, [&] {
+      for (int i = 0; i < queries; ++i)
+        hits[i] = bvh.raycast(origins[i], directions[i], FLT_MAX,
+                              hitObjects[i], hitDistances[i]);
+    });
+    for (int i = 0; i < queries; ++i) {
+      // ties between boxes may pick either, the distance must match
+      float closest = FLT_MAX, distance;
+      for (uint32_t object = 0; object < count; ++object)
+        if (rayHitsBox(boxes[object], origins[i], directions[i], closest,
+                       distance))
+          closest = std::min(closest, distance);
+      bool hit = closest != FLT_MAX;
+      if (hit != (bool)hits[i] ||
+          (hit && std::abs(closest - hitDistances[i]) >
+                      1e-4f * std::max(1.0f, closest))) {
+        out << "MISMATCH: BVH ray " << i << " of " << count
+            << " objects hit at " << (hits[i] ? hitDistances[i] : -1.0f)
+            << ", brute force at " << (hit ? closest : -1.0f) << std::endl;
+        return false;
+      }
+    }
+
+    double sphereMs = bestOfMs(3, [&] {
+      for (int i = 0; i < queries; ++i) {
+        found[i].clear();
+        bvh.querySphere(centers[i], radius, found[i]);
+      }
+    });
+    for (int i = 0; i < queries; ++i) {
+      expected[i].clear();
+      for (uint32_t object = 0; object < count; ++object) {
+        const Aabb &box = boxes[object];
+        glm::vec3 offset =
+            centers[i] - glm::clamp(centers[i], box.min, box.max);
+        if (glm::dot(offset, offset) <= radius * radius)
+          expected[i].push_back(object);
+      }
+      std::sort(found[i].begin(), found[i].end());
+      if (found[i] != expected[i]) {
+        out << "MISMATCH: BVH sphere query " << i << " of " << count
+            << " objects found " << found[i].size() << ", brute force "
+            << expected[i].size() << std::endl;
+        return false;
+      }
+    }
+
+    out << std::setw(10) << count << std::setw(10) << bvh.getNodeCount()
+        << std::setw(10) << buildMs << std::setw(10) << refitMs
+        << std::setw(10) << frustumMs / queries << std::setw(10)
+        << bruteMs / queries << std::setw(10) << rayMs / queries
+        << std::setw(10) << sphereMs / queries << std::endl;
+  }
+  return true;
+}
+
+// Closed sphere of rings * segments * 2 triangles, counter-clockwise seen
+// from outside
+OccluderMesh sphereOccluder(const glm::vec3 &center, float radius, int rings,
+                            int segments) {
+  OccluderMesh mesh;
+  for (int ring = 0; ring <= rings; ++ring) {
+    float theta = glm::pi<float>() * ring / rings;
+    for (int segment = 0; segment < segments; ++segment) {
+      float phi = glm::two_pi<float>() * segment / segments;
+      mesh.positions.push_back(
+          center + radius * glm::vec3(std::sin(theta) * std::cos(phi),
+                                      std::cos(theta),
+                                      std::sin(theta) * std::sin(phi)));
+    }
+  }
+  auto vertex = [&](int ring, int segment) {
+    return (uint32_t)(ring * segments + segment % segments);
+  };
+  for (int ring = 0; ring < rings; ++ring) {
+    for (int segment = 0; segment < segments; ++segment) {
+      uint32_t quad[4] = {vertex(ring, segment), vertex(ring, segment + 1),
+                          vertex(ring + 1, segment + 1),
+                          vertex(ring + 1, segment)};
+      for (int first : {0, 2}) {
+        uint32_t a = quad[0], b = quad[first + 1], c = quad[(first + 2) % 4];
+        glm::vec3 normal = glm::cross(mesh.positions[b] - mesh.positions[a],
+                                      mesh.positions[c] - mesh.positions[a]);
+        if (glm::dot(normal, mesh.positions[a] - center) < 0.0f)
+          std::swap(b, c);
+        mesh.indices.insert(mesh.indices.end(), {a, b, c});
+      }
+    }
+  }
+  return mesh;
+}
+
+bool benchOcclusion(std::ostream &out) {
+  const size_t count = 100000;
+  out << "Occlusion culling (256x128, " << count << " boxes)" << std::endl;
+  out << std::setw(12) << "path" << std::setw(10) << "items"
+      << std::setw(12) << "ms" << std::setw(14) << "items/ms" << std::endl;
+
+  // the camera looks down -z from the origin
+  glm::mat4 viewProjection =
+      glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f);
+  std::mt19937 engine(777u);
+  std::uniform_real_distribution<float> xyDist(-15.0f, 15.0f);
+  std::uniform_real_distribution<float> zDist(-40.0f, -5.0f);
+  std::uniform_real_distribution<float> sizeDist(0.1f, 1.0f);
+  std::vector<Aabb> boxes(count);
+  for (Aabb &box : boxes) {
+    glm::vec3 center(xyDist(engine), xyDist(engine), zDist(engine));
+    glm::vec3 half(sizeDist(engine), sizeDist(engine), sizeDist(engine));
+    box = {center - half, center + half};
+  }
+
+  // timing: a row of spheres, about what a frame of the demo draws
+  std::vector<OccluderMesh> spheres;
+  for (int i = 0; i < 8; ++i)
+    spheres.push_back(sphereOccluder(
+        glm::vec3(-14.0f + 4.0f * i, 0.0f, -25.0f), 2.5f, 16, 32));
+  size_t triangles = 0;
+  OcclusionBuffer buffer;
+  auto drawSpheres = [&](ThreadPool *workers) {
+    buffer.begin(viewProjection);
+    for (const OccluderMesh &sphere : spheres)
+      buffer.addOccluder(sphere, glm::mat4(1.0f));
+    buffer.rasterize(workers);
+    triangles = buffer.getTriangleCount();
+  };
+  ThreadPool pool;
+  double serialMs = bestOfMs(20, [&] { drawSpheres(nullptr); });
+  double parallelMs = bestOfMs(20, [&] { drawSpheres(&pool); });
+  size_t sphereCulled = 0;
+  double testMs = bestOfMs(5, [&] {
+    sphereCulled = 0;
+    for (const Aabb &box : boxes)
+      sphereCulled += !buffer.isVisible(box);
+  });
+  printRow(out, "raster 1t", triangles, serialMs);
+  printRow(out, "raster pool", triangles, parallelMs);
+  printRow(out, "box tests", count, testMs);
+
+  // correctness: a wall square at z = -20 hides exactly the boxes behind
+  // it whose corners all project into it. Turned in its plane the edges
+  // cross pixels diagonally, partly covered pixels must not hide a box.
+  // It stays on screen either way, off screen box corners are not drawn.
+  const float wallZ = -20.0f, wallHalf = 8.0f;
+  OccluderMesh wall;
+  wall.positions = {{-wallHalf, -wallHalf, wallZ},
+                    {wallHalf, -wallHalf, wallZ},
+                    {wallHalf, wallHalf, wallZ},
+                    {-wallHalf, wallHalf, wallZ}};
+  wall.indices = {0, 1, 2, 0, 2, 3};
+  size_t hidden = 0, culled = 0;
+  for (float angle : {0.0f, 0.3f}) {
+    glm::mat4 turn =
+        glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 0.0f, 1.0f));
+    buffer.begin(viewProjection);
+    buffer.addOccluder(wall, turn);
+    buffer.rasterize(&pool);
+
+    glm::mat4 unturn = glm::inverse(turn);
+    for (const Aabb &box : boxes) {
+      bool isHidden = true;
+      for (int corner = 0; corner < 8 && isHidden; ++corner) {
+        glm::vec3 position(corner & 1 ? box.max.x : box.min.x,
+                           corner & 2 ? box.max.y : box.min.y,
+                           corner & 4 ? box.max.z : box.min.z);
+        glm::vec2 onWall =
+            glm::vec2(unturn * glm::vec4(position, 1.0f)) *
+            (wallZ / position.z);
+        isHidden = position.z < wallZ && std::abs(onWall.x) <= wallHalf &&
+                   std::abs(onWall.y) <= wallHalf;
+      }
+      hidden += isHidden;
+      if (!buffer.isVisible(box)) {
+        if (!isHidden) {
+          out << "MISMATCH: occlusion culled a box in front of or beside "
+                 "the wall"
+              << std::endl;
+          return false;
+        }
+        ++culled;
+      }
+    }
+  }
+  out << std::setw(12) << "culled" << std::setw(10) << sphereCulled
+      << "  by the spheres" << std::endl;
+  out << std::setw(12) << "wall" << std::setw(10) << culled << "  of "
+      << hidden << " hidden boxes culled, none visible" << std::endl;
+  return true;
+}
+
+// Rows top to bottom mirrored, like a flipped load
+void flipRows(std::vector<uint8_t> &rgba, int width, int height) {
+  size_t rowBytes = (size_t)width * 4;
+  for (int y = 0; y < height / 2; ++y)
+    std::swap_ranges(rgba.begin() + y * rowBytes,
+                     rgba.begin() + (y + 1) * rowBytes,
+                     rgba.begin() + (height - 1 - y) * rowBytes);
+}
+
+struct TestImage {
+  std::string name;
+  int width, height;
+  std::vector<uint8_t> rgba;
+};
+
+// Smooth colors with a soft alpha edge and a normal map of sine bumps, the
+// normal map at sizes that are not a multiple of 4
+std::vector<TestImage> syntheticImages() {
+  std::vector<TestImage> images;
+  TestImage gradient{"gradient", 64, 64, {}};
+  for (int y = 0; y < gradient.height; ++y) {
+    for (int x = 0; x < gradient.width; ++x) {
+      float radius = glm::length(glm::vec2(x - 32.0f, y - 32.0f)) / 32.0f;
+      gradient.rgba.insert(
+          gradient.rgba.end(),
+          {(uint8_t)(x * 4), (uint8_t)(y * 4), (uint8_t)((x + y) * 2),
+           (uint8_t)(255.0f * glm::clamp(1.5f - radius, 0.0f, 1.0f))});
+    }
+  }
+  images.push_back(std::move(gradient));
+
+  TestImage normals{"normals", 61, 37, {}};
+  for (int y = 0; y < normals.height; ++y) {
+    for (int x = 0; x < normals.width; ++x) {
+      // gradient of sin(x / 5) * cos(y / 7)
+      glm::vec3 normal = glm::normalize(glm::vec3(
+          -std::cos(x / 5.0f) * std::cos(y / 7.0f) / 5.0f,
+          std::sin(x / 5.0f) * std::sin(y / 7.0f) / 7.0f, 1.0f));
+      glm::vec3 encoded = (normal * 0.5f + 0.5f) * 255.0f + 0.5f;
+      normals.rgba.insert(normals.rgba.end(),
+                          {(uint8_t)encoded.x, (uint8_t)encoded.y,
+                           (uint8_t)encoded.z, 255});
+    }
+  }
+  images.push_back(std::move(normals));
+  return images;
+}
+
+bool benchBlockCompression(std::ostream &out) {
+  // texconv's default --min-psnr
+  const double minPsnr = 30.0;
+  const BlockFormat formats[] = {BlockFormat::BC1, BlockFormat::BC3,
+                                 BlockFormat::BC5};
+  out << "Block compression (round trip, at least " << minPsnr << " dB)"
+      << std::endl;
+  out << std::setw(12) << "image" << std::setw(10) << "format"
+      << std::setw(12) << "ms" << std::setw(14) << "PSNR dB" << std::endl;
+
+  std::vector<TestImage> images = syntheticImages();
+  // the textures texconv converts, relative to the binary like the models
+  for (const char *path : {"assets/leaf/leaf.png", "assets/window/window.png",
+                           "assets/planet/specular.png",
+                           "assets/ball/diffuse.jpg"}) {
+    int width = 0, height = 0, channels = 0;
+    stbi_set_flip_vertically_on_load(false);
+    uint8_t *pixels = stbi_load(path, &width, &height, &channels, 4);
+    if (!pixels) {
+      out << std::setw(12) << "skipped" << "  " << path << std::endl;
+      continue;
+    }
+    std::string name = path;
+    name = name.substr(name.find('/') + 1);
+    images.push_back({name.substr(0, name.find('/')), width, height,
+                      std::vector<uint8_t>(
+                          pixels, pixels + (size_t)width * height * 4)});
+    stbi_image_free(pixels);
+  }
+
+  bool ok = true;
+  std::vector<uint8_t> blocks, decoded;
+  for (const TestImage &image : images) {
+    size_t pixelCount = (size_t)image.width * image.height;
+    for (BlockFormat format : formats) {
+      blocks.resize(compressedSize(format, image.width, image.height));
+      decoded.resize(pixelCount * 4);
+      double encodeMs = bestOfMs(1, [&] {
+        compressImage(format, image.rgba.data(), image.width, image.height,
+                      blocks.data());
+      });
+      decompressImage(format, blocks.data(), image.width, image.height,
+                      decoded.data());
+      double quality =
+          psnr(format, image.rgba.data(), decoded.data(), pixelCount);
+      out << std::setw(12) << image.name << std::setw(10)
+          << "BC" + std::to_string((int)format) << std::setw(12) << encodeMs
+          << std::setw(14) << quality << std::endl;
+      if (!(quality >= minPsnr)) {
+        out << "MISMATCH: " << image.name << " BC" << (int)format
+            << " below " << minPsnr << " dB" << std::endl;
+        ok = false;
+      }
+    }
+  }
+
+  // flipping the blocks against flipping the decoded pixels: exact while
+  // whole block rows move, within the PSNR gate where they are re-encoded
+  const TestImage &source = images[0];
+  for (BlockFormat format : formats) {
+    for (int height : {1, 2, 3, 4, 8, 16, 5, 6, 7, 13, 30}) {
+      for (int width : {12, 13}) {
+        std::vector<uint8_t> rgba;
+        for (int y = 0; y < height; ++y)
+          rgba.insert(rgba.end(),
+                      source.rgba.begin() + (size_t)y * source.width * 4,
+                      source.rgba.begin() +
+                          ((size_t)y * source.width + width) * 4);
+        blocks.resize(compressedSize(format, width, height));
+        compressImage(format, rgba.data(), width, height, blocks.data());
+
+        std::vector<uint8_t> expected((size_t)width * height * 4);
+        decompressImage(format, blocks.data(), width, height,
+                        expected.data());
+        flipRows(expected, width, height);
+        flipBlocksVertically(format, blocks.data(), width, height);
+        decoded.resize(expected.size());
+        decompressImage(format, blocks.data(), width, height,
+                        decoded.data());
+
+        bool exact = height % 4 == 0 || height < 4;
+        double quality = psnr(format, expected.data(), decoded.data(),
+                              (size_t)width * height);
+        if (exact ? decoded != expected : !(quality >= minPsnr)) {
+          out << "MISMATCH: BC" << (int)format << " " << width << "x"
+              << height << " flipped blocks differ from flipped pixels"
+              << std::endl;
+          ok = false;
+        }
+      }
+    }
+  }
+  out << std::setw(12) << "flip" << std::setw(10) << "" << "  heights 1-8, "
+      << "13, 16, 30 checked against flipped decodes" << std::endl;
+  return ok;
+}
+
+} // namespace
+
+bool runBenchmarks(std::ostream &out) {
+  out << std::fixed << std::setprecision(3);
+  bool ok = benchFrustumCulling(out);
+  out << std::endl;
+  ok = benchNormalMatrices(out) && ok;
+  out << std::endl;
+  ok = benchVertexPacking(out) && ok;
+  out << std::endl;
+  ok = benchSceneGraph(out) && ok;
+  out << std::endl;
+  ok = benchBvh(out) && ok;
+  out << std::endl;
+  ok = benchOcclusion(out) && ok;
+  out << std::endl;
+  ok = benchBlockCompression(out) && ok;
+  return ok;
+}
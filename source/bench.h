@@ -0,0 +1,11 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <ostream>
+
+// CPU micro benchmarks for the per-frame stages that do not need a GL
+// context (--bench). Each one also checks its fast path against the
+// reference implementation; returns false on a mismatch.
+bool runBenchmarks(std::ostream &out);
+
+#endif // !BENCH_H
@@ -0,0 +1,430 @@
+#include "blockcompress.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+uint16_t pack565(const float color[3]) {
+  int r = std::clamp((int)(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+  int g = std::clamp((int)(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+  int b = std::clamp((int)(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void unpack565(uint16_t value, int color[3]) {
+  int r = (value >> 11) & 31, g = (value >> 5) & 63, b = value & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+// BC3 color blocks are always decoded in four color mode
+void colorPalette(uint16_t c0, uint16_t c1, bool forceFourColor,
+                  int palette[4][3]) {
+  unpack565(c0, palette[0]);
+  unpack565(c1, palette[1]);
+  for (int c = 0; c < 3; ++c) {
+    int a = palette[0][c], b = palette[1][c];
+    if (c0 > c1 || forceFourColor) {
+      palette[2][c] = (2 * a + b) / 3;
+      palette[3][c] = (a + 2 * b) / 3;
+    } else {
+      palette[2][c] = (a + b) / 2;
+      palette[3][c] = 0;
+    }
+  }
+}
+
+int colorDistance(const uint8_t *pixel, const int color[3]) {
+  int dr = pixel[0] - color[0], dg = pixel[1] - color[1],
+      db = pixel[2] - color[2];
+  return dr * dr + dg * dg + db * db;
+}
+
+// 2 bit index per pixel, pixel 0 in the low bits; returns the squared error
+int colorIndices(const uint8_t block[64], const int palette[4][3],
+                 uint32_t &indices) {
+  int error = 0;
+  indices = 0;
+  for (int i = 0; i < 16; ++i) {
+    int best = 0, bestDistance = INT_MAX;
+    for (int p = 0; p < 4; ++p) {
+      int distance = colorDistance(block + i * 4, palette[p]);
+      if (distance < bestDistance) {
+        bestDistance = distance;
+        best = p;
+      }
+    }
+    indices |= (uint32_t)best << (2 * i);
+    error += bestDistance;
+  }
+  return error;
+}
+
+void writeColorBlock(uint16_t c0, uint16_t c1, uint32_t indices,
+                     uint8_t out[8]) {
+  out[0] = c0 & 0xFF;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xFF;
+  out[3] = c1 >> 8;
+  for (int i = 0; i < 4; ++i)
+    out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// Endpoints on the principal axis of the block colors, then two rounds of
+// least squares refinement against the chosen indices. Always emits four
+// color mode (c0 > c1) unless the block is a single 565 color.
+void encodeColorBlock(const uint8_t block[64], uint8_t out[8]) {
+  float mean[3] = {};
+  for (int i = 0; i < 16; ++i)
+    for (int c = 0; c < 3; ++c)
+      mean[c] += block[i * 4 + c];
+  for (float &m : mean)
+    m /= 16.0f;
+
+  float cov[6] = {};
+  for (int i = 0; i < 16; ++i) {
+    float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1],
+          b = block[i * 4 + 2] - mean[2];
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    float length = std::max({std::fabs(x), std::fabs(y), std::fabs(z)});
+    if (length < 1e-6f)
+      break;
+    axis[0] = x / length;
+    axis[1] = y / length;
+    axis[2] = z / length;
+  }
+
+  float minT = 0.0f, maxT = 0.0f;
+  float lengthSq =
+      axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+  for (int i = 0; i < 16; ++i) {
+    float t = 0.0f;
+    for (int c = 0; c < 3; ++c)
+      t += (block[i * 4 + c] - mean[c]) * axis[c];
+    t /= lengthSq;
+    minT = std::min(minT, t);
+    maxT = std::max(maxT, t);
+  }
+
+  float end0[3], end1[3];
+  for (int c = 0; c < 3; ++c) {
+    end0[c] = mean[c] + axis[c] * maxT;
+    end1[c] = mean[c] + axis[c] * minT;
+  }
+
+  uint16_t bestC0 = 0, bestC1 = 0;
+  uint32_t bestIndices = 0;
+  int bestError = INT_MAX;
+  for (int round = 0; round < 3; ++round) {
+    uint16_t c0 = pack565(end0), c1 = pack565(end1);
+    if (c0 < c1) {
+      std::swap(c0, c1);
+      std::swap(end0, end1);
+    }
+
+    int palette[4][3];
+    colorPalette(c0, c1, true, palette);
+    uint32_t indices = 0;
+    int error = c0 == c1 ? 0 : colorIndices(block, palette, indices);
+    if (c0 == c1)
+      for (int i = 0; i < 16; ++i)
+        error += colorDistance(block + i * 4, palette[0]);
+
+    if (error < bestError) {
+      bestError = error;
+      bestC0 = c0;
+      bestC1 = c1;
+      bestIndices = indices;
+    }
+    if (c0 == c1 || error == 0)
+      break;
+
+    // solve for the endpoints that best reproduce the chosen indices
+    static const float kWeight[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {}, bx[3] = {};
+    for (int i = 0; i < 16; ++i) {
+      float a = kWeight[(indices >> (2 * i)) & 3], b = 1.0f - a;
+      aa += a * a;
+      bb += b * b;
+      ab += a * b;
+      for (int c = 0; c < 3; ++c) {
+        ax[c] += a * block[i * 4 + c];
+        bx[c] += b * block[i * 4 + c];
+      }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f)
+      break;
+    for (int c = 0; c < 3; ++c) {
+      end0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.0f, 255.0f);
+      end1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.0f, 255.0f);
+    }
+  }
+
+  writeColorBlock(bestC0, bestC1, bestIndices, out);
+}
+
+void decodeColorBlock(const uint8_t in[8], bool forceFourColor,
+                      uint8_t block[64]) {
+  uint16_t c0 = in[0] | (in[1] << 8), c1 = in[2] | (in[3] << 8);
+  int palette[4][3];
+  colorPalette(c0, c1, forceFourColor, palette);
+  uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (in[7] << 24);
+  for (int i = 0; i < 16; ++i) {
+    int index = (indices >> (2 * i)) & 3;
+    for (int c = 0; c < 3; ++c)
+      block[i * 4 + c] = (uint8_t)palette[index][c];
+    block[i * 4 + 3] = (!forceFourColor && c0 <= c1 && index == 3) ? 0 : 255;
+  }
+}
+
+void alphaPalette(int a0, int a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1) {
+    for (int i = 2; i < 8; ++i)
+      palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+  } else {
+    for (int i = 2; i < 6; ++i)
+      palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+// Single channel BC4 block, eight value mode over the block's range.
+// values points at the channel inside an RGBA block.
+void encodeAlphaBlock(const uint8_t *values, uint8_t out[8]) {
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; ++i) {
+    lo = std::min(lo, (int)values[i * 4]);
+    hi = std::max(hi, (int)values[i * 4]);
+  }
+
+  int palette[8];
+  alphaPalette(hi, lo, palette);
+  uint64_t indices = 0;
+  if (hi != lo) {
+    for (int i = 0; i < 16; ++i) {
+      int best = 0, bestDistance = INT_MAX;
+      for (int p = 0; p < 8; ++p) {
+        int distance = std::abs(values[i * 4] - palette[p]);
+        if (distance < bestDistance) {
+          bestDistance = distance;
+          best = p;
+        }
+      }
+      indices |= (uint64_t)best << (3 * i);
+    }
+  }
+
+  out[0] = (uint8_t)hi;
+  out[1] = (uint8_t)lo;
+  for (int i = 0; i < 6; ++i)
+    out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+void decodeAlphaBlock(const uint8_t in[8], uint8_t *values) {
+  int palette[8];
+  alphaPalette(in[0], in[1], palette);
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; ++i)
+    indices |= (uint64_t)in[2 + i] << (8 * i);
+  for (int i = 0; i < 16; ++i)
+    values[i * 4] = (uint8_t)palette[(indices >> (3 * i)) & 7];
+}
+
+// Reverses the first `rows` pixel rows of a block in place
+void flipColorRows(uint8_t block[8], int rows) {
+  std::reverse(block + 4, block + 4 + rows);
+}
+
+void flipAlphaRows(uint8_t block[8], int rows) {
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; ++i)
+    indices |= (uint64_t)block[2 + i] << (8 * i);
+
+  uint64_t flipped = indices;
+  for (int row = 0; row < rows; ++row) {
+    uint64_t bits = (indices >> (12 * row)) & 0xFFF;
+    int target = rows - 1 - row;
+    flipped &= ~(0xFFFull << (12 * target));
+    flipped |= bits << (12 * target);
+  }
+  for (int i = 0; i < 6; ++i)
+    block[2 + i] = (flipped >> (8 * i)) & 0xFF;
+}
+
+void flipBlockRows(BlockFormat format, uint8_t *block, int rows) {
+  switch (format) {
+  case BlockFormat::BC1:
+    flipColorRows(block, rows);
+    break;
+  case BlockFormat::BC3:
+    flipAlphaRows(block, rows);
+    flipColorRows(block + 8, rows);
+    break;
+  case BlockFormat::BC5:
+    flipAlphaRows(block, rows);
+    flipAlphaRows(block + 8, rows);
+    break;
+  }
+}
+
+} // namespace
+
+size_t blockBytes(BlockFormat format) {
+  return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t compressedSize(BlockFormat format, int width, int height) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+void compressImage(BlockFormat format, const uint8_t *rgba, int width,
+                   int height, uint8_t *blocks) {
+  size_t stride = blockBytes(format);
+  uint8_t block[64];
+  for (int by = 0; by < height; by += 4) {
+    for (int bx = 0; bx < width; bx += 4) {
+      for (int y = 0; y < 4; ++y) {
+        int sy = std::min(by + y, height - 1);
+        for (int x = 0; x < 4; ++x) {
+          int sx = std::min(bx + x, width - 1);
+          std::memcpy(block + (y * 4 + x) * 4,
+                      rgba + ((size_t)sy * width + sx) * 4, 4);
+        }
+      }
+
+      switch (format) {
+      case BlockFormat::BC1:
+        encodeColorBlock(block, blocks);
+        break;
+      case BlockFormat::BC3:
+        encodeAlphaBlock(block + 3, blocks);
+        encodeColorBlock(block, blocks + 8);
+        break;
+      case BlockFormat::BC5:
+        encodeAlphaBlock(block, blocks);
+        encodeAlphaBlock(block + 1, blocks + 8);
+        break;
+      }
+      blocks += stride;
+    }
+  }
+}
+
+void decompressImage(BlockFormat format, const uint8_t *blocks, int width,
+                     int height, uint8_t *rgba) {
+  size_t stride = blockBytes(format);
+  uint8_t block[64];
+  for (int by = 0; by < height; by += 4) {
+    for (int bx = 0; bx < width; bx += 4) {
+      switch (format) {
+      case BlockFormat::BC1:
+        decodeColorBlock(blocks, false, block);
+        break;
+      case BlockFormat::BC3:
+        decodeColorBlock(blocks + 8, true, block);
+        decodeAlphaBlock(blocks, block + 3);
+        break;
+      case BlockFormat::BC5:
+        decodeAlphaBlock(blocks, block);
+        decodeAlphaBlock(blocks + 8, block + 1);
+        for (int i = 0; i < 16; ++i) {
+          block[i * 4 + 2] = 0;
+          block[i * 4 + 3] = 255;
+        }
+        break;
+      }
+      blocks += stride;
+
+      for (int y = 0; y < 4 && by + y < height; ++y)
+        for (int x = 0; x < 4 && bx + x < width; ++x)
+          std::memcpy(rgba + ((size_t)(by + y) * width + bx + x) * 4,
+                      block + (y * 4 + x) * 4, 4);
+    }
+  }
+}
+
+void flipBlocksVertically(BlockFormat format, uint8_t *blocks, int width,
+                          int height) {
+  size_t stride = blockBytes(format);
+  size_t rowBytes = (size_t)((width + 3) / 4) * stride;
+  int blockRows = (height + 3) / 4;
+
+  if (height % 4 != 0 && height > 4) {
+    // block rows straddle the mirror line, take the slow path
+    std::vector<uint8_t> rgba((size_t)width * height * 4);
+    decompressImage(format, blocks, width, height, rgba.data());
+    size_t pixelRow = (size_t)width * 4;
+    for (int y = 0; y < height / 2; ++y)
+      std::swap_ranges(rgba.begin() + y * pixelRow,
+                       rgba.begin() + (y + 1) * pixelRow,
+                       rgba.begin() + (height - 1 - y) * pixelRow);
+    compressImage(format, rgba.data(), width, height, blocks);
+    return;
+  }
+
+  for (int row = 0; row < blockRows / 2; ++row)
+    std::swap_ranges(blocks + row * rowBytes, blocks + (row + 1) * rowBytes,
+                     blocks + (blockRows - 1 - row) * rowBytes);
+
+  int rows = std::min(height, 4);
+  size_t blockCount = rowBytes / stride * blockRows;
+  for (size_t i = 0; i < blockCount; ++i)
+    flipBlockRows(format, blocks + i * stride, rows);
+}
+
+void downsample(const uint8_t *rgba, int width, int height,
+                std::vector<uint8_t> &out) {
+  int outWidth = std::max(width / 2, 1), outHeight = std::max(height / 2, 1);
+  out.resize((size_t)outWidth * outHeight * 4);
+  for (int y = 0; y < outHeight; ++y) {
+    int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+    for (int x = 0; x < outWidth; ++x) {
+      int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+      for (int c = 0; c < 4; ++c) {
+        int sum = rgba[((size_t)y0 * width + x0) * 4 + c] +
+                  rgba[((size_t)y0 * width + x1) * 4 + c] +
+                  rgba[((size_t)y1 * width + x0) * 4 + c] +
+                  rgba[((size_t)y1 * width + x1) * 4 + c];
+        out[((size_t)y * outWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+double psnr(BlockFormat format, const uint8_t *reference,
+            const uint8_t *decoded, size_t pixelCount) {
+  int channels = format == BlockFormat::BC3   ? 4
+                 : format == BlockFormat::BC5 ? 2
+                                              : 3;
+  double sum = 0.0;
+  for (size_t i = 0; i < pixelCount; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      double diff = (double)reference[i * 4 + c] - decoded[i * 4 + c];
+      sum += diff * diff;
+    }
+  }
+  double mse = sum / ((double)pixelCount * channels);
+  if (mse <= 0.0)
+    return 99.0;
+  return std::min(99.0, 10.0 * std::log10(255.0 * 255.0 / mse));
+}
@@ -0,0 +1,40 @@
+#ifndef BLOCKCOMPRESS_H
+#define BLOCKCOMPRESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CPU encoder / decoder for the S3TC / RGTC block formats. Images are RGBA8,
+// rows top to bottom; edge blocks of sizes that are not a multiple of 4
+// replicate the last row / column.
+enum class BlockFormat : uint32_t {
+  BC1 = 1, // RGB, 4 bpp
+  BC3 = 3, // RGBA, 8 bpp
+  BC5 = 5, // RG (normal maps), 8 bpp
+};
+
+size_t blockBytes(BlockFormat format);
+size_t compressedSize(BlockFormat format, int width, int height);
+
+void compressImage(BlockFormat format, const uint8_t *rgba, int width,
+                   int height, uint8_t *blocks);
+// BC5 writes 0 to blue and 255 to alpha, BC1 255 to alpha
+void decompressImage(BlockFormat format, const uint8_t *blocks, int width,
+                     int height, uint8_t *rgba);
+
+// Mirrors a compressed image top to bottom. Whole block rows are swapped and
+// the rows inside each block reversed; levels whose height is not a
+// multiple of 4 (only small mips in practice) are decoded and re-encoded.
+void flipBlocksVertically(BlockFormat format, uint8_t *blocks, int width,
+                          int height);
+
+// 2x2 box filter, odd sizes clamp the last row / column
+void downsample(const uint8_t *rgba, int width, int height,
+                std::vector<uint8_t> &out);
+
+// PSNR in dB over the channels the format stores, 99 for identical images
+double psnr(BlockFormat format, const uint8_t *reference,
+            const uint8_t *decoded, size_t pixelCount);
+
+#endif // !BLOCKCOMPRESS_H
@@ -0,0 +1,327 @@
+#include "bvh.h"
+
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+const int kBinCount = 16;
+// Below this depth nodes are halved instead of split by SAH, which keeps
+// the depth under kMaxDepth + 32 and the query stacks fixed
+const int kMaxDepth = 64;
+const int kStackSize = kMaxDepth + 34;
+
+// ray against box, entry distance or a miss
+bool rayBox(const Aabb &box, const glm::vec3 &origin,
+            const glm::vec3 &inverseDirection, float maxDistance,
+            float &entry) {
+  if (box.isEmpty())
+    return false;
+  float near = 0.0f, far = maxDistance;
+  for (int axis = 0; axis < 3; ++axis) {
+    float t0 = (box.min[axis] - origin[axis]) * inverseDirection[axis];
+    float t1 = (box.max[axis] - origin[axis]) * inverseDirection[axis];
+    // fmin / fmax drop the NaN of a zero direction inside the slab
+    near = std::fmax(near, std::fmin(t0, t1));
+    far = std::fmin(far, std::fmax(t0, t1));
+  }
+  entry = near;
+  return near <= far;
+}
+
+bool sphereBox(const Aabb &box, const glm::vec3 &center, float radius) {
+  if (box.isEmpty())
+    return false;
+  glm::vec3 offset = center - glm::clamp(center, box.min, box.max);
+  return glm::dot(offset, offset) <= radius * radius;
+}
+
+} // namespace
+
+void Bvh::build(const Aabb *bounds, size_t count) {
+  m_Bounds.assign(bounds, bounds + count);
+  m_Objects.resize(count);
+  m_Leaves.assign(count, 0);
+  m_Nodes.clear();
+  m_Nodes.reserve(count ? 2 * count / kMaxLeafObjects + 1 : 0);
+  m_AnyDirty = false;
+
+  // partitioned in place, sequential where m_Bounds would be random
+  std::vector<BuildItem> items(count);
+  for (size_t i = 0; i < count; ++i) {
+    items[i].bounds = bounds[i];
+    // empty boxes go anywhere, they never grow a node
+    items[i].center =
+        bounds[i].isEmpty() ? glm::vec3(0.0f) : bounds[i].center();
+    items[i].object = (uint32_t)i;
+  }
+  if (count == 0) {
+    m_Dirty.clear();
+    return;
+  }
+
+  m_Nodes.push_back({Aabb::empty(), 0, (uint32_t)count, 0, 0});
+  buildNode(0, 0, items);
+  m_Dirty.assign(m_Nodes.size(), 0);
+}
+
+void Bvh::buildNode(uint32_t index, int depth,
+                    std::vector<BuildItem> &items) {
+  uint32_t first = m_Nodes[index].first;
+  uint32_t count = m_Nodes[index].count;
+  Aabb bounds = Aabb::empty(), centerBounds = Aabb::empty();
+  for (uint32_t i = first; i < first + count; ++i) {
+    bounds.expand(items[i].bounds);
+    centerBounds.expand(items[i].center);
+  }
+  m_Nodes[index].bounds = bounds;
+
+  if (count <= kMaxLeafObjects) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      m_Objects[i] = items[i].object;
+      m_Leaves[items[i].object] = index;
+    }
+    return;
+  }
+
+  // binned SAH on every axis at once, the cost of a split is
+  // area(left) * count(left) + area(right) * count(right)
+  glm::vec3 extent = centerBounds.max - centerBounds.min;
+  glm::vec3 scale(0.0f);
+  for (int axis = 0; axis < 3; ++axis)
+    if (extent[axis] > 0.0f)
+      scale[axis] = kBinCount / extent[axis];
+  Aabb binBounds[3][kBinCount];
+  uint32_t binCounts[3][kBinCount] = {};
+  for (int axis = 0; axis < 3; ++axis)
+    for (int bin = 0; bin < kBinCount; ++bin)
+      binBounds[axis][bin] = Aabb::empty();
+  for (uint32_t i = first; i < first + count; ++i) {
+    glm::vec3 position = (items[i].center - centerBounds.min) * scale;
+    for (int axis = 0; axis < 3; ++axis) {
+      int bin = std::min(kBinCount - 1, (int)position[axis]);
+      binBounds[axis][bin].expand(items[i].bounds);
+      ++binCounts[axis][bin];
+    }
+  }
+
+  int bestAxis = -1, bestSplit = 0;
+  float bestCost = FLT_MAX;
+  for (int axis = 0; axis < 3 && depth < kMaxDepth; ++axis) {
+    if (scale[axis] == 0.0f)
+      continue;
+    // sweep from the right, then from the left evaluating each split
+    float rightArea[kBinCount];
+    uint32_t rightCount[kBinCount];
+    Aabb right = Aabb::empty();
+    uint32_t rightObjects = 0;
+    for (int bin = kBinCount - 1; bin > 0; --bin) {
+      right.expand(binBounds[axis][bin]);
+      rightObjects += binCounts[axis][bin];
+      rightArea[bin] = right.surfaceArea();
+      rightCount[bin] = rightObjects;
+    }
+    Aabb left = Aabb::empty();
+    uint32_t leftObjects = 0;
+    for (int split = 1; split < kBinCount; ++split) {
+      left.expand(binBounds[axis][split - 1]);
+      leftObjects += binCounts[axis][split - 1];
+      if (leftObjects == 0 || rightCount[split] == 0)
+        continue;
+      float cost = left.surfaceArea() * leftObjects +
+                   rightArea[split] * rightCount[split];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = split;
+      }
+    }
+  }
+
+  BuildItem *begin = items.data() + first;
+  BuildItem *middle;
+  if (bestAxis >= 0) {
+    float origin = centerBounds.min[bestAxis];
+    middle = std::partition(begin, begin + count, [&](const BuildItem &item) {
+      int bin = std::min(
+          kBinCount - 1,
+          (int)((item.center[bestAxis] - origin) * scale[bestAxis]));
+      return bin < bestSplit;
+    });
+  } else {
+    // every center in one point or too deep, any halving will do
+    middle = begin + count / 2;
+  }
+  uint32_t leftCount = (uint32_t)(middle - begin);
+
+  uint32_t left = (uint32_t)m_Nodes.size();
+  m_Nodes.push_back({Aabb::empty(), first, leftCount, 0, index});
+  buildNode(left, depth + 1, items);
+  uint32_t right = (uint32_t)m_Nodes.size();
+  m_Nodes.push_back(
+      {Aabb::empty(), first + leftCount, count - leftCount, 0, index});
+  buildNode(right, depth + 1, items);
+  m_Nodes[index].right = right;
+}
+
+void Bvh::update(uint32_t object, const Aabb &bounds) {
+  m_Bounds[object] = bounds;
+  uint32_t node = m_Leaves[object];
+  m_LastDirty = m_AnyDirty ? std::max(m_LastDirty, (size_t)node) : node;
+  m_AnyDirty = true;
+  // ancestors up to the first one flagged already
+  for (;;) {
+    if (m_Dirty[node])
+      break;
+    m_Dirty[node] = 1;
+    if (node == 0)
+      break;
+    node = m_Nodes[node].parent;
+  }
+}
+
+size_t Bvh::refit() {
+  if (!m_AnyDirty)
+    return 0;
+  size_t refitted = 0;
+  // children come after their parent, so backwards every child is final
+  for (size_t index = m_LastDirty + 1; index-- > 0;) {
+    if (!m_Dirty[index])
+      continue;
+    m_Dirty[index] = 0;
+    Node &node = m_Nodes[index];
+    if (node.right) {
+      node.bounds = m_Nodes[index + 1].bounds;
+      node.bounds.expand(m_Nodes[node.right].bounds);
+    } else {
+      node.bounds = Aabb::empty();
+      for (uint32_t i = node.first; i < node.first + node.count; ++i)
+        node.bounds.expand(m_Bounds[m_Objects[i]]);
+    }
+    ++refitted;
+  }
+  m_AnyDirty = false;
+  return refitted;
+}
+
+void Bvh::appendObjects(const Node &node,
+                        std::vector<uint32_t> &objects) const {
+  for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+    if (!m_Bounds[m_Objects[i]].isEmpty())
+      objects.push_back(m_Objects[i]);
+  }
+}
+
+void Bvh::queryFrustum(const Frustum &frustum,
+                       std::vector<uint32_t> &objects) const {
+  if (m_Nodes.empty())
+    return;
+  uint32_t stack[kStackSize];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node &node = m_Nodes[stack[--top]];
+    Containment containment = classifyBox(frustum, node.bounds);
+    if (containment == Containment::Outside)
+      continue;
+    if (containment == Containment::Inside) {
+      appendObjects(node, objects);
+      continue;
+    }
+    if (node.right == 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        uint32_t object = m_Objects[i];
+        if (classifyBox(frustum, m_Bounds[object]) != Containment::Outside)
+          objects.push_back(object);
+      }
+      continue;
+    }
+    stack[top++] = node.right;
+    stack[top++] = (uint32_t)(&node - m_Nodes.data()) + 1;
+  }
+}
+
+void Bvh::querySphere(const glm::vec3 &center, float radius,
+                      std::vector<uint32_t> &objects) const {
+  if (m_Nodes.empty())
+    return;
+  uint32_t stack[kStackSize];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    uint32_t index = stack[--top];
+    const Node &node = m_Nodes[index];
+    if (!sphereBox(node.bounds, center, radius))
+      continue;
+    if (node.right == 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        uint32_t object = m_Objects[i];
+        if (sphereBox(m_Bounds[object], center, radius))
+          objects.push_back(object);
+      }
+      continue;
+    }
+    stack[top++] = node.right;
+    stack[top++] = index + 1;
+  }
+}
+
+bool Bvh::raycast(const glm::vec3 &origin, const glm::vec3 &direction,
+                  float maxDistance, uint32_t &object,
+                  float &distance) const {
+  if (m_Nodes.empty())
+    return false;
+  glm::vec3 inverseDirection = 1.0f / direction;
+  float closest = maxDistance;
+  bool hit = false;
+
+  uint32_t stack[kStackSize];
+  int top = 0;
+  float entry;
+  if (!rayBox(m_Nodes[0].bounds, origin, inverseDirection, closest, entry))
+    return false;
+  stack[top++] = 0;
+  while (top > 0) {
+    uint32_t index = stack[--top];
+    const Node &node = m_Nodes[index];
+    // a closer hit may have been found since the node was pushed
+    if (!rayBox(node.bounds, origin, inverseDirection, closest, entry))
+      continue;
+    if (node.right == 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        float t;
+        if (rayBox(m_Bounds[m_Objects[i]], origin, inverseDirection,
+                   closest, t) &&
+            (!hit || t < closest)) {
+          closest = t;
+          object = m_Objects[i];
+          hit = true;
+        }
+      }
+      continue;
+    }
+
+    // the nearer child is popped first
+    uint32_t first = index + 1, second = node.right;
+    float firstEntry = FLT_MAX, secondEntry = FLT_MAX;
+    bool firstHit = rayBox(m_Nodes[first].bounds, origin, inverseDirection,
+                           closest, firstEntry);
+    bool secondHit = rayBox(m_Nodes[second].bounds, origin,
+                            inverseDirection, closest, secondEntry);
+    if (firstHit && secondHit && secondEntry < firstEntry) {
+      std::swap(first, second);
+      std::swap(firstHit, secondHit);
+    }
+    if (secondHit)
+      stack[top++] = second;
+    if (firstHit)
+      stack[top++] = first;
+  }
+  if (hit)
+    distance = closest;
+  return hit;
+}
@@ -0,0 +1,75 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "culling.h"
+
+#include "glm/ext/vector_float3.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over object boxes, GL free like culling.h.
+// build() splits with the binned surface area heuristic. Moving objects
+// change their box with update(); refit() then resizes the ancestors of
+// the changed leaves and keeps the topology, which stays good while the
+// objects move little relative to each other. Rebuild when they do not.
+//
+// Nodes are stored depth first: the left child follows its parent and a
+// node's objects are one contiguous range, so refit() is one backward
+// sweep and a node inside the frustum hands out its range untested.
+class Bvh {
+public:
+  static const uint32_t kMaxLeafObjects = 4;
+
+  // object i is bounds[i]; empty boxes are kept but never found
+  void build(const Aabb *bounds, size_t count);
+  void update(uint32_t object, const Aabb &bounds);
+  // Returns the number of nodes resized
+  size_t refit();
+
+  // The query functions append to objects, in no particular order
+  void queryFrustum(const Frustum &frustum,
+                    std::vector<uint32_t> &objects) const;
+  void querySphere(const glm::vec3 &center, float radius,
+                   std::vector<uint32_t> &objects) const;
+  // Closest object box hit by origin + t * direction for t in
+  // [0, maxDistance], in units of direction. False on a miss.
+  bool raycast(const glm::vec3 &origin, const glm::vec3 &direction,
+               float maxDistance, uint32_t &object, float &distance) const;
+
+  size_t getObjectCount() const { return m_Bounds.size(); }
+  size_t getNodeCount() const { return m_Nodes.size(); }
+  const Aabb &getBounds(uint32_t object) const { return m_Bounds[object]; }
+
+private:
+  struct Node {
+    Aabb bounds;
+    // m_Objects[first, first + count) are the subtree's objects
+    uint32_t first;
+    uint32_t count;
+    // 0 for leaves, the root is never a right child
+    uint32_t right;
+    uint32_t parent;
+  };
+
+  std::vector<Node> m_Nodes;
+  std::vector<uint8_t> m_Dirty;
+  // object ids in leaf order
+  std::vector<uint32_t> m_Objects;
+  std::vector<Aabb> m_Bounds;
+  std::vector<uint32_t> m_Leaves;
+  size_t m_LastDirty = 0;
+  bool m_AnyDirty = false;
+
+  struct BuildItem {
+    Aabb bounds;
+    glm::vec3 center;
+    uint32_t object;
+  };
+
+  void buildNode(uint32_t node, int depth, std::vector<BuildItem> &items);
+  void appendObjects(const Node &node, std::vector<uint32_t> &objects) const;
+};
+
+#endif // !BVH_H
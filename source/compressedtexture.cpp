@@ -0,0 +1,155 @@
+#include "compressedtexture.h"
+#include "meshcache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char kMagic[8] = {'B', 'L', 'O', 'C', 'K', 'T', 'X', '\0'};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t levelCount;
+  uint32_t reserved;
+  uint64_t sourceHash;
+};
+
+bool validFormat(uint32_t format) {
+  return format == (uint32_t)BlockFormat::BC1 ||
+         format == (uint32_t)BlockFormat::BC3 ||
+         format == (uint32_t)BlockFormat::BC5;
+}
+
+} // namespace
+
+bool CompressedTexture::s_enabled = true;
+
+bool CompressedTexture::read(const std::string &path, uint64_t sourceHash,
+                             size_t firstLevel, size_t lastLevel) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  Header header;
+  if (!in.read((char *)&header, sizeof(header)) ||
+      std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.sourceHash != sourceHash ||
+      !validFormat(header.format) || header.width == 0 ||
+      header.height == 0 || header.levelCount == 0 || header.levelCount > 32)
+    return false;
+
+  format = (BlockFormat)header.format;
+  width = (int)header.width;
+  height = (int)header.height;
+  this->sourceHash = sourceHash;
+  levels.assign(header.levelCount, {});
+  for (size_t level = 0; level < levels.size(); ++level) {
+    uint32_t size = 0;
+    if (!in.read((char *)&size, sizeof(size)) ||
+        size != compressedSize(format, levelWidth(level), levelHeight(level)))
+      return false;
+
+    uint32_t padded = (size + 3) & ~3u;
+    if (level < firstLevel || level > lastLevel) {
+      in.seekg(padded, std::ios::cur);
+      continue;
+    }
+
+    levels[level].resize(size);
+    if (!in.read((char *)levels[level].data(), size))
+      return false;
+    in.ignore(padded - size);
+  }
+  return true;
+}
+
+bool CompressedTexture::write(const std::string &path,
+                              uint64_t sourceHash) const {
+  // write to a temporary file first so a crash never leaves a torn file
+  std::string tempPath = path + ".tmp";
+  std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+  if (!out)
+    return false;
+
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.format = (uint32_t)format;
+  header.width = (uint32_t)width;
+  header.height = (uint32_t)height;
+  header.levelCount = (uint32_t)levels.size();
+  header.reserved = 0;
+  header.sourceHash = sourceHash;
+  out.write((const char *)&header, sizeof(header));
+
+  static const char zeros[4] = {};
+  for (const std::vector<uint8_t> &level : levels) {
+    uint32_t size = (uint32_t)level.size();
+    out.write((const char *)&size, sizeof(size));
+    out.write((const char *)level.data(), size);
+    out.write(zeros, ((size + 3) & ~3u) - size);
+  }
+
+  out.close();
+  if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+    std::remove(tempPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+void CompressedTexture::flipVertically() {
+  for (size_t level = 0; level < levels.size(); ++level)
+    if (!levels[level].empty())
+      flipBlocksVertically(format, levels[level].data(), levelWidth(level),
+                           levelHeight(level));
+}
+
+int CompressedTexture::levelWidth(size_t level) const {
+  return std::max(width >> level, 1);
+}
+
+int CompressedTexture::levelHeight(size_t level) const {
+  return std::max(height >> level, 1);
+}
+
+uint64_t CompressedTexture::hashSource(const std::string &sourcePath) {
+  return MeshCache::hashFile(sourcePath, kVersion);
+}
+
+std::string CompressedTexture::pathFor(const std::string &sourcePath) {
+  return sourcePath + ".btx";
+}
+
+bool loadCompressedTexture(const std::string &sourcePath, bool flip,
+                           CompressedTexture &texture, int maxSize) {
+  std::string path = CompressedTexture::pathFor(sourcePath);
+  if (!CompressedTexture::isEnabled() || !std::ifstream(path))
+    return false;
+
+  uint64_t sourceHash = CompressedTexture::hashSource(sourcePath);
+  if (!sourceHash)
+    return false;
+
+  size_t firstLevel = 0;
+  if (maxSize > 0) {
+    // header and level sizes only
+    if (!texture.read(path, sourceHash, SIZE_MAX, 0))
+      return false;
+    while (firstLevel + 1 < texture.levels.size() &&
+           std::max(texture.levelWidth(firstLevel),
+                    texture.levelHeight(firstLevel)) > maxSize)
+      ++firstLevel;
+  }
+  if (!texture.read(path, sourceHash, firstLevel))
+    return false;
+  if (flip)
+    texture.flipVertically();
+  return true;
+}
@@ -0,0 +1,58 @@
+#ifndef COMPRESSEDTEXTURE_H
+#define COMPRESSEDTEXTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "blockcompress.h"
+
+// Block compressed image with its full mip chain, written offline by
+// texconv next to the source image (see pathFor) and uploaded as is with
+// glCompressedTexImage2D. Like the mesh cache, files carry a format version
+// and a hash of the source image and are rejected when either mismatches.
+//
+// Layout (native endianness):
+//   Header
+//   per level: uint32 byte size, blocks padded to 4 bytes
+// Level 0 is stored top row first, the way stb_image loads without a flip.
+struct CompressedTexture {
+  static const uint32_t kVersion = 1;
+
+  BlockFormat format = BlockFormat::BC1;
+  int width = 0;
+  int height = 0;
+  uint64_t sourceHash = 0;
+  std::vector<std::vector<uint8_t>> levels;
+
+  // Levels outside [firstLevel, lastLevel] are skipped and left empty, the
+  // texture streamer reads the fine mips on demand this way.
+  bool read(const std::string &path, uint64_t sourceHash,
+            size_t firstLevel = 0, size_t lastLevel = SIZE_MAX);
+  bool write(const std::string &path, uint64_t sourceHash) const;
+
+  // Mirrors every level read, for models loaded with flipTexture
+  void flipVertically();
+
+  int levelWidth(size_t level) const;
+  int levelHeight(size_t level) const;
+
+  static uint64_t hashSource(const std::string &sourcePath);
+  static std::string pathFor(const std::string &sourcePath);
+
+  // Lets loadCompressedTexture pick up converted files. On by default.
+  static void setEnabled(bool enabled) { s_enabled = enabled; }
+  static bool isEnabled() { return s_enabled; }
+
+private:
+  static bool s_enabled;
+};
+
+// Loads pathFor(sourcePath) if enabled, present and up to date, flipped if
+// asked. A non-zero maxSize skips the levels larger than that per side,
+// keeping at least the last one. Safe on any thread.
+bool loadCompressedTexture(const std::string &sourcePath, bool flip,
+                           CompressedTexture &texture, int maxSize = 0);
+
+#endif // !COMPRESSEDTEXTURE_H
@@ -0,0 +1,198 @@
+#include "culling.h"
+
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/vector_relational.hpp"
+
+#include <cfloat>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define CULLING_SSE 1
+#endif
+
+Frustum Frustum::fromMatrix(const glm::mat4 &m) {
+  // rows of the matrix, glm is column major
+  glm::vec4 row0{m[0][0], m[1][0], m[2][0], m[3][0]};
+  glm::vec4 row1{m[0][1], m[1][1], m[2][1], m[3][1]};
+  glm::vec4 row2{m[0][2], m[1][2], m[2][2], m[3][2]};
+  glm::vec4 row3{m[0][3], m[1][3], m[2][3], m[3][3]};
+
+  Frustum frustum;
+  frustum.planes[0] = row3 + row0;
+  frustum.planes[1] = row3 - row0;
+  frustum.planes[2] = row3 + row1;
+  frustum.planes[3] = row3 - row1;
+  frustum.planes[4] = row3 + row2;
+  frustum.planes[5] = row3 - row2;
+
+  for (glm::vec4 &plane : frustum.planes)
+    plane /= glm::length(glm::vec3(plane));
+  return frustum;
+}
+
+Aabb Aabb::empty() {
+  return {glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+}
+
+float Aabb::surfaceArea() const {
+  if (isEmpty())
+    return 0.0f;
+  glm::vec3 size = max - min;
+  return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+Aabb Aabb::transformed(const glm::mat4 &matrix) const {
+  if (isEmpty())
+    return *this;
+  // every output axis takes the smaller / larger of each input axis term
+  Aabb result{glm::vec3(matrix[3]), glm::vec3(matrix[3])};
+  for (int column = 0; column < 3; ++column) {
+    glm::vec3 a = glm::vec3(matrix[column]) * min[column];
+    glm::vec3 b = glm::vec3(matrix[column]) * max[column];
+    result.min += glm::min(a, b);
+    result.max += glm::max(a, b);
+  }
+  return result;
+}
+
+Containment classifyBox(const Frustum &frustum, const Aabb &box) {
+  if (box.isEmpty())
+    return Containment::Outside;
+  Containment result = Containment::Inside;
+  for (const glm::vec4 &plane : frustum.planes) {
+    glm::vec3 normal(plane);
+    // the corners farthest along and against the plane normal
+    glm::vec3 positive = glm::mix(box.min, box.max,
+                                  glm::greaterThanEqual(normal, glm::vec3(0)));
+    glm::vec3 negative = glm::mix(box.max, box.min,
+                                  glm::greaterThanEqual(normal, glm::vec3(0)));
+    if (glm::dot(normal, positive) + plane.w < 0.0f)
+      return Containment::Outside;
+    if (glm::dot(normal, negative) + plane.w < 0.0f)
+      result = Containment::Intersects;
+  }
+  return result;
+}
+
+void SphereSet::reserve(size_t count) {
+  m_X.reserve(count);
+  m_Y.reserve(count);
+  m_Z.reserve(count);
+  m_Radius.reserve(count);
+}
+
+void SphereSet::clear() {
+  m_X.clear();
+  m_Y.clear();
+  m_Z.clear();
+  m_Radius.clear();
+}
+
+void SphereSet::add(const glm::vec3 &center, float radius) {
+  m_X.push_back(center.x);
+  m_Y.push_back(center.y);
+  m_Z.push_back(center.z);
+  m_Radius.push_back(radius);
+}
+
+static bool sphereVisible(const Frustum &frustum, float x, float y, float z,
+                          float radius) {
+  // same evaluation order as the SSE path so both agree on the boundary
+  for (const glm::vec4 &plane : frustum.planes) {
+    float distance = (plane.x * x + plane.y * y) + (plane.z * z + plane.w);
+    if (distance < -radius)
+      return false;
+  }
+  return true;
+}
+
+size_t cullSpheresScalar(const Frustum &frustum, const SphereSet &spheres,
+                         uint32_t *visibleIndices) {
+  const float *x = spheres.x();
+  const float *y = spheres.y();
+  const float *z = spheres.z();
+  const float *radius = spheres.radius();
+
+  size_t visible = 0;
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    if (sphereVisible(frustum, x[i], y[i], z[i], radius[i]))
+      visibleIndices[visible++] = (uint32_t)i;
+  }
+  return visible;
+}
+
+size_t cullSpheres(const Frustum &frustum, const SphereSet &spheres,
+                   uint32_t *visibleIndices) {
+#ifdef CULLING_SSE
+  const float *x = spheres.x();
+  const float *y = spheres.y();
+  const float *z = spheres.z();
+  const float *radius = spheres.radius();
+  size_t count = spheres.size();
+
+  // every plane component broadcast once, outside the loop
+  __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+  for (int p = 0; p < 6; ++p) {
+    planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+    planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+    planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+    planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+  }
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+
+  size_t visible = 0;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 sx = _mm_loadu_ps(x + i);
+    __m128 sy = _mm_loadu_ps(y + i);
+    __m128 sz = _mm_loadu_ps(z + i);
+    __m128 negRadius = _mm_xor_ps(_mm_loadu_ps(radius + i), signMask);
+
+    // bit set while the sphere is inside every plane tested so far
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; ++p) {
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(planeX[p], sx), _mm_mul_ps(planeY[p], sy)),
+          _mm_add_ps(_mm_mul_ps(planeZ[p], sz), planeW[p]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+    }
+
+    int mask = _mm_movemask_ps(inside);
+    while (mask) {
+      int lane = __builtin_ctz(mask);
+      visibleIndices[visible++] = (uint32_t)(i + lane);
+      mask &= mask - 1;
+    }
+  }
+
+  for (; i < count; ++i) {
+    if (sphereVisible(frustum, x[i], y[i], z[i], radius[i]))
+      visibleIndices[visible++] = (uint32_t)i;
+  }
+  return visible;
+#else
+  return cullSpheresScalar(frustum, spheres, visibleIndices);
+#endif
+}
+
+float boundingRadius(const glm::vec3 *positions, size_t count,
+                     size_t strideBytes) {
+  const char *bytes = (const char *)positions;
+  float maxLength2 = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    const glm::vec3 &p = *(const glm::vec3 *)(bytes + i * strideBytes);
+    maxLength2 = std::fmax(maxLength2, glm::dot(p, p));
+  }
+  return std::sqrt(maxLength2);
+}
+
+Aabb boundingBox(const glm::vec3 *positions, size_t count,
+                 size_t strideBytes) {
+  const char *bytes = (const char *)positions;
+  Aabb box = Aabb::empty();
+  for (size_t i = 0; i < count; ++i)
+    box.expand(*(const glm::vec3 *)(bytes + i * strideBytes));
+  return box;
+}
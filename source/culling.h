@@ -0,0 +1,91 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include "glm/common.hpp"
+#include "glm/ext/matrix_float4x4.hpp"
+#include "glm/ext/vector_float3.hpp"
+#include "glm/ext/vector_float4.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CPU visibility tests. Nothing here touches GL, so the functions can be
+// exercised and timed without a context (see --bench).
+
+// Six planes (left, right, bottom, top, near, far) pointing inwards,
+// normalized so that dot(plane.xyz, p) + plane.w is a signed distance.
+struct Frustum {
+  glm::vec4 planes[6];
+
+  // Gribb / Hartmann extraction from projection * view (* model).
+  static Frustum fromMatrix(const glm::mat4 &viewProjection);
+};
+
+// Axis aligned box. Empty boxes have min > max and fail every test.
+struct Aabb {
+  glm::vec3 min;
+  glm::vec3 max;
+
+  static Aabb empty();
+  bool isEmpty() const { return min.x > max.x; }
+  void expand(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+  void expand(const Aabb &box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+  float surfaceArea() const;
+  // Box around the transformed box (Arvo), empty stays empty
+  Aabb transformed(const glm::mat4 &matrix) const;
+};
+
+enum class Containment { Outside, Intersects, Inside };
+
+// Conservative: boxes crossing a plane outside the frustum's corners may
+// be reported as intersecting.
+Containment classifyBox(const Frustum &frustum, const Aabb &box);
+
+// Bounding spheres in structure of arrays layout so four of them load into
+// one SSE register per component.
+class SphereSet {
+public:
+  void reserve(size_t count);
+  void clear();
+  void add(const glm::vec3 &center, float radius);
+
+  size_t size() const { return m_X.size(); }
+
+  const float *x() const { return m_X.data(); }
+  const float *y() const { return m_Y.data(); }
+  const float *z() const { return m_Z.data(); }
+  const float *radius() const { return m_Radius.data(); }
+
+private:
+  std::vector<float> m_X;
+  std::vector<float> m_Y;
+  std::vector<float> m_Z;
+  std::vector<float> m_Radius;
+};
+
+// Writes the indices of the spheres intersecting the frustum to
+// visibleIndices (room for spheres.size() entries) in ascending order and
+// returns how many were written. Uses SSE when the target has it.
+size_t cullSpheres(const Frustum &frustum, const SphereSet &spheres,
+                   uint32_t *visibleIndices);
+
+// Plain loop with the same result, kept as reference and for the benchmark.
+size_t cullSpheresScalar(const Frustum &frustum, const SphereSet &spheres,
+                         uint32_t *visibleIndices);
+
+// Radius of a sphere at the origin enclosing every position.
+float boundingRadius(const glm::vec3 *positions, size_t count,
+                     size_t strideBytes = sizeof(glm::vec3));
+// Box enclosing every position, empty for count 0.
+Aabb boundingBox(const glm::vec3 *positions, size_t count,
+                 size_t strideBytes = sizeof(glm::vec3));
+
+#endif // !CULLING_H
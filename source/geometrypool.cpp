@@ -0,0 +1,178 @@
+#include "geometrypool.h"
+#include "model.h"
+#include "renderstate.h"
+#include "vertexformat.h"
+
+#include <algorithm>
+
+namespace {
+
+// Moves a buffer's content into a new one of newBytes, returns the new one
+GLuint regrow(GLuint buffer, size_t usedBytes, size_t newBytes) {
+  GLuint grown;
+  glGenBuffers(1, &grown);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+  glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+  if (buffer) {
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        usedBytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return grown;
+}
+
+} // namespace
+
+GeometryPool &GeometryPool::get() {
+  static GeometryPool pool;
+  return pool;
+}
+
+size_t GeometryPool::vertexSize(VertexLayout layout) {
+  return layout == VertexLayout::Packed ? sizeof(PackedVertex)
+                                        : sizeof(Vertex);
+}
+
+GeometryPool::Pool &GeometryPool::pool(VertexLayout layout) {
+  Pool &pool = m_Pools[(int)layout];
+  if (pool.vertexArrays.empty()) {
+    GLuint vertexArray;
+    glGenVertexArrays(1, &vertexArray);
+    pool.vertexArrays.push_back(vertexArray);
+  }
+  return pool;
+}
+
+GeometryRange GeometryPool::add(VertexLayout layout, const void *vertices,
+                                size_t vertexCount, const GLuint *indices,
+                                size_t indexCount) {
+  reserve(layout, vertexCount, indexCount);
+  Pool &target = pool(layout);
+
+  GeometryRange range;
+  range.layout = layout;
+  range.baseVertex = (GLint)target.vertexCount;
+  range.firstIndex = (GLuint)target.indexCount;
+
+  size_t stride = vertexSize(layout);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, target.vertexBuffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, target.vertexCount * stride,
+                  vertexCount * stride, vertices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, target.indexBuffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, target.indexCount * sizeof(GLuint),
+                  indexCount * sizeof(GLuint), indices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  target.vertexCount += vertexCount;
+  target.indexCount += indexCount;
+  return range;
+}
+
+GLuint GeometryPool::getVertexArray(VertexLayout layout) {
+  return pool(layout).vertexArrays[0];
+}
+
+GLuint GeometryPool::createVertexArray(VertexLayout layout) {
+  Pool &target = pool(layout);
+  GLuint vertexArray;
+  glGenVertexArrays(1, &vertexArray);
+  target.vertexArrays.push_back(vertexArray);
+  if (target.vertexBuffer)
+    setupVertexArray(layout, vertexArray);
+  return vertexArray;
+}
+
+size_t GeometryPool::getVertexBytes() const {
+  size_t bytes = 0;
+  for (int layout = 0; layout < (int)VertexLayout::Count; ++layout)
+    bytes += m_Pools[layout].vertexCount * vertexSize((VertexLayout)layout);
+  return bytes;
+}
+
+size_t GeometryPool::getIndexBytes() const {
+  size_t bytes = 0;
+  for (const Pool &pool : m_Pools)
+    bytes += pool.indexCount * sizeof(GLuint);
+  return bytes;
+}
+
+void GeometryPool::destroy() {
+  for (Pool &pool : m_Pools) {
+    if (!pool.vertexArrays.empty())
+      glDeleteVertexArrays((GLsizei)pool.vertexArrays.size(),
+                           pool.vertexArrays.data());
+    glDeleteBuffers(1, &pool.vertexBuffer);
+    glDeleteBuffers(1, &pool.indexBuffer);
+    pool = Pool{};
+  }
+}
+
+void GeometryPool::reserve(VertexLayout layout, size_t vertexCount,
+                           size_t indexCount) {
+  Pool &target = pool(layout);
+  size_t stride = vertexSize(layout);
+  bool grown = false;
+
+  // doubling keeps the copies linear in the final size
+  if (target.vertexCount + vertexCount > target.vertexCapacity) {
+    size_t capacity = std::max<size_t>(target.vertexCapacity * 2, 1 << 16);
+    capacity = std::max(capacity, target.vertexCount + vertexCount);
+    target.vertexBuffer = regrow(
+        target.vertexBuffer, target.vertexCount * stride, capacity * stride);
+    target.vertexCapacity = capacity;
+    grown = true;
+  }
+  if (target.indexCount + indexCount > target.indexCapacity) {
+    size_t capacity = std::max<size_t>(target.indexCapacity * 2, 1 << 18);
+    capacity = std::max(capacity, target.indexCount + indexCount);
+    target.indexBuffer =
+        regrow(target.indexBuffer, target.indexCount * sizeof(GLuint),
+               capacity * sizeof(GLuint));
+    target.indexCapacity = capacity;
+    grown = true;
+  }
+
+  if (grown) {
+    for (GLuint vertexArray : target.vertexArrays)
+      setupVertexArray(layout, vertexArray);
+  }
+}
+
+void GeometryPool::setupVertexArray(VertexLayout layout, GLuint vertexArray) {
+  const Pool &source = m_Pools[(int)layout];
+  // through the cache, so its bound vertex array stays current
+  RenderState &state = RenderState::get();
+  state.bindVertexArray(vertexArray);
+  glBindBuffer(GL_ARRAY_BUFFER, source.vertexBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, source.indexBuffer);
+
+  if (layout == VertexLayout::Packed) {
+    // snorm16 position in the mesh bounds
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                          (void *)offsetof(PackedVertex, position));
+    // octahedral snorm16 normal, z reads as 0
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                          (void *)offsetof(PackedVertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                          (void *)offsetof(PackedVertex, texCoords));
+  } else {
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, Position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, Normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, TexCoords));
+  }
+
+  state.bindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
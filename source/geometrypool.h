@@ -0,0 +1,88 @@
+#ifndef GEOMETRYPOOL_H
+#define GEOMETRYPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glew/glew.h"
+
+// Vertex formats the pool keeps apart, each has its own buffers and VAO
+enum class VertexLayout : uint8_t {
+  // Vertex, 32 bytes of floats
+  Float,
+  // PackedVertex, see vertexformat.h
+  Packed,
+  Count
+};
+
+// Where a mesh landed in the pool. Its indices are relative to baseVertex,
+// draws pass both to glDrawElementsBaseVertex.
+struct GeometryRange {
+  VertexLayout layout = VertexLayout::Float;
+  GLint baseVertex = 0;
+  GLuint firstIndex = 0;
+};
+
+// Command of glDrawElementsIndirect / glMultiDrawElementsIndirect over a
+// GeometryRange, layout fixed by GL
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+// Every static mesh is suballocated from one vertex and one index buffer
+// per layout, drawn through one VAO per layout, so going from one mesh to
+// the next binds nothing. The buffers only grow (copied on the GPU) and
+// meshes keep their range until exit.
+class GeometryPool {
+public:
+  static GeometryPool &get();
+
+  GeometryPool(const GeometryPool &) = delete;
+  GeometryPool &operator=(const GeometryPool &) = delete;
+
+  // GL thread. Appends a mesh, vertices are of the layout's vertex type.
+  GeometryRange add(VertexLayout layout, const void *vertices,
+                    size_t vertexCount, const GLuint *indices,
+                    size_t indexCount);
+
+  // The shared VAO of layout, also valid before anything was added
+  GLuint getVertexArray(VertexLayout layout);
+  // Another VAO over the pool buffers with the layout's attributes, for
+  // callers that add attributes of their own (instancing, per draw data).
+  // It is re-pointed along with the shared one when the pool grows.
+  GLuint createVertexArray(VertexLayout layout);
+
+  size_t getVertexBytes() const;
+  size_t getIndexBytes() const;
+
+  // Frees the GL objects, call while the context is still current.
+  void destroy();
+
+private:
+  GeometryPool() = default;
+
+  struct Pool {
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+    size_t vertexCount = 0;
+    size_t vertexCapacity = 0;
+    size_t indexCount = 0;
+    size_t indexCapacity = 0;
+    // [0] is the shared one
+    std::vector<GLuint> vertexArrays;
+  };
+
+  Pool m_Pools[(int)VertexLayout::Count];
+
+  static size_t vertexSize(VertexLayout layout);
+  Pool &pool(VertexLayout layout);
+  void reserve(VertexLayout layout, size_t vertexCount, size_t indexCount);
+  void setupVertexArray(VertexLayout layout, GLuint vertexArray);
+};
+
+#endif // !GEOMETRYPOOL_H
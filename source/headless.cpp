@@ -0,0 +1,105 @@
+#include "headless.h"
+
+#include <cstring>
+#include <iostream>
+
+static bool hasExtension(const char *extensions, const char *name) {
+  if (!extensions)
+    return false;
+
+  size_t length = std::strlen(name);
+  const char *start = extensions;
+  while ((start = std::strstr(start, name)) != nullptr) {
+    bool atBegin = start == extensions || start[-1] == ' ';
+    bool atEnd = start[length] == ' ' || start[length] == '\0';
+    if (atBegin && atEnd)
+      return true;
+    start += length;
+  }
+  return false;
+}
+
+HeadlessContext::~HeadlessContext() { destroy(); }
+
+bool HeadlessContext::create(int major, int minor) {
+  const char *clientExtensions =
+      eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+  if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+    auto getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+      m_Display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                     EGL_DEFAULT_DISPLAY, NULL);
+  }
+  if (m_Display == EGL_NO_DISPLAY)
+    m_Display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint eglMajor, eglMinor;
+  if (m_Display == EGL_NO_DISPLAY ||
+      !eglInitialize(m_Display, &eglMajor, &eglMinor)) {
+    std::cout << "ERROR::HEADLESS:: EGL display init failed" << std::endl;
+    m_Display = EGL_NO_DISPLAY;
+    return false;
+  }
+
+  const char *displayExtensions = eglQueryString(m_Display, EGL_EXTENSIONS);
+  if (!hasExtension(displayExtensions, "EGL_KHR_surfaceless_context")) {
+    std::cout << "ERROR::HEADLESS:: EGL_KHR_surfaceless_context not supported"
+              << std::endl;
+    destroy();
+    return false;
+  }
+
+  // Surfaceless rendering does not need a config, but not every driver
+  // exposes EGL_KHR_no_config_context, so pick one if we can.
+  EGLConfig config = EGL_NO_CONFIG_KHR;
+  EGLint configCount = 0;
+  const EGLint configAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                  EGL_NONE};
+  if (!eglChooseConfig(m_Display, configAttribs, &config, 1, &configCount) ||
+      configCount == 0)
+    config = EGL_NO_CONFIG_KHR;
+
+  eglBindAPI(EGL_OPENGL_API);
+
+  const EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                   major,
+                                   EGL_CONTEXT_MINOR_VERSION,
+                                   minor,
+                                   EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                   EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                   EGL_NONE};
+  m_Context =
+      eglCreateContext(m_Display, config, EGL_NO_CONTEXT, contextAttribs);
+  if (m_Context == EGL_NO_CONTEXT) {
+    std::cout << "ERROR::HEADLESS:: EGL context creation failed: 0x"
+              << std::hex << eglGetError() << std::dec << std::endl;
+    destroy();
+    return false;
+  }
+
+  if (!eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_Context)) {
+    std::cout << "ERROR::HEADLESS:: eglMakeCurrent failed" << std::endl;
+    destroy();
+    return false;
+  }
+
+  std::cout << "Headless EGL " << eglMajor << "." << eglMinor << " context "
+            << major << "." << minor << " core" << std::endl;
+  return true;
+}
+
+void HeadlessContext::destroy() {
+  if (m_Display == EGL_NO_DISPLAY)
+    return;
+
+  eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (m_Context != EGL_NO_CONTEXT)
+    eglDestroyContext(m_Display, m_Context);
+  eglTerminate(m_Display);
+
+  m_Context = EGL_NO_CONTEXT;
+  m_Display = EGL_NO_DISPLAY;
+}
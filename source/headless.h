@@ -0,0 +1,29 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Surfaceless EGL context for running without a display (CI, render farm).
+// Uses EGL_MESA_platform_surfaceless when available, so it works on Mesa
+// llvmpipe with no X server and no GPU. All rendering has to go into FBOs,
+// there is no default framebuffer.
+class HeadlessContext {
+public:
+  HeadlessContext() = default;
+  ~HeadlessContext();
+
+  HeadlessContext(const HeadlessContext &) = delete;
+  HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+  bool create(int major, int minor);
+  void destroy();
+
+  bool isValid() const { return m_Context != EGL_NO_CONTEXT; }
+
+private:
+  EGLDisplay m_Display = EGL_NO_DISPLAY;
+  EGLContext m_Context = EGL_NO_CONTEXT;
+};
+
+#endif // !HEADLESS_H
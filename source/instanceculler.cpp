@@ -0,0 +1,193 @@
+#include "instanceculler.h"
+#include "model.h"
+#include "renderstate.h"
+
+#include <cstddef>
+#include <iostream>
+
+static_assert(kMaxLods == 4, "instancecull takes the errors as a vec4");
+
+InstanceCuller::InstanceCuller(Shader &shader, const Mesh &mesh,
+                               float meshRadius,
+                               const InstanceTRS *instances, size_t count,
+                               bool allowIndirect)
+    : m_Shader(shader), m_Lods(mesh.getLods()),
+      m_FirstIndex(mesh.getGeometry().firstIndex),
+      m_BaseVertex(mesh.getGeometry().baseVertex), m_Count(count),
+      m_Indirect(allowIndirect &&
+                 (GLEW_VERSION_4_0 || GLEW_ARB_draw_indirect) &&
+                 (GLEW_VERSION_4_4 || GLEW_ARB_query_buffer_object)),
+      m_Radius(meshRadius) {
+  std::cout << "INSTANCE CULLER: transform feedback, "
+            << (m_Indirect ? "counts to indirect draws on the GPU"
+                           : "counts read back")
+            << std::endl;
+  if (m_Lods.size() > kMaxLods)
+    m_Lods.resize(kMaxLods);
+
+  glGenBuffers(1, &m_Instances);
+  glBindBuffer(GL_ARRAY_BUFFER, m_Instances);
+  glBufferData(GL_ARRAY_BUFFER, count * sizeof(InstanceTRS), instances,
+               GL_STATIC_DRAW);
+
+  glGenVertexArrays(1, &m_InstanceArray);
+  RenderState::get().bindVertexArray(m_InstanceArray);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTRS),
+                        (void *)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTRS),
+                        (void *)offsetof(InstanceTRS, rotation));
+  RenderState::get().bindVertexArray(0);
+
+  // every level may keep every instance
+  glGenBuffers(1, &m_Output);
+  glBindBuffer(GL_ARRAY_BUFFER, m_Output);
+  glBufferData(GL_ARRAY_BUFFER, kMaxLods * count * sizeof(InstanceTRS),
+               nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  if (m_Indirect) {
+    // only the instance counts change, written by the GPU
+    std::vector<DrawElementsIndirectCommand> commands;
+    for (const MeshLod &lod : m_Lods)
+      commands.push_back({lod.indexCount, 0, m_FirstIndex + lod.indexOffset,
+                          m_BaseVertex, 0});
+    glGenBuffers(1, &m_Commands);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_Commands);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 commands.size() * sizeof(DrawElementsIndirectCommand),
+                 commands.data(),
+                 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  }
+  glGenQueries(kMaxLods, m_Queries);
+
+  m_Planes = shader.getUniform("planes");
+  m_MeshRadius = shader.getUniform("meshRadius");
+  m_LodErrors = shader.getUniform("lodErrors");
+  m_LodCount = shader.getUniform("lodCount");
+  m_Lod = shader.getUniform("lod");
+  m_Eye = shader.getUniform("eye");
+  m_PixelsPerUnit = shader.getUniform("pixelsPerUnit");
+  m_MaxErrorPixels = shader.getUniform("maxErrorPixels");
+}
+
+void InstanceCuller::destroy() {
+  glDeleteQueries(kMaxLods, m_Queries);
+  GLuint buffers[] = {m_Instances, m_Output, m_Commands};
+  glDeleteBuffers(3, buffers);
+  glDeleteVertexArrays(1, &m_InstanceArray);
+  m_Instances = m_Output = m_Commands = m_InstanceArray = 0;
+}
+
+void InstanceCuller::cull(const Frustum &frustum, const glm::vec3 &eye,
+                          float pixelsPerUnit, float maxErrorPixels) {
+  RenderState &state = RenderState::get();
+  m_Shader.use();
+  glm::vec4 errors(0.0f);
+  for (size_t lod = 0; lod < m_Lods.size(); ++lod)
+    errors[(int)lod] = m_Lods[lod].error;
+  m_Shader.setVec4(m_Planes, frustum.planes, 6);
+  m_Shader.setFloat(m_MeshRadius, m_Radius);
+  m_Shader.setVec4(m_LodErrors, errors);
+  m_Shader.setInt(m_LodCount, (int)m_Lods.size());
+  m_Shader.setVec3(m_Eye, eye);
+  m_Shader.setFloat(m_PixelsPerUnit, pixelsPerUnit);
+  m_Shader.setFloat(m_MaxErrorPixels, maxErrorPixels);
+
+  state.bindVertexArray(m_InstanceArray);
+  state.enable(GL_RASTERIZER_DISCARD);
+  for (size_t lod = 0; lod < m_Lods.size(); ++lod) {
+    m_Shader.setInt(m_Lod, (int)lod);
+    glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_Output,
+                      lod * m_Count * sizeof(InstanceTRS),
+                      m_Count * sizeof(InstanceTRS));
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, m_Queries[lod]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)m_Count);
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+  }
+  state.countDraws((unsigned int)m_Lods.size());
+  state.disable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+  if (m_Indirect) {
+    // the GPU waits for the counts, the CPU does not
+    glBindBuffer(GL_QUERY_BUFFER, m_Commands);
+    for (size_t lod = 0; lod < m_Lods.size(); ++lod)
+      glGetQueryObjectuiv(
+          m_Queries[lod], GL_QUERY_RESULT,
+          (GLuint *)(lod * sizeof(DrawElementsIndirectCommand) +
+                     offsetof(DrawElementsIndirectCommand, instanceCount)));
+    glBindBuffer(GL_QUERY_BUFFER, 0);
+  }
+  m_Pending = true;
+}
+
+void InstanceCuller::draw() {
+  RenderState &state = RenderState::get();
+  glBindBuffer(GL_ARRAY_BUFFER, m_Output);
+  if (m_Indirect)
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_Commands);
+  for (size_t lod = 0; lod < m_Lods.size(); ++lod) {
+    if (!m_Indirect) {
+      glGetQueryObjectuiv(m_Queries[lod], GL_QUERY_RESULT, &m_Visible[lod]);
+      if (m_Visible[lod] == 0)
+        continue;
+    }
+    GLintptr region = lod * m_Count * sizeof(InstanceTRS);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTRS),
+                          (void *)region);
+    glVertexAttribPointer(
+        4, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTRS),
+        (void *)(region + offsetof(InstanceTRS, rotation)));
+    if (m_Indirect) {
+      glDrawElementsIndirect(
+          GL_TRIANGLES, GL_UNSIGNED_INT,
+          (void *)(lod * sizeof(DrawElementsIndirectCommand)));
+    } else {
+      const MeshLod &level = m_Lods[lod];
+      glDrawElementsInstancedBaseVertex(
+          GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT,
+          (void *)((m_FirstIndex + level.indexOffset) * sizeof(GLuint)),
+          (GLsizei)m_Visible[lod], m_BaseVertex);
+    }
+    state.countDraws(1);
+  }
+  if (m_Indirect)
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  if (!m_Indirect)
+    m_Pending = false;
+}
+
+void InstanceCuller::pollStatistics() {
+  if (!m_Pending)
+    return;
+  for (size_t lod = 0; lod < m_Lods.size(); ++lod) {
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(m_Queries[lod], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+    if (!available)
+      return;
+  }
+  for (size_t lod = 0; lod < m_Lods.size(); ++lod)
+    glGetQueryObjectuiv(m_Queries[lod], GL_QUERY_RESULT, &m_Visible[lod]);
+  m_Pending = false;
+}
+
+size_t InstanceCuller::getVisibleCount() const {
+  size_t visible = 0;
+  for (size_t lod = 0; lod < m_Lods.size(); ++lod)
+    visible += m_Visible[lod];
+  return visible;
+}
+
+size_t InstanceCuller::getTriangleCount() const {
+  size_t triangles = 0;
+  for (size_t lod = 0; lod < m_Lods.size(); ++lod)
+    triangles += (size_t)m_Visible[lod] * m_Lods[lod].indexCount / 3;
+  return triangles;
+}
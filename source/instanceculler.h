@@ -0,0 +1,87 @@
+#ifndef INSTANCECULLER_H
+#define INSTANCECULLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "culling.h"
+#include "geometrypool.h"
+#include "meshsimplify.h"
+#include "shader.h"
+#include "transforms.h"
+
+#include "glew/glew.h"
+#include "glm/ext/vector_float3.hpp"
+
+class Mesh;
+
+// Frustum culling and level of detail selection of an instance field on
+// the GPU, with GL 3.3 transform feedback. The instances are uploaded once;
+// every frame one pass per level runs the instancecull shader over all of
+// them (frustum planes as uniforms, level like Mesh::selectLod) and
+// captures the survivors of that level into its own region of the output
+// buffer, counted by a GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN query.
+//
+// With GL 4.4 / ARB_query_buffer_object and GL 4.0 / ARB_draw_indirect the
+// GPU copies the counts into indirect draw commands and the CPU never
+// waits. Otherwise draw() reads the counts back, which waits for the cull.
+class InstanceCuller {
+public:
+  // shader is the instancecull program. mesh is the instanced mesh and
+  // meshRadius its bounding radius.
+  // allowIndirect false forces the readback.
+  InstanceCuller(Shader &shader, const Mesh &mesh, float meshRadius,
+                 const InstanceTRS *instances, size_t count,
+                 bool allowIndirect = true);
+
+  InstanceCuller(const InstanceCuller &) = delete;
+  InstanceCuller &operator=(const InstanceCuller &) = delete;
+
+  // Frees the GL objects, call while the context is still current.
+  void destroy();
+
+  // Keeps the instances whose sphere touches the frustum, levels as for
+  // Mesh::selectLod at the eye's distance
+  void cull(const Frustum &frustum, const glm::vec3 &eye,
+            float pixelsPerUnit, float maxErrorPixels);
+  // Draws the survivors with the current program and VAO, which must be
+  // the mesh's layout with instanced InstanceTRS attributes at 3 and 4
+  void draw();
+
+  // Counts of the latest cull the GPU has finished, never waits
+  void pollStatistics();
+  size_t getVisibleCount() const;
+  size_t getTriangleCount() const;
+
+  bool isIndirect() const { return m_Indirect; }
+
+private:
+  Shader &m_Shader;
+  std::vector<MeshLod> m_Lods;
+  GLuint m_FirstIndex;
+  GLint m_BaseVertex;
+  size_t m_Count;
+  bool m_Indirect;
+  bool m_Pending = false;
+
+  GLuint m_Instances = 0;
+  GLuint m_InstanceArray = 0;
+  // one region of m_Count records per level
+  GLuint m_Output = 0;
+  GLuint m_Commands = 0;
+  GLuint m_Queries[kMaxLods] = {};
+  GLuint m_Visible[kMaxLods] = {};
+
+  UniformHandle m_Planes;
+  UniformHandle m_MeshRadius;
+  UniformHandle m_LodErrors;
+  UniformHandle m_LodCount;
+  UniformHandle m_Lod;
+  UniformHandle m_Eye;
+  UniformHandle m_PixelsPerUnit;
+  UniformHandle m_MaxErrorPixels;
+  float m_Radius;
+};
+
+#endif // !INSTANCECULLER_H
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
@@ -13,14 +14,37 @@
 #include "glm/matrix.hpp"
 #include "glm/trigonometric.hpp"
 
+#include "assetloader.h"
+#include "batchrenderer.h"
+#include "bench.h"
+#include "bvh.h"
 #include "camera.h"
+#include "compressedtexture.h"
+#include "culling.h"
+#include "geometrypool.h"
+#include "instanceculler.h"
 #include "model.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "renderqueue.h"
+#include "renderstate.h"
 #include "shader.h"
+#include "shaderwatcher.h"
+#include "streambuffer.h"
 #include "system.h"
+#include "texturecache.h"
+#include "texturestreamer.h"
+#include "threadpool.h"
+#include "transforms.h"
 #include "utilities.h"
 
+#include <cfloat>
+#include <chrono>
 #include <cstddef>
-#include <map>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <optional>
 #include <random>
 #include <string>
 #include <vector>
@@ -35,6 +59,111 @@ struct OffscreenFBO {
   int h = 0;
 };
 
+struct AppOptions {
+  bool headless = false;
+  unsigned int frames = 600;
+  unsigned int warmup = 60;
+  unsigned int width = 800;
+  unsigned int height = 800;
+  bool meshCache = true;
+  bool programCache = true;
+  bool parallelShaders = true;
+  std::string shaderDirectory = "shader/";
+  // hot reload, on by default with a window
+  bool watchShaders = false;
+  bool compressedTextures = true;
+  unsigned int textureBudget = 256;
+  bool meshOptimize = true;
+  float lodError = 1.0f;
+  bool multiDrawIndirect = true;
+  bool occlusionCulling = true;
+  // asteroid frustum culling and levels on the GPU, see InstanceCuller
+  bool gpuCulling = false;
+  bool bench = false;
+  bool meshReport = false;
+};
+
+static bool parseOptions(int argc, char **argv, AppOptions &options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    bool hasValue = i + 1 < argc;
+
+    if (std::strcmp(arg, "--headless") == 0)
+      options.headless = true;
+    else if (std::strcmp(arg, "--frames") == 0 && hasValue)
+      options.frames = std::atoi(argv[++i]);
+    else if (std::strcmp(arg, "--warmup") == 0 && hasValue)
+      options.warmup = std::atoi(argv[++i]);
+    else if (std::strcmp(arg, "--width") == 0 && hasValue)
+      options.width = std::atoi(argv[++i]);
+    else if (std::strcmp(arg, "--height") == 0 && hasValue)
+      options.height = std::atoi(argv[++i]);
+    else if (std::strcmp(arg, "--no-mesh-cache") == 0)
+      options.meshCache = false;
+    else if (std::strcmp(arg, "--no-program-cache") == 0)
+      options.programCache = false;
+    else if (std::strcmp(arg, "--no-parallel-shaders") == 0)
+      options.parallelShaders = false;
+    else if (std::strcmp(arg, "--shader-dir") == 0 && hasValue)
+      options.shaderDirectory = std::string(argv[++i]) + "/";
+    else if (std::strcmp(arg, "--watch-shaders") == 0)
+      options.watchShaders = true;
+    else if (std::strcmp(arg, "--no-compressed-textures") == 0)
+      options.compressedTextures = false;
+    else if (std::strcmp(arg, "--texture-budget") == 0 && hasValue)
+      options.textureBudget = std::atoi(argv[++i]);
+    else if (std::strcmp(arg, "--no-mesh-optimize") == 0)
+      options.meshOptimize = false;
+    else if (std::strcmp(arg, "--lod-error") == 0 && hasValue)
+      options.lodError = (float)std::atof(argv[++i]);
+    else if (std::strcmp(arg, "--no-multi-draw-indirect") == 0)
+      options.multiDrawIndirect = false;
+    else if (std::strcmp(arg, "--no-occlusion-culling") == 0)
+      options.occlusionCulling = false;
+    else if (std::strcmp(arg, "--gpu-culling") == 0)
+      options.gpuCulling = true;
+    else if (std::strcmp(arg, "--bench") == 0)
+      options.bench = true;
+    else if (std::strcmp(arg, "--mesh-report") == 0)
+      options.meshReport = true;
+    else {
+      std::cout << "Usage: " << argv[0]
+                << " [--headless] [--frames N] [--warmup N] [--width W]"
+                   " [--height H] [--no-mesh-cache] [--no-program-cache]"
+                   " [--no-parallel-shaders] [--shader-dir DIR]"
+                   " [--watch-shaders] [--no-compressed-textures]"
+                   " [--texture-budget MiB]"
+                   " [--no-mesh-optimize] [--lod-error PIXELS]"
+                   " [--no-multi-draw-indirect] [--no-occlusion-culling]"
+                   " [--gpu-culling] [--bench] [--mesh-report]"
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Vertex cache statistics of every model under assets/, before and after the
+// import time optimization (FIFO of kVertexCacheSize entries).
+static bool runMeshReport(std::ostream &out) {
+  std::vector<std::string> paths;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator("assets"))
+    if (entry.is_regular_file() && entry.path().extension() == ".obj")
+      paths.push_back(entry.path().generic_string());
+  std::sort(paths.begin(), paths.end());
+
+  out << std::fixed << std::setprecision(3);
+  out << std::setw(32) << "asset" << std::setw(5) << "mesh" << std::setw(9)
+      << "tris" << std::setw(9) << "verts" << std::setw(9) << "after"
+      << std::setw(8) << "ACMR" << std::setw(8) << "after" << std::setw(8)
+      << "ATVR" << std::setw(8) << "after" << std::endl;
+  bool ok = !paths.empty();
+  for (const std::string &path : paths)
+    ok = Model::reportMeshOptimization(path, out) && ok;
+  return ok;
+}
+
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
   System *app = static_cast<System *>(glfwGetWindowUserPointer(window));
 
@@ -114,12 +243,16 @@ static void createFramebuffer(System &App, OffscreenFBO &framebufer) {
     std::cout << "ERROR::FRAMEBUFFER:: framebuffer is not complete!"
               << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    RenderState::get().reset();
     return;
   }
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  // the texture binds above bypassed the shadow
+  RenderState::get().reset();
 }
 
-void drawQuad(Shader &shader, OffscreenFBO framebufer) {
+void drawQuad(Shader &shader, OffscreenFBO framebufer, GLuint target = 0) {
+  RenderState &state = RenderState::get();
 
   static GLuint VAO = 0, VBO = 0;
   if (VAO == 0) {
@@ -135,7 +268,7 @@ void drawQuad(Shader &shader, OffscreenFBO framebufer) {
     };
 
     glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    state.bindVertexArray(VAO);
 
     GLuint VBO;
     glGenBuffers(1, &VBO);
@@ -152,23 +285,20 @@ void drawQuad(Shader &shader, OffscreenFBO framebufer) {
     glEnableVertexAttribArray(1);
   }
 
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, target);
   glViewport(0, 0, framebufer.w, framebufer.h);
-  glDisable(GL_DEPTH_TEST);
-  glDisable(GL_STENCIL_TEST);
+  state.disable(GL_DEPTH_TEST);
+  state.disable(GL_STENCIL_TEST);
 
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, framebufer.colorTex);
+  state.bindTexture(0, GL_TEXTURE_2D, framebufer.colorTex);
   shader.use();
-  shader.setInt("screenTexture", 0);
 
-  glBindVertexArray(VAO);
+  state.bindVertexArray(VAO);
   glDrawArrays(GL_TRIANGLES, 0, 6);
-  glBindVertexArray(0);
-  glEnable(GL_DEPTH_TEST);
+  state.countDraws(1);
 
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_STENCIL_TEST);
+  state.enable(GL_DEPTH_TEST);
+  state.enable(GL_STENCIL_TEST);
 }
 
 void processInput(System &system) {
@@ -239,59 +369,224 @@ void setTexFilteringWrapping() {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
+// Deterministic fly-around used by the headless benchmark instead of input.
+void scriptedCamera(Camera &camera, unsigned int frame,
+                    unsigned int frameCount) {
+  const glm::vec3 center{-1.0f, 0.5f, 2.0f};
+  const float radius = 8.0f;
+
+  float angle = (float)frame / frameCount * glm::two_pi<float>();
+  glm::vec3 position = center + glm::vec3(sin(angle) * radius,
+                                          1.0f + 0.5f * sin(angle * 2.0f),
+                                          -cos(angle) * radius);
+  camera.setPosition(position);
+  camera.setFront(center - position);
+}
+
+// Light uniforms shared by the object and instance shaders
+struct LightUniforms {
+  UniformHandle dirDirection, dirAmbient, dirDiffuse, dirSpecular;
+  UniformHandle pointPosition, pointAmbient, pointDiffuse, pointSpecular;
+  UniformHandle pointConstant, pointLinear, pointQuadratic;
+  UniformHandle flashPosition, flashDirection, flashDiffuse, flashSpecular;
+  UniformHandle flashCutOff, flashOuterCutOff;
+
+  LightUniforms(Shader &shader)
+      : dirDirection(shader.getUniform("dirLight.direction")),
+        dirAmbient(shader.getUniform("dirLight.ambient")),
+        dirDiffuse(shader.getUniform("dirLight.diffuse")),
+        dirSpecular(shader.getUniform("dirLight.specular")),
+        pointPosition(shader.getUniform("pointLight.position")),
+        pointAmbient(shader.getUniform("pointLight.ambient")),
+        pointDiffuse(shader.getUniform("pointLight.diffuse")),
+        pointSpecular(shader.getUniform("pointLight.specular")),
+        pointConstant(shader.getUniform("pointLight.constant")),
+        pointLinear(shader.getUniform("pointLight.linear")),
+        pointQuadratic(shader.getUniform("pointLight.quadratic")),
+        flashPosition(shader.getUniform("flashLight.position")),
+        flashDirection(shader.getUniform("flashLight.direction")),
+        flashDiffuse(shader.getUniform("flashLight.diffuse")),
+        flashSpecular(shader.getUniform("flashLight.specular")),
+        flashCutOff(shader.getUniform("flashLight.cutOff")),
+        flashOuterCutOff(shader.getUniform("flashLight.outerCutOff")) {}
+};
+
+// First texture of the model, groups draws sharing it in the render queue
+static uint32_t materialKey(const Model &model) {
+  const std::vector<Texture> &textures = model.getTextures();
+  return textures.empty() ? 0 : textures[0].id;
+}
+
+// Permutation of the object shader for the model's material
+static ShaderDefines materialDefines(const Model &model) {
+  for (const Texture &texture : model.getTextures())
+    if (texture.type == TextureType::Specular)
+      return {};
+  return {{"HAS_SPECULAR_MAP", "0"}};
+}
+
+// Occluder drawn with the world matrix of a scene node
+struct SceneOccluder {
+  OccluderMesh mesh;
+  uint32_t node;
+};
+
+// One occluder per mesh of a placed model, simplified to about
+// maxTriangles. Collapses keep the vertices on the surface, so for convex
+// meshes the occluder lies inside the mesh and hides nothing it would not.
+static void addOccluders(const Model &model, uint32_t root,
+                         size_t maxTriangles,
+                         std::vector<SceneOccluder> &occluders) {
+  const std::vector<MeshNode> &nodes = model.getNodes();
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    for (uint32_t index = 0; index < nodes[i].meshCount; ++index) {
+      const Mesh &mesh = model.getMeshes()[nodes[i].firstMesh + index];
+      const MeshLod &finest = mesh.getLods()[0];
+      std::vector<uint32_t> indices(
+          mesh.m_indices.begin() + finest.indexOffset,
+          mesh.m_indices.begin() + finest.indexOffset + finest.indexCount);
+
+      SceneOccluder occluder;
+      occluder.node = root + (uint32_t)i;
+      simplifyMesh(mesh.m_vertices, indices, maxTriangles * 3, FLT_MAX,
+                   occluder.mesh.indices);
+      for (const Vertex &vertex : mesh.m_vertices)
+        occluder.mesh.positions.push_back(vertex.Position);
+      occluders.push_back(std::move(occluder));
+    }
+  }
+}
+
+// Lights are in view space, the shader must be in use.
+void setLights(const Shader &shader, const LightUniforms &light,
+               Camera &camera) {
+  glm::mat4 view = camera.getView();
+
+  // Direction light properties
+  shader.setVec3(light.dirDirection,
+                 glm::vec3(view * glm::vec4(0.0f, -1.0f, 0.0f, 0.0f)));
+  shader.setVec3(light.dirAmbient, glm::vec3(0.1f, 0.1f, 0.1f));
+  shader.setVec3(light.dirDiffuse, glm::vec3(0.3f, 0.3f, 0.3f));
+  shader.setVec3(light.dirSpecular, glm::vec3(0.3f, 0.3f, 0.3f));
+
+  // Pointlight properties
+  shader.setVec3(light.pointPosition,
+                 glm::vec3(view * glm::vec4(0.0f, 2.0f, 0.0f, 1.0f)));
+  shader.setVec3(light.pointAmbient, glm::vec3(0.1f, 0.1f, 0.1f));
+  shader.setVec3(light.pointDiffuse, glm::vec3(1.0f, 1.0f, 1.0f));
+  shader.setVec3(light.pointSpecular, glm::vec3(1.0f, 1.0f, 1.0f));
+  shader.setFloat(light.pointConstant, 1.0f);
+  shader.setFloat(light.pointLinear, 0.14f);
+  shader.setFloat(light.pointQuadratic, 0.07f);
+
+  // Flash light properties
+  shader.setVec3(light.flashPosition,
+                 glm::vec3(view * glm::vec4(camera.getPosition(), 1.0f)));
+  shader.setVec3(light.flashDirection,
+                 glm::vec3(view * glm::vec4(camera.getFront(), 0.0f)));
+  shader.setVec3(light.flashDiffuse, glm::vec3(1.0f, 1.0f, 1.0f));
+  shader.setVec3(light.flashSpecular, glm::vec3(1.0f, 1.0f, 1.0f));
+  shader.setFloat(light.flashCutOff, cos(glm::radians(20.f)));
+  shader.setFloat(light.flashOuterCutOff, cos(glm::radians(13.f)));
+}
+
 glm::vec3 PointlightPosition{glm::vec3{0.5f, 2.0f, -1.0f}}; //
 
-int main() {
+int main(int argc, char **argv) {
 
-  glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  // glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  // glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  AppOptions options;
+  if (!parseOptions(argc, argv, options))
+    return 1;
+
+  if (options.bench)
+    return runBenchmarks(std::cout) ? 0 : 1;
+  if (options.meshReport)
+    return runMeshReport(std::cout) ? 0 : 1;
+
+  if (!options.headless) {
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    // glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  }
 
-  System App{"LearnOpenGL", 800, 800};
+  System App{"LearnOpenGL", options.width, options.height, options.headless};
   App.setCamera(Camera(glm::vec3(0.0f, 0.0f, -4.0f),
                        glm::vec3(0.0f, 0.0f, 1.0f),
                        glm::vec3(0.0f, 1.0f, 0.0f)));
 
-  glfwSetInputMode(App.m_Window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-  if (App.m_Window == NULL) {
-    std::cout << "Failed tp create GLFW window" << std::endl;
-    glfwTerminate();
+  if (!App.isValid()) {
+    std::cout << (options.headless ? "Failed to create headless context"
+                                   : "Failed tp create GLFW window")
+              << std::endl;
+    if (!options.headless)
+      glfwTerminate();
     return 1;
   }
-  glfwMakeContextCurrent(App.m_Window);
 
+  if (!options.headless) {
+    glfwSetInputMode(App.m_Window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    glfwMakeContextCurrent(App.m_Window);
+  }
+
+  // GLEW looks for a GLX display after loading the GL entry points, which
+  // does not exist on a surfaceless EGL context. That error is harmless.
+  glewExperimental = GL_TRUE;
   GLenum err = glewInit();
-  if (err != GLEW_OK) {
+  if (err != GLEW_OK &&
+      !(options.headless && err == GLEW_ERROR_NO_GLX_DISPLAY)) {
     std::cerr << "Glew init fails" << glewGetErrorString(err) << std::endl;
     return 1;
   }
 
-  glfwSetWindowUserPointer(App.m_Window, &App);
-  glfwSetFramebufferSizeCallback(App.m_Window, framebuffer_size_callback);
-  glfwSetWindowSizeCallback(App.m_Window, window_size_callback);
-
-  Shader InstanceShader("instance");
-  Shader VizNormalShader("normal");
-  Shader RefractionShader("refraction");
-  Shader MirrorShader("mirror");
-  Shader CubeMapShader("cubemap");
-  Shader EdgeShader("edge");
-  Shader BlurShader("blur");
-  Shader SharpenShader("sharpen");
-  Shader GrayscaleShader("grayscale");
-  Shader InversShader("invers");
-  Shader ScreenShader("screen");
-  Shader ObjectShader("object");
-  Shader TestShader("test");
-  Shader LightShader{"light"};
-  Shader DepthShader{"depth"};
-  Shader OutLineShader("outline");
-  Shader TranspShader("transparent");
-  Shader GlassShader("glass");
+  if (!options.headless) {
+    glfwSetWindowUserPointer(App.m_Window, &App);
+    glfwSetFramebufferSizeCallback(App.m_Window, framebuffer_size_callback);
+    glfwSetWindowSizeCallback(App.m_Window, window_size_callback);
+  }
+
+  // startup cost of the programs, compare a cold and a warm program cache
+  Shader::setProgramCacheEnabled(options.programCache);
+  Shader::setDirectory(options.shaderDirectory);
+  auto shaderStart = std::chrono::steady_clock::now();
+  // all compiles and links in flight at once, checked after the last one
+  ShaderBatch shaderBatch;
+  ShaderBatch *shaders = options.parallelShaders ? &shaderBatch : nullptr;
+  Shader InstanceShader("object", {{"INSTANCED", "1"}}, shaders);
+  Shader VizNormalShader("normal", shaders);
+  Shader RefractionShader("refraction", shaders);
+  Shader MirrorShader("mirror", shaders);
+  Shader CubeMapShader("cubemap", shaders);
+  Shader EdgeShader("edge", shaders);
+  Shader BlurShader("blur", shaders);
+  Shader SharpenShader("sharpen", shaders);
+  Shader GrayscaleShader("grayscale", shaders);
+  Shader InversShader("invers", shaders);
+  Shader ScreenShader("screen", shaders);
+  Shader ObjectShader("object", shaders);
+  Shader TestShader("test", shaders);
+  Shader LightShader{"light", shaders};
+  Shader DepthShader{"depth", shaders};
+  Shader OutLineShader("outline", shaders);
+  Shader TranspShader("transparent", shaders);
+  Shader GlassShader("glass", shaders);
+  // only with --gpu-culling
+  std::optional<Shader> InstanceCullShader;
+  if (options.gpuCulling)
+    InstanceCullShader.emplace("instancecull", shaders);
+  if (shaders)
+    shaders->finish();
+  std::cout << "Shader programs: " << Shader::getProgramCount() << ", "
+            << Shader::getProgramCacheHits() << " from program cache, "
+            << (!shaders                  ? "one at a time, "
+                : shaderBatch.isParallel() ? "parallel compile, "
+                                           : "batched, ")
+            << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - shaderStart)
+                   .count()
+            << " ms" << std::endl;
   std::vector<glm::vec3> windowPos = {
       glm::vec3(0.1f, 1.0f, 3.0f),  //
       glm::vec3(-0.2f, 1.0f, 5.0f), //
@@ -300,22 +595,34 @@ int main() {
       glm::vec3(0.5f, 1.0f, 10.0f)  //
   };
 
-  std::cout << "Ball: start loadet" << std::endl;
-  Model modelBall{"assets/ball/ball.obj"};
-  std::cout << "Ball: end loadet" << std::endl;
-  std::cout << "Stand: start loadet" << std::endl;
-  Model modelStand{"assets/stand/stand.obj"};
-  std::cout << "Stand: end loadet" << std::endl;
-  std::cout << "Leaf: start loadet" << std::endl;
-  Model modelLeaf{"assets/leaf/leaf.obj"};
+  Model::setMeshCacheEnabled(options.meshCache);
+  Model::setMeshOptimizeEnabled(options.meshOptimize);
+  CompressedTexture::setEnabled(options.compressedTextures);
+  // 0 uploads every mip up front
+  TextureStreamer &streamer = TextureStreamer::get();
+  streamer.setBudget((size_t)options.textureBudget << 20);
+  streamer.setSynchronous(options.headless);
+
+  // Models decode on worker threads while the rest of the setup runs, the GL
+  // uploads happen in loader.finish()
+  ThreadPool workers;
+  AssetLoader loader(workers);
+  Model modelBall{loader, "assets/ball/ball.obj"};
+  Model modelStand{loader, "assets/stand/stand.obj"};
+  Model modelLeaf{loader, "assets/leaf/leaf.obj"};
   std::vector<glm::vec3> vegetationPos = {glm::vec3(-3.5f, 0.0f, -1.2f), //
                                           glm::vec3(0.2f, 0.0f, 4.0f),   //
                                           glm::vec3(0.0f, 0.0f, 6.1f),   //
                                           glm::vec3(-0.9f, 0.0f, -6.9)}; //
 
-  Model modelWindow{"assets/window/window.obj"};
+  Model modelWindow{loader, "assets/window/window.obj"};
 
-  Model modelPlandet{"assets/planet/planet.obj", true};
+  // drawn only with the object / instance shaders, which decode packed
+  // vertices
+  Model modelPlandet{loader, "assets/planet/planet.obj", true, false, false,
+                     true};
+  Model modelAsteroid{loader, "assets/asteroid/asteroid.obj", true, false,
+                      false, true, true};
 
   glBindVertexArray(0);
 
@@ -331,13 +638,17 @@ int main() {
 
   // Offscreen framebuffer
   OffscreenFBO framebufer;
+  // Headless runs have no default framebuffer, post-processing goes here
+  OffscreenFBO presentFBO;
 
   // Load cubmap
   GLuint CubemapTex = loadCubemap("Skybox");
   GLuint CubemapVAO = createCubMapVAO();
 
-  GLuint matrixUbo = genUbo(sizeof(glm::mat4) * 2);
-  UboBlocBinding(matrixUbo, sizeof(glm::mat3) * 2, 0);
+  // Matrices block: projection, view. Rebound every frame at the offset the
+  // stream buffer hands out.
+  StreamBuffer uniformStream(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * 2);
+  GLuint matrixUbo = uniformStream.getBuffer();
 
   ShaderBlockBinding(matrixUbo, ObjectShader, "Matrices", 0);
   ShaderBlockBinding(matrixUbo, OutLineShader, "Matrices", 0);
@@ -351,90 +662,458 @@ int main() {
   int instanceCount = 30000;
   float radius = 1.7f;
 
-  std::mt19937 engine(std::random_device{}());
+  std::mt19937 engine(options.headless ? 1337u : std::random_device{}());
 
   std::uniform_real_distribution<float> offsetDist(-0.3f, 0.3f);
   std::uniform_real_distribution<float> scaleDist(0.02f, 0.05f);
   std::uniform_real_distribution<float> rotDist(0.0f, glm::two_pi<float>());
 
-  std::vector<glm::mat4> modelMatrices(instanceCount);
-  std::vector<glm::mat3> normalMatrices(instanceCount);
-
-  for (unsigned int i = 0; i < instanceCount; ++i) {
-    glm::mat4 model(1.0f);
-
-    float angle = (float)i / instanceCount * glm::two_pi<float>();
-
-    float x = sin(angle) * radius + offsetDist(engine);
-    float y = offsetDist(engine) * 0.2f;
-    float z = cos(angle) * radius + offsetDist(engine);
+  // The random draws stay serial so a seed always gives the same field, the
+  // matrices are built from them on the workers.
+  struct InstanceParams {
+    glm::vec3 offset;
+    float scale;
+    float rotAngle;
+  };
+  std::vector<InstanceParams> instanceParams(instanceCount);
+  for (InstanceParams &params : instanceParams) {
+    params.offset.x = offsetDist(engine);
+    params.offset.y = offsetDist(engine) * 0.2f;
+    params.offset.z = offsetDist(engine);
+    params.scale = scaleDist(engine);
+    params.rotAngle = rotDist(engine);
+  }
 
-    model = glm::translate(model, {x - 5.0f, y + 1.0f, z});
+  std::vector<InstanceTRS> asteroidInstances(instanceCount);
+  workers.parallelFor(instanceCount, 4096, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const InstanceParams &params = instanceParams[i];
 
-    float scale = scaleDist(engine);
-    model = glm::scale(model, glm::vec3(scale));
+      float angle = (float)i / instanceCount * glm::two_pi<float>();
 
-    float rotAngle = rotDist(engine);
-    model = glm::rotate(model, rotAngle,
-                        glm::normalize(glm::vec3(0.3f, 0.6f, 0.8f)));
+      float x = sin(angle) * radius + params.offset.x;
+      float y = params.offset.y;
+      float z = cos(angle) * radius + params.offset.z;
 
-    modelMatrices[i] = model;
-    normalMatrices[i] = glm::transpose(
-        glm::inverse(glm::mat3{App.m_Camera.getView() * modelMatrices[i]}));
-  }
+      asteroidInstances[i] =
+          makeInstanceTRS({x - 5.0f, y + 1.0f, z}, params.scale,
+                          params.rotAngle, glm::vec3(0.3f, 0.6f, 0.8f));
+    }
+  });
 
-  Model modelAsteroid{"assets/asteroid/asteroid.obj", true};
+  loader.finish();
+  TextureCache::get().report(std::cout);
 
   Mesh &asteroidMesh = modelAsteroid.getMesh(0);
 
-  GLuint asteroidVBO, asteroidNormalVBO;
-  glGenBuffers(1, &asteroidVBO);
-  glGenBuffers(1, &asteroidNormalVBO);
-
-  glBindVertexArray(asteroidMesh.getVAO());
-  glBindBuffer(GL_ARRAY_BUFFER, asteroidVBO);
-  glBufferData(GL_ARRAY_BUFFER, modelMatrices.size() * sizeof(glm::mat4),
-               modelMatrices.data(), GL_STATIC_DRAW);
-
-  // instance attributes
-
-  for (int i = 0; i < 4; ++i) {
-    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
-                          (void *)(i * sizeof(glm::vec4)));
+  // Bounding spheres for culling, the mesh radius scaled per instance
+  float asteroidRadius =
+      boundingRadius(positionsOf(asteroidMesh.m_vertices),
+                     asteroidMesh.m_vertices.size(), sizeof(Vertex));
+  SphereSet asteroidBounds;
+  asteroidBounds.reserve(instanceCount);
+  for (const InstanceTRS &instance : asteroidInstances)
+    asteroidBounds.add(instance.position, asteroidRadius * instance.scale);
+  std::vector<uint32_t> visibleAsteroids(instanceCount);
+
+  // Visible instances regrouped by level of detail, every level draws its
+  // contiguous range of the instance stream
+  const std::vector<MeshLod> &asteroidLods = asteroidMesh.getLods();
+  std::vector<uint8_t> asteroidLod(instanceCount);
+  std::vector<uint32_t> lodAsteroids(instanceCount);
+  size_t lodStart[kMaxLods + 1] = {};
+
+  // Only the visible instances are compacted into the stream every frame.
+  // The attribute pointers follow the offset of that frame's region.
+  StreamBuffer instanceStream(GL_ARRAY_BUFFER,
+                              instanceCount * sizeof(InstanceTRS));
+
+  // a VAO of its own over the pool buffers, the instance attributes are
+  // not shared with the other meshes of its layout
+  GLuint asteroidVAO = GeometryPool::get().createVertexArray(
+      asteroidMesh.getGeometry().layout);
+  RenderState::get().bindVertexArray(asteroidVAO);
+  for (int i = 0; i < 2; ++i) {
     glEnableVertexAttribArray(3 + i);
     glVertexAttribDivisor(3 + i, 1);
   }
 
-  glBindBuffer(GL_ARRAY_BUFFER, asteroidNormalVBO);
-  glBufferData(GL_ARRAY_BUFFER, normalMatrices.size() * sizeof(glm::mat3),
-               normalMatrices.data(), GL_DYNAMIC_DRAW);
+  RenderState::get().bindVertexArray(0);
+
+  // the field as a static buffer, culled and split into levels on the GPU
+  std::optional<InstanceCuller> asteroidCuller;
+  if (options.gpuCulling)
+    asteroidCuller.emplace(*InstanceCullShader, asteroidMesh, asteroidRadius,
+                           asteroidInstances.data(), instanceCount,
+                           options.multiDrawIndirect);
+  // instance object }
 
-  for (int i = 0; i < 3; ++i) {
-    glVertexAttribPointer(7 + i, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat3),
-                          (void *)(i * sizeof(glm::vec3)));
-    glEnableVertexAttribArray(7 + i);
-    glVertexAttribDivisor(7 + i, 1);
+  // Scene graph {
+  // Every placed object is a node with its model's node hierarchy below
+  // it. The spinning ones hang from a node that only holds the rotation,
+  // their placement is never recomputed.
+  SceneGraph scene;
+  const glm::vec3 yAxis{0.0f, 1.0f, 0.0f};
+  uint32_t planetSpin = scene.addNode(
+      scene.addNode(SceneGraph::kNoParent,
+                    glm::translate(glm::mat4(1.0f), {-5.f, 1.0f, 0.0f})));
+  uint32_t planetRoot = modelPlandet.addToScene(scene, planetSpin);
+  uint32_t ballSpin = scene.addNode(SceneGraph::kNoParent);
+  uint32_t ballRoot = modelBall.addToScene(scene, ballSpin);
+  uint32_t standRoot = modelStand.addToScene(scene);
+  uint32_t mirrorSpin = scene.addNode(
+      scene.addNode(SceneGraph::kNoParent,
+                    glm::translate(glm::mat4(1.0f), {2.0f, 0.0f, 0.0f})));
+  uint32_t mirrorRoot = modelBall.addToScene(scene, mirrorSpin);
+  uint32_t diamondSpin = scene.addNode(
+      scene.addNode(SceneGraph::kNoParent,
+                    glm::translate(glm::mat4(1.0f), {-2.0f, 0.0f, 0.0f})));
+  uint32_t diamondRoot = modelBall.addToScene(scene, diamondSpin);
+
+  // leaves spin about y, then stand up
+  std::vector<uint32_t> leafSpins, leafRoots;
+  glm::mat4 leafTilt =
+      glm::rotate(glm::mat4(1.0f), glm::radians(90.f), {1.0f, 0.0f, 0.0f});
+  for (const glm::vec3 &position : vegetationPos) {
+    leafSpins.push_back(scene.addNode(scene.addNode(
+        SceneGraph::kNoParent, glm::translate(glm::mat4(1.0f), position))));
+    leafRoots.push_back(modelLeaf.addToScene(
+        scene, scene.addNode(leafSpins.back(), leafTilt)));
   }
+  std::vector<uint32_t> windowRoots;
+  for (const glm::vec3 &position : windowPos) {
+    glm::mat4 place = glm::rotate(glm::translate(glm::mat4(1.0f), position),
+                                  glm::radians(90.f), yAxis);
+    windowRoots.push_back(modelWindow.addToScene(
+        scene, scene.addNode(SceneGraph::kNoParent, place)));
+  }
+  scene.update();
+  // Scene graph }
+
+  // Object BVH {
+  // One object per placed model, boxed from its meshes' import bounds.
+  // The spinning ones are refitted every frame and only the objects the
+  // frustum query returns are drawn.
+  struct PlacedModel {
+    const Model *model;
+    uint32_t root;
+  };
+  enum : uint32_t {
+    kPlanetObject,
+    kBallObject,
+    kStandObject,
+    kMirrorObject,
+    kDiamondObject,
+    kFirstLeafObject
+  };
+  std::vector<PlacedModel> placed = {{&modelPlandet, planetRoot},
+                                     {&modelBall, ballRoot},
+                                     {&modelStand, standRoot},
+                                     {&modelBall, mirrorRoot},
+                                     {&modelBall, diamondRoot}};
+  for (uint32_t root : leafRoots)
+    placed.push_back({&modelLeaf, root});
+  uint32_t firstWindowObject = (uint32_t)placed.size();
+  for (uint32_t root : windowRoots)
+    placed.push_back({&modelWindow, root});
+
+  std::vector<uint32_t> movingObjects = {kPlanetObject, kBallObject,
+                                         kMirrorObject, kDiamondObject};
+  for (uint32_t i = 0; i < leafRoots.size(); ++i)
+    movingObjects.push_back(kFirstLeafObject + i);
+
+  std::vector<Aabb> objectBounds;
+  for (const PlacedModel &object : placed)
+    objectBounds.push_back(object.model->getBounds(scene, object.root));
+  Bvh objectBvh;
+  objectBvh.build(objectBounds.data(), objectBounds.size());
+  std::vector<uint32_t> visibleObjects;
+  std::vector<uint8_t> objectVisible(placed.size());
+  // Object BVH }
+
+  // Occlusion culling {
+  // The planet hides asteroids and objects behind it. The stand is not
+  // convex, its simplified mesh may reach outside it. Coarse, a triangle
+  // only hides the pixels it covers entirely.
+  std::vector<SceneOccluder> occluders;
+  addOccluders(modelPlandet, planetRoot, 128, occluders);
+  OcclusionBuffer occlusion(256, 128);
+  std::vector<uint8_t> asteroidVisible(instanceCount);
+  // Occlusion culling }
+
+  // Leaves and windows, one multi draw per model whatever the count
+  BatchRenderer batches(vegetationPos.size() * modelLeaf.getMeshes().size() +
+                            windowPos.size() * modelWindow.getMeshes().size(),
+                        options.multiDrawIndirect);
+
+  // Uniform handles, resolved once {
+  LightUniforms instanceLights(InstanceShader);
+  LightUniforms objectLights(ObjectShader);
+
+  // only the permutations these materials need are compiled
+  Shader &planetShader = ObjectShader.variant(materialDefines(modelPlandet));
+  Shader &ballShader = ObjectShader.variant(materialDefines(modelBall));
+  Shader &standShader = ObjectShader.variant(materialDefines(modelStand));
+  UniformHandle cubemapView = CubeMapShader.getUniform("view");
+  UniformHandle cubemapProjection = CubeMapShader.getUniform("projection");
+  UniformHandle depthView = DepthShader.getUniform("view");
+  UniformHandle depthProjection = DepthShader.getUniform("projection");
+  // Uniform handles }
+
+  // Uniforms that never change, set once and after a hot reload {
+  auto setConstantUniforms = [&] {
+    InstanceShader.use();
+    InstanceShader.setInt("material.texture_diffuse1", 0);
+    InstanceShader.setInt("material.texture_specular1", 1);
+    InstanceShader.setFloat("material.shininess", 64.f);
+
+    RefractionShader.use();
+    RefractionShader.setFloat("ROI", 1.309f);
+
+    DepthShader.use();
+    DepthShader.setFloat("near", 0.1f);
+    DepthShader.setFloat("far", 10.f);
+
+    for (Shader *postShader : {&ScreenShader, &InversShader, &GrayscaleShader,
+                               &SharpenShader, &BlurShader, &EdgeShader}) {
+      postShader->use();
+      postShader->setInt("screenTexture", 0);
+    }
+    RenderState::get().useProgram(0);
+  };
+  setConstantUniforms();
+
+  // the source tree can be passed with --shader-dir to edit in place
+  ShaderWatcher shaderWatcher;
+  if (options.watchShaders || !options.headless) {
+    for (Shader *shader :
+         {&InstanceShader, &VizNormalShader, &RefractionShader, &MirrorShader,
+          &CubeMapShader, &EdgeShader, &BlurShader, &SharpenShader,
+          &GrayscaleShader, &InversShader, &ScreenShader, &ObjectShader,
+          &TestShader, &LightShader, &DepthShader, &OutLineShader,
+          &TranspShader, &GlassShader})
+      shaderWatcher.watch(*shader);
+    if (InstanceCullShader)
+      shaderWatcher.watch(*InstanceCullShader);
+    shaderWatcher.setReloadCallback([&](Shader &) { setConstantUniforms(); });
+  }
+  // Uniforms that never change }
 
-  glBindVertexArray(0);
-  // instance object }
+  FrameProfiler profiler(true, options.headless ? options.warmup : 0);
+  unsigned int frameCount = options.warmup + options.frames;
 
-  glm::mat4 model;
-  while (!glfwWindowShouldClose(App.m_Window)) {
-    updateUbo(matrixUbo, 0, projection);
-    updateUbo(matrixUbo, sizeof(glm::mat4), App.m_Camera.getView());
+  unsigned int streamWaits = 0;
+  RenderState &state = RenderState::get();
 
-    float time = glfwGetTime();
+  // Render queue passes, each sets every state its draws depend on {
+  RenderQueue queue;
+  queue.setDepthRange(0.1f, 200.f);
 
-    App.update();
+  auto depthState = [&state] {
+    state.enable(GL_DEPTH_TEST);
+    state.depthMask(GL_TRUE);
+    state.depthFunc(GL_LESS);
+  };
+  queue.setPassState(RenderPass::Opaque, [&] {
+    profiler.beginPass("opaque");
+    depthState();
+    state.disable(GL_STENCIL_TEST);
+    state.enable(GL_CULL_FACE);
+    state.cullFace(GL_BACK);
+    state.frontFace(GL_CCW);
+  });
+  queue.setPassState(RenderPass::StencilWrite, [&] {
+    profiler.beginPass("stencil");
+    depthState();
+    state.enable(GL_STENCIL_TEST);
+    state.stencilMask(0xFF);
+    state.stencilFunc(GL_ALWAYS, 1, 0xFF);
+  });
+  queue.setPassState(RenderPass::Outline, [&] {
+    profiler.beginPass("outline");
+    depthState();
+    state.enable(GL_STENCIL_TEST);
+    state.stencilMask(0x00);
+    state.stencilFunc(GL_NOTEQUAL, 1, 0xFF);
+  });
+  queue.setPassState(RenderPass::Skybox, [&] {
+    profiler.beginPass("skybox");
+    state.disable(GL_STENCIL_TEST);
+    state.depthMask(GL_TRUE);
+    state.depthFunc(GL_LEQUAL);
+  });
+  queue.setPassState(RenderPass::Transparent, [&] {
+    profiler.beginPass("transparent");
+    state.disable(GL_STENCIL_TEST);
+    state.depthFunc(GL_LESS);
+    state.depthMask(GL_FALSE);
+    state.enable(GL_BLEND);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  });
+  // Render queue passes }
+
+  while (options.headless ? profiler.getFrameCount() < frameCount
+                          : !glfwWindowShouldClose(App.m_Window)) {
+    profiler.beginFrame();
+    // setup and the previous frame's swap may have touched GL directly
+    state.reset();
+
+    float time = options.headless ? profiler.getFrameCount() / 60.0f
+                                  : glfwGetTime();
+
+    App.update(time);
     float aspect = (float)App.m_FbWidth / (float)App.m_FbHight;
     projection = glm::perspective(glm::radians(45.f), aspect, 0.1f, 200.f);
 
+    shaderWatcher.poll();
+
+    // only the spin nodes change, update() recomputes them and their
+    // subtrees
+    glm::mat4 spin =
+        glm::rotate(glm::mat4(1.0f), glm::radians(time * 7), yAxis);
+    for (uint32_t node : {planetSpin, ballSpin, mirrorSpin, diamondSpin})
+      scene.setLocal(node, spin);
+    glm::mat4 leafSpin =
+        glm::rotate(glm::mat4(1.0f), glm::radians(time * 10), yAxis);
+    for (uint32_t node : leafSpins)
+      scene.setLocal(node, leafSpin);
+    size_t sceneUpdates = scene.update();
+    for (uint32_t object : movingObjects)
+      objectBvh.update(object, placed[object].model->getBounds(
+                                   scene, placed[object].root));
+    objectBvh.refit();
+
     // input
-    processInput(App);
+    if (options.headless)
+      scriptedCamera(App.m_Camera, profiler.getFrameCount(), frameCount);
+    else
+      processInput(App);
+
+    // Culling {
+    profiler.beginPass("culling");
+    const glm::mat4 &view = App.m_Camera.getView();
+    Frustum frustum = Frustum::fromMatrix(projection * view);
+    visibleObjects.clear();
+    objectBvh.queryFrustum(frustum, visibleObjects);
+    std::fill(objectVisible.begin(), objectVisible.end(), 0);
+    for (uint32_t object : visibleObjects)
+      objectVisible[object] = 1;
+
+    // with GPU culling the CPU keeps no asteroid, nothing is streamed
+    size_t visibleCount =
+        options.gpuCulling
+            ? 0
+            : cullSpheres(frustum, asteroidBounds, visibleAsteroids.data());
+
+    // what the frustum kept is tested against the occluders' depth
+    size_t occlusionTested = visibleObjects.size() + visibleCount;
+    size_t occluded = 0;
+    if (options.occlusionCulling) {
+      occlusion.begin(projection * view);
+      for (const SceneOccluder &occluder : occluders)
+        occlusion.addOccluder(occluder.mesh, scene.getWorld(occluder.node));
+      occlusion.rasterize(&workers);
+
+      for (uint32_t object : visibleObjects) {
+        if (!occlusion.isVisible(objectBvh.getBounds(object))) {
+          objectVisible[object] = 0;
+          ++occluded;
+        }
+      }
+      workers.parallelFor(visibleCount, 2048, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          uint32_t index = visibleAsteroids[i];
+          glm::vec3 center{asteroidBounds.x()[index],
+                           asteroidBounds.y()[index],
+                           asteroidBounds.z()[index]};
+          glm::vec3 radius(asteroidBounds.radius()[index]);
+          asteroidVisible[i] =
+              occlusion.isVisible(Aabb{center - radius, center + radius});
+        }
+      });
+      // in place, the order stays ascending
+      size_t kept = 0;
+      for (size_t i = 0; i < visibleCount; ++i)
+        if (asteroidVisible[i])
+          visibleAsteroids[kept++] = visibleAsteroids[i];
+      occluded += visibleCount - kept;
+      visibleCount = kept;
+    }
+    // Culling }
+
+    // Per frame uploads {
+    profiler.beginPass("upload");
+    uniformStream.begin();
+    instanceStream.begin();
+    batches.begin();
+
+    GLintptr matricesOffset = 0;
+    glm::mat4 *matrices = (glm::mat4 *)uniformStream.allocate(
+        sizeof(glm::mat4) * 2, matricesOffset);
+    // without them nothing of the scene is drawn this frame
+    if (matrices) {
+      matrices[0] = projection;
+      matrices[1] = view;
+    }
+
+    // the asteroids are skipped for the frame if their instances do not fit
+    GLintptr instanceOffset = 0;
+    InstanceTRS *instances = (InstanceTRS *)instanceStream.allocate(
+        visibleCount * sizeof(InstanceTRS), instanceOffset);
+    if (!instances)
+      visibleCount = 0;
+
+    // level of detail from the projected simplification error, the
+    // instance scale is its bounding radius over the mesh's
+    const glm::vec3 &eye = App.m_Camera.getPosition();
+    float pixelsPerUnit =
+        App.m_FbHight / (2.0f * std::tan(glm::radians(45.f) / 2.0f));
+    workers.parallelFor(visibleCount, 2048, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        uint32_t index = visibleAsteroids[i];
+        glm::vec3 center{asteroidBounds.x()[index], asteroidBounds.y()[index],
+                         asteroidBounds.z()[index]};
+        float radius = asteroidBounds.radius()[index];
+        float distance = std::max(glm::length(center - eye) - radius, 0.1f);
+        float pixels = radius / asteroidRadius * pixelsPerUnit / distance;
+        asteroidLod[i] = (uint8_t)asteroidMesh.selectLod(pixels,
+                                                         options.lodError);
+      }
+    });
+    std::fill(std::begin(lodStart), std::end(lodStart), 0);
+    for (size_t i = 0; i < visibleCount; ++i)
+      ++lodStart[asteroidLod[i] + 1];
+    for (size_t lod = 0; lod < kMaxLods; ++lod)
+      lodStart[lod + 1] += lodStart[lod];
+    {
+      size_t fill[kMaxLods];
+      std::copy(lodStart, lodStart + kMaxLods, fill);
+      for (size_t i = 0; i < visibleCount; ++i)
+        lodAsteroids[fill[asteroidLod[i]]++] = visibleAsteroids[i];
+    }
+
+    workers.parallelFor(visibleCount, 2048, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        instances[i] = asteroidInstances[lodAsteroids[i]];
+    });
+    size_t asteroidTriangles = 0;
+    for (size_t lod = 0; lod < asteroidLods.size(); ++lod)
+      asteroidTriangles += (lodStart[lod + 1] - lodStart[lod]) *
+                           asteroidLods[lod].indexCount / 3;
+
+    uniformStream.commit();
+    instanceStream.commit();
+    if (matrices)
+      glBindBufferRange(GL_UNIFORM_BUFFER, 0, matrixUbo, matricesOffset,
+                        sizeof(glm::mat4) * 2);
+    if (matrices && options.gpuCulling)
+      asteroidCuller->cull(frustum, eye, pixelsPerUnit, options.lodError);
+    // Per frame uploads }
 
     // Creating a custom framebufer //////////////////////
     createFramebuffer(App, framebufer);
+    if (options.headless)
+      createFramebuffer(App, presentFBO);
     // Creating a custom framebufer \\\\\\\\\\\\\\\\\\\\\\
 
     glBindFramebuffer(GL_FRAMEBUFFER, framebufer.fbo);
@@ -443,405 +1122,379 @@ int main() {
     // Clear
     glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-
-    model = glm::mat4{1.0f};
-
-    if (!App.m_Camera.getDepthModeStatus()) {
+    state.stencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+
+    bool depthMode = App.m_Camera.getDepthModeStatus();
+    if (matrices && !depthMode) {
+      auto distanceTo = [&](const glm::vec3 &position) {
+        return glm::length(eye - position);
+      };
+
+      // Mip requests for the streamer from the on-screen diameter of each
+      // draw's bounding sphere
+      auto requestTextures = [&](const Model &model, const glm::vec3 &center,
+                                 float radius) {
+        float distance = std::max(distanceTo(center) - radius, 0.1f);
+        float pixels = 2.0f * radius / distance * pixelsPerUnit;
+        for (const Texture &texture : model.getTextures())
+          streamer.request(texture, pixels);
+      };
+
+      // light uniforms are program state, set once before any draw
+      InstanceShader.use();
+      setLights(InstanceShader, instanceLights, App.m_Camera);
+      ObjectShader.forEachVariant([&](Shader &shader) {
+        shader.use();
+        setLights(shader, objectLights, App.m_Camera);
+      });
 
       // Asteroids models{
-      glEnable(GL_CULL_FACE);
-      glCullFace(GL_BACK);
-      glFrontFace(GL_CCW);
-
-      InstanceShader.use();
-      InstanceShader.setVec3("dirLight.direction",
-                             glm::vec3(App.m_Camera.getView() *
-                                       glm::vec4(0.0f, -1.0f, 0.0f, 0.0f)));
-      InstanceShader.setVec3("dirLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      InstanceShader.setVec3("dirLight.diffuse", glm::vec3(0.3f, 0.3f, 0.3f));
-      InstanceShader.setVec3("dirLight.specular", glm::vec3(0.3f, 0.3f, 0.3f));
-
-      // Pointlight properties
-      InstanceShader.setVec3(
-          "pointLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(glm::vec3(0.0f, 2.0f, 0.0f), 1.0f)));
-
-      InstanceShader.setVec3("pointLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      InstanceShader.setVec3("pointLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      InstanceShader.setVec3("pointLight.specular",
-                             glm::vec3(1.0f, 1.0f, 1.0f));
-      InstanceShader.setFloat("pointLight.constant", 1.0f);
-      InstanceShader.setFloat("pointLight.linear", 0.14f);
-      InstanceShader.setFloat("pointLight.quadratic", 0.07f);
-
-      // Flash light properties
-      InstanceShader.setVec3(
-          "flashLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(App.m_Camera.getPosition(), 1.0f)));
-      InstanceShader.setVec3(
-          "flashLight.direction",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(App.m_Camera.getFront(), 0.0f)));
-      InstanceShader.setVec3("flashLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      InstanceShader.setVec3("flashLight.specular",
-                             glm::vec3(1.0f, 1.0f, 1.0f));
-      InstanceShader.setFloat("flashLight.cutOff", cos(glm::radians(20.f)));
-      InstanceShader.setFloat("flashLight.outerCutOff",
-                              cos(glm::radians(13.f)));
-
-      glBindVertexArray(asteroidMesh.getVAO());
-      //
-      // for (int i = 0; i < instanceCount; ++i) {
-      //   normalMatrices[i] = glm::transpose(
-      //       glm::inverse(glm::mat3{App.m_Camera.getView() *
-      //       modelMatrices[i]}));
-      // }
-      // glBindBuffer(GL_ARRAY_BUFFER, asteroidNormalVBO);
-      // glBufferSubData(GL_ARRAY_BUFFER, 0,
-      //                 normalMatrices.size() * sizeof(glm::mat3),
-      //                 normalMatrices.data());
-
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, asteroidMesh.m_textures[0].id);
-      InstanceShader.setInt("material.texture_diffuse1", 0);
-      glActiveTexture(GL_TEXTURE0 + 1);
-      glBindTexture(GL_TEXTURE_2D, asteroidMesh.m_textures[1].id);
-      InstanceShader.setInt("material.texture_specular1", 1);
-      InstanceShader.setFloat("material.shininess", 64.f);
-
-      glDrawElementsInstanced(GL_TRIANGLES, asteroidMesh.m_indices.size(),
-                              GL_UNSIGNED_INT, 0, instanceCount);
+      if (options.gpuCulling) {
+        // the survivors are not known here, textures as for the closest
+        // possible rock
+        requestTextures(modelAsteroid, eye, asteroidRadius);
+        queue.submit(
+            queue.makeKey(RenderPass::Opaque, InstanceShader.ID,
+                          materialKey(modelAsteroid),
+                          distanceTo(glm::vec3(-5.0f, 1.0f, 0.0f))),
+            [&] {
+              InstanceShader.use();
+              asteroidMesh.setVertexDecode(InstanceShader);
+              state.bindVertexArray(asteroidVAO);
+              state.bindTexture(0, GL_TEXTURE_2D,
+                                asteroidMesh.m_textures[0].id);
+              state.bindTexture(1, GL_TEXTURE_2D,
+                                asteroidMesh.m_textures[1].id);
+              asteroidCuller->draw();
+            });
+      } else if (visibleCount > 0) {
+        // the closest visible rock decides the field's mip level
+        size_t nearest = visibleAsteroids[0];
+        float nearestDistance = FLT_MAX;
+        for (size_t i = 0; i < visibleCount; ++i) {
+          uint32_t index = visibleAsteroids[i];
+          glm::vec3 center{asteroidBounds.x()[index],
+                           asteroidBounds.y()[index],
+                           asteroidBounds.z()[index]};
+          float distance =
+              distanceTo(center) - asteroidBounds.radius()[index];
+          if (distance < nearestDistance) {
+            nearestDistance = distance;
+            nearest = index;
+          }
+        }
+        requestTextures(modelAsteroid,
+                        {asteroidBounds.x()[nearest],
+                         asteroidBounds.y()[nearest],
+                         asteroidBounds.z()[nearest]},
+                        asteroidBounds.radius()[nearest]);
+
+        queue.submit(
+            queue.makeKey(RenderPass::Opaque, InstanceShader.ID,
+                          materialKey(modelAsteroid),
+                          distanceTo(glm::vec3(-5.0f, 1.0f, 0.0f))),
+            [&] {
+              InstanceShader.use();
+              asteroidMesh.setVertexDecode(InstanceShader);
+
+              state.bindVertexArray(asteroidVAO);
+              state.bindTexture(0, GL_TEXTURE_2D,
+                                asteroidMesh.m_textures[0].id);
+              state.bindTexture(1, GL_TEXTURE_2D,
+                                asteroidMesh.m_textures[1].id);
+
+              // GL 3.3 has no base instance, the attribute pointers move
+              // to each level's range instead
+              glBindBuffer(GL_ARRAY_BUFFER, instanceStream.getBuffer());
+              for (size_t lod = 0; lod < asteroidLods.size(); ++lod) {
+                size_t count = lodStart[lod + 1] - lodStart[lod];
+                if (count == 0)
+                  continue;
+                GLintptr instances =
+                    instanceOffset + lodStart[lod] * sizeof(InstanceTRS);
+                glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE,
+                                      sizeof(InstanceTRS), (void *)instances);
+                glVertexAttribPointer(
+                    4, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTRS),
+                    (void *)(instances + offsetof(InstanceTRS, rotation)));
+                const GeometryRange &geometry = asteroidMesh.getGeometry();
+                const MeshLod &level = asteroidLods[lod];
+                glDrawElementsInstancedBaseVertex(
+                    GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT,
+                    (void *)((geometry.firstIndex + level.indexOffset) *
+                             sizeof(GLuint)),
+                    (GLsizei)count, geometry.baseVertex);
+                state.countDraws(1);
+              }
+              glBindBuffer(GL_ARRAY_BUFFER, 0);
+            });
+      }
       // Asteroids models}
 
       // Planet model {
-
-      ObjectShader.use();
-
-      ObjectShader.setVec3("dirLight.direction",
-                           glm::vec3(App.m_Camera.getView() *
-                                     glm::vec4(0.0f, -1.0f, 0.0f, 0.0f)));
-      ObjectShader.setVec3("dirLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      ObjectShader.setVec3("dirLight.diffuse", glm::vec3(0.3f, 0.3f, 0.3f));
-      ObjectShader.setVec3("dirLight.specular", glm::vec3(0.3f, 0.3f, 0.3f));
-
-      // Pointlight properties
-      ObjectShader.setVec3(
-          "pointLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(glm::vec3(0.0f, 2.0f, 0.0f), 1.0f)));
-
-      ObjectShader.setVec3("pointLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      ObjectShader.setVec3("pointLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setVec3("pointLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-
-      // Flash light properties
-      ObjectShader.setVec3(
-          "flashLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(App.m_Camera.getPosition(), 1.0f)));
-      ObjectShader.setVec3("flashLight.direction",
-                           glm::vec3(App.m_Camera.getView() *
-                                     glm::vec4(App.m_Camera.getFront(), 0.0f)));
-      ObjectShader.setVec3("flashLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setVec3("flashLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setFloat("flashLight.cutOff", cos(glm::radians(20.f)));
-      ObjectShader.setFloat("flashLight.outerCutOff", cos(glm::radians(13.f)));
-
-      // Matrix
-      model = glm::mat4(1.0f);
-      {
-        model = glm::translate(model, glm::vec3{-5.f, 1.0f, 0.0f});
-
-        float angle = time * 7;
-        model = glm::rotate(model, glm::radians(angle),
-                            glm::vec3{0.0f, 1.0f, 0.0f});
+      glm::vec3 planetCenter(scene.getWorld(planetSpin)[3]);
+      if (objectVisible[kPlanetObject]) {
+        requestTextures(modelPlandet, planetCenter,
+                        modelPlandet.getBoundingRadius());
+        queue.submit(queue.makeKey(RenderPass::Opaque, planetShader.ID,
+                                   materialKey(modelPlandet),
+                                   distanceTo(planetCenter)),
+                     [&] {
+                       planetShader.use();
+                       modelPlandet.Draw(planetShader, scene, planetRoot,
+                                         App.m_Camera.getView());
+                     });
       }
-      ObjectShader.setMat4("model", model);
-      ObjectShader.setMat3("inverse", glm::mat3(glm::transpose(glm::inverse(
-                                          App.m_Camera.getView() * model))));
-      modelPlandet.Draw(ObjectShader);
       // Planet model }
 
       // Ball model {
-      glEnable(GL_DEPTH_TEST);
-      glDepthMask(GL_TRUE);
-      glDepthFunc(GL_LESS);
-      glEnable(GL_STENCIL_TEST);
-      glStencilMask(0xFF);
-      glStencilFunc(GL_ALWAYS, 1, 0xFF);
-
-      ObjectShader.use();
-      // Direction light properties
-      ObjectShader.setVec3("dirLight.direction",
-                           glm::vec3(App.m_Camera.getView() *
-                                     glm::vec4(0.0f, -1.0f, 0.0f, 0.0f)));
-      ObjectShader.setVec3("dirLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      ObjectShader.setVec3("dirLight.diffuse", glm::vec3(0.3f, 0.3f, 0.3f));
-      ObjectShader.setVec3("dirLight.specular", glm::vec3(0.3f, 0.3f, 0.3f));
-
-      // Pointlight properties
-      ObjectShader.setVec3(
-          "pointLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(glm::vec3(0.0f, 2.0f, 0.0f), 1.0f)));
-
-      ObjectShader.setVec3("pointLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      ObjectShader.setVec3("pointLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setVec3("pointLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-
-      // Flash light properties
-      ObjectShader.setVec3(
-          "flashLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(App.m_Camera.getPosition(), 1.0f)));
-      ObjectShader.setVec3("flashLight.direction",
-                           glm::vec3(App.m_Camera.getView() *
-                                     glm::vec4(App.m_Camera.getFront(), 0.0f)));
-      ObjectShader.setVec3("flashLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setVec3("flashLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setFloat("flashLight.cutOff", cos(glm::radians(20.f)));
-      ObjectShader.setFloat("flashLight.outerCutOff", cos(glm::radians(13.f)));
-
-      // Matrix
-      model = glm::mat4(1.0f);
-      {
-        float angle = time * 7;
-        model = glm::rotate(model, glm::radians(angle),
-                            glm::vec3{0.0f, 1.0f, 0.0f});
-      }
-      ObjectShader.setMat4("model", model);
-      ObjectShader.setMat3("inverse", glm::mat3(glm::transpose(glm::inverse(
-                                          App.m_Camera.getView() * model))));
-      modelBall.Draw(ObjectShader);
-      if (false) {
-        // Normals visualization {
-        // Matrix
-        VizNormalShader.use();
-        model = glm::mat4(1.0f);
-        {
-          float angle = time * 7;
-          model = glm::rotate(model, glm::radians(angle),
-                              glm::vec3{0.0f, 1.0f, 0.0f});
+      glm::vec3 ballCenter(scene.getWorld(ballSpin)[3]);
+      if (objectVisible[kBallObject]) {
+        requestTextures(modelBall, ballCenter, modelBall.getBoundingRadius());
+        queue.submit(queue.makeKey(RenderPass::StencilWrite, ballShader.ID,
+                                   materialKey(modelBall),
+                                   distanceTo(ballCenter)),
+                     [&] {
+                       ballShader.use();
+                       modelBall.Draw(ballShader, scene, ballRoot,
+                                      App.m_Camera.getView());
+                     });
+        if (false) {
+          // Normals visualization {
+          VizNormalShader.use();
+          modelBall.Draw(VizNormalShader, scene, ballRoot,
+                         App.m_Camera.getView());
+          // Normals visualization }
         }
-        VizNormalShader.setMat4("model", model);
-        VizNormalShader.setMat3(
-            "inverse", glm::mat3(glm::transpose(
-                           glm::inverse(App.m_Camera.getView() * model))));
-        modelBall.Draw(VizNormalShader);
-        // Normals visualization }
+
+        // Ball outLine model {
+        queue.submit(queue.makeKey(RenderPass::Outline, OutLineShader.ID, 0,
+                                   distanceTo(ballCenter)),
+                     [&] {
+                       OutLineShader.use();
+                       modelBall.Draw(OutLineShader, scene, ballRoot,
+                                      App.m_Camera.getView());
+                     });
+        // Ball outLine model }
       }
       // Ball model }
 
-      // Ball outLine model {
-      glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-      glStencilMask(0x00);
-
-      OutLineShader.use();
-      OutLineShader.setMat4("model", model);
-      OutLineShader.setMat3("inverse", glm::mat3(glm::transpose(glm::inverse(
-                                           App.m_Camera.getView() * model))));
-      modelBall.Draw(OutLineShader);
-
-      glEnable(GL_DEPTH_TEST);
-      glDepthMask(0xFF);
-      glDisable(GL_STENCIL_TEST);
-      // Ball outLine model }
-
       // Stand model {
-      ObjectShader.use();
-      // Direction light properties
-      ObjectShader.setVec3("dirLight.direction",
-                           glm::vec3(App.m_Camera.getView() *
-                                     glm::vec4(0.0f, -1.0f, 0.0f, 0.0f)));
-      ObjectShader.setVec3("dirLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      ObjectShader.setVec3("dirLight.diffuse", glm::vec3(0.3f, 0.3f, 0.3f));
-      ObjectShader.setVec3("dirLight.specular", glm::vec3(0.3f, 0.3f, 0.3f));
-
-      // Pointlight properties
-      ObjectShader.setVec3(
-          "pointLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(glm::vec3(0.0f, 2.0f, 0.0f), 1.0f)));
-
-      ObjectShader.setVec3("pointLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-      ObjectShader.setVec3("pointLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setVec3("pointLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-
-      // Flash light properties
-      ObjectShader.setVec3(
-          "flashLight.position",
-          glm::vec3(App.m_Camera.getView() *
-                    glm::vec4(App.m_Camera.getPosition(), 1.0f)));
-      ObjectShader.setVec3("flashLight.direction",
-                           glm::vec3(App.m_Camera.getView() *
-                                     glm::vec4(App.m_Camera.getFront(), 0.0f)));
-      ObjectShader.setVec3("flashLight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setVec3("flashLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-      ObjectShader.setFloat("flashLight.cutOff", cos(glm::radians(20.f)));
-      ObjectShader.setFloat("flashLight.outerCutOff", cos(glm::radians(13.f)));
-
-      // Matrix
-      model = glm::mat4(1.0f);
-      ObjectShader.setMat4("model", model);
-      ObjectShader.setMat3("inverse", glm::mat3(glm::transpose(glm::inverse(
-                                          App.m_Camera.getView() * model))));
-      modelStand.Draw(ObjectShader);
-
+      if (objectVisible[kStandObject]) {
+        requestTextures(modelStand, {}, modelStand.getBoundingRadius());
+        queue.submit(queue.makeKey(RenderPass::Opaque, standShader.ID,
+                                   materialKey(modelStand), distanceTo({})),
+                     [&] {
+                       standShader.use();
+                       modelStand.Draw(standShader, scene, standRoot,
+                                       App.m_Camera.getView());
+                     });
+      }
       // Stand model }
 
       // Leaf model {
-      glEnable(GL_DEPTH_TEST);
-      glStencilFunc(GL_ALWAYS, 1, 0x00);
-
-      TranspShader.use();
-      for (int i = 0; i < vegetationPos.size(); ++i) {
-        // Matrix
-        model = glm::mat4{1.0f};
-        model = glm::translate(model, vegetationPos[i]);
-        {
-          float angle = time * 10;
-          model = glm::rotate(model, glm::radians(angle),
-                              glm::vec3{0.0f, 1.0f, 0.0f});
-          model = glm::rotate(model, glm::radians(90.f),
-                              glm::vec3{1.0f, 0.0f, 0.0f});
-        }
-        TranspShader.setMat4("model", model);
-
-        modelLeaf.Draw(TranspShader);
+      size_t leafBatch = batches.beginBatch();
+      float leafDistance = FLT_MAX;
+      for (size_t i = 0; i < vegetationPos.size(); ++i) {
+        if (!objectVisible[kFirstLeafObject + i])
+          continue;
+        const glm::vec3 &position = vegetationPos[i];
+        requestTextures(modelLeaf, position, modelLeaf.getBoundingRadius());
+        batches.add(modelLeaf, scene, leafRoots[i]);
+        leafDistance = std::min(leafDistance, distanceTo(position));
       }
-      model = glm::mat4{1.0f};
+      // the nearest leaf sorts the batch among the opaque draws, FLT_MAX
+      // when none is visible
+      if (leafDistance != FLT_MAX && !modelLeaf.getMeshes().empty())
+        queue.submit(queue.makeKey(RenderPass::Opaque, TranspShader.ID,
+                                   materialKey(modelLeaf), leafDistance),
+                     [&, leafBatch] {
+                       TranspShader.use();
+                       modelLeaf.getMeshes()[0].bindMaterial(TranspShader);
+                       batches.draw(leafBatch);
+                     });
       // Leaf model }
 
       // Ball mirror model {
-      MirrorShader.use();
-
-      glBindTexture(GL_TEXTURE_CUBE_MAP, CubemapTex);
-
-      // Matrix
-      model = glm::mat4(1.0f);
-      {
-        model = glm::translate(model, glm::vec3{2.0f, 0.0f, 0.0f});
-        float angle = time * 7;
-        model = glm::rotate(model, glm::radians(angle),
-                            glm::vec3{0.0f, 1.0f, 0.0f});
-      }
-      MirrorShader.setMat4("model", model);
-      MirrorShader.setMat3("inverse", glm::mat3(glm::transpose(glm::inverse(
-                                          App.m_Camera.getView() * model))));
-      modelBall.Draw(MirrorShader, false);
-
+      glm::vec3 mirrorCenter(scene.getWorld(mirrorSpin)[3]);
+      if (objectVisible[kMirrorObject])
+        queue.submit(queue.makeKey(RenderPass::Opaque, MirrorShader.ID,
+                                   CubemapTex, distanceTo(mirrorCenter)),
+                     [&] {
+                       MirrorShader.use();
+                       state.bindTexture(0, GL_TEXTURE_CUBE_MAP, CubemapTex);
+                       modelBall.Draw(MirrorShader, scene, mirrorRoot,
+                                      App.m_Camera.getView(), false);
+                     });
       // Ball mirror model }
 
       // Ball diamond model {
-      RefractionShader.use();
-
-      glBindTexture(GL_TEXTURE_CUBE_MAP, CubemapTex);
-
-      // Matrix
-      model = glm::mat4(1.0f);
-      {
-        model = glm::translate(model, glm::vec3{-2.0f, 0.0f, 0.0f});
-        float angle = time * 7;
-        model = glm::rotate(model, glm::radians(angle),
-                            glm::vec3{0.0f, 1.0f, 0.0f});
-      }
-      RefractionShader.setFloat("ROI", 1.309f);
-      RefractionShader.setMat4("model", model);
-      RefractionShader.setMat3(
-          "inverse", glm::mat3(glm::transpose(
-                         glm::inverse(App.m_Camera.getView() * model))));
-      modelBall.Draw(RefractionShader, false);
-
+      glm::vec3 diamondCenter(scene.getWorld(diamondSpin)[3]);
+      if (objectVisible[kDiamondObject])
+        queue.submit(queue.makeKey(RenderPass::Opaque, RefractionShader.ID,
+                                   CubemapTex, distanceTo(diamondCenter)),
+                     [&] {
+                       RefractionShader.use();
+                       state.bindTexture(0, GL_TEXTURE_CUBE_MAP, CubemapTex);
+                       modelBall.Draw(RefractionShader, scene, diamondRoot,
+                                      App.m_Camera.getView(), false);
+                     });
       // Ball diamond model }
 
       // Cubemap {
-      glDepthFunc(GL_LEQUAL);
-      CubeMapShader.use();
-      CubeMapShader.setMat4("view",
-                            glm::mat4(glm::mat3(App.m_Camera.getView())));
-      CubeMapShader.setMat4("projection", projection);
-      glBindVertexArray(CubemapVAO);
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_CUBE_MAP, CubemapTex);
-      glDrawArrays(GL_TRIANGLES, 0, 36);
+      queue.submit(
+          queue.makeKey(RenderPass::Skybox, CubeMapShader.ID, CubemapTex, 0),
+          [&] {
+            CubeMapShader.use();
+            CubeMapShader.setMat4(cubemapView,
+                                  glm::mat4(glm::mat3(App.m_Camera.getView())));
+            CubeMapShader.setMat4(cubemapProjection, projection);
+            state.bindVertexArray(CubemapVAO);
+            state.bindTexture(0, GL_TEXTURE_CUBE_MAP, CubemapTex);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            state.countDraws(1);
+          });
       // Cubemap }
 
       // Window model {
-      // Sort transparent window
-      std::map<float, glm::vec3> sorted;
-      for (unsigned int i = 0; i < windowPos.size(); ++i) {
-        float distance = glm::length(App.m_Camera.getPosition() - windowPos[i]);
-        sorted[distance] = windowPos[i];
-      }
-
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-      glDepthMask(GL_FALSE);
-
-      GlassShader.use();
-      for (std::map<float, glm::vec3>::reverse_iterator it = sorted.rbegin();
-           it != sorted.rend(); ++it) {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, it->second);
-        model = glm::rotate(model, glm::radians(90.f), glm::vec3(0, 1, 0));
-
-        GlassShader.setMat4("model", model);
-
-        modelWindow.Draw(GlassShader);
+      // blended, so the batch itself is ordered back to front and sorts
+      // among the transparent draws by its farthest window
+      std::vector<size_t> windowOrder;
+      for (size_t i = 0; i < windowPos.size(); ++i)
+        if (objectVisible[firstWindowObject + i])
+          windowOrder.push_back(i);
+      std::sort(windowOrder.begin(), windowOrder.end(),
+                [&](size_t a, size_t b) {
+                  return distanceTo(windowPos[a]) > distanceTo(windowPos[b]);
+                });
+      size_t windowBatch = batches.beginBatch();
+      for (size_t window : windowOrder) {
+        requestTextures(modelWindow, windowPos[window],
+                        modelWindow.getBoundingRadius());
+        batches.add(modelWindow, scene, windowRoots[window]);
       }
-      glDepthMask(GL_TRUE);
-      glDisable(GL_BLEND);
+      if (!windowOrder.empty() && !modelWindow.getMeshes().empty())
+        queue.submit(queue.makeKey(RenderPass::Transparent, GlassShader.ID,
+                                   materialKey(modelWindow),
+                                   distanceTo(windowPos[windowOrder[0]])),
+                     [&, windowBatch] {
+                       GlassShader.use();
+                       modelWindow.getMeshes()[0].bindMaterial(GlassShader);
+                       batches.draw(windowBatch);
+                     });
       // Window model }
 
-      glDepthMask(GL_TRUE);
-      glStencilMask(0xFF);
-      glStencilFunc(GL_ALWAYS, 1, 0xFF);
-      glDepthFunc(GL_LESS);
-    } else {
+      batches.commit();
+      queue.execute();
+
+      state.depthMask(GL_TRUE);
+      state.disable(GL_BLEND);
+      state.stencilMask(0xFF);
+      state.stencilFunc(GL_ALWAYS, 1, 0xFF);
+      state.depthFunc(GL_LESS);
+      profiler.endPass();
+    } else if (depthMode) {
+      profiler.beginPass("depth");
       DepthShader.use();
-      DepthShader.setFloat("near", 0.1f);
-      DepthShader.setFloat("far", 10.f);
 
       // Matrix
-      DepthShader.setMat4("model", model);
-      DepthShader.setMat4("projection", projection);
-      DepthShader.setMat4("view", App.m_Camera.getView());
-      modelBall.Draw(DepthShader, false);
+      DepthShader.setMat4(depthProjection, projection);
+      DepthShader.setMat4(depthView, App.m_Camera.getView());
+      modelBall.Draw(DepthShader, scene, ballRoot, App.m_Camera.getView(),
+                     false);
+      profiler.endPass();
     }
 
+    profiler.beginPass("post");
+    GLuint presentTarget = options.headless ? presentFBO.fbo : 0;
     if (!App.m_Camera.getDepthModeStatus()) {
       switch (App.m_effectType) {
       case EffectType::NoEffect:
-        drawQuad(ScreenShader, framebufer);
+        drawQuad(ScreenShader, framebufer, presentTarget);
         break;
       case EffectType::Inversion:
-        drawQuad(InversShader, framebufer);
+        drawQuad(InversShader, framebufer, presentTarget);
         break;
       case EffectType::Grayscale:
-        drawQuad(GrayscaleShader, framebufer);
+        drawQuad(GrayscaleShader, framebufer, presentTarget);
         break;
       case EffectType::Sharpen:
-        drawQuad(SharpenShader, framebufer);
+        drawQuad(SharpenShader, framebufer, presentTarget);
         break;
       case EffectType::Blur:
-        drawQuad(BlurShader, framebufer);
+        drawQuad(BlurShader, framebufer, presentTarget);
         break;
       case EffectType::Edge:
-        drawQuad(EdgeShader, framebufer);
+        drawQuad(EdgeShader, framebufer, presentTarget);
         break;
       }
     } else {
-      drawQuad(ScreenShader, framebufer);
+      drawQuad(ScreenShader, framebufer, presentTarget);
     }
+    profiler.endPass();
+
+    profiler.beginPass("streaming");
+    streamer.update();
+    profiler.endPass();
 
-    // check and call events and swap the buffers
-    glfwSwapBuffers(App.m_Window);
-    glfwPollEvents();
+    if (!options.headless) {
+      // check and call events and swap the buffers
+      glfwSwapBuffers(App.m_Window);
+      glfwPollEvents();
+    }
+    uniformStream.end();
+    instanceStream.end();
+    batches.end();
+
+    profiler.setCounter("uniform lookups", Shader::getLookupCount());
+    profiler.setCounter("state calls", state.getIssuedCount());
+    profiler.setCounter("state calls elided", state.getElidedCount());
+    profiler.setCounter("draw calls", state.getDrawCount());
+    state.resetCounters();
+    profiler.setCounter("scene nodes updated", sceneUpdates);
+    profiler.setCounter("visible objects", visibleObjects.size());
+    profiler.setCounter("occlusion culled %",
+                        occlusionTested ? 100.0 * occluded / occlusionTested
+                                        : 0.0);
+    profiler.setCounter("occluder triangles",
+                        options.occlusionCulling
+                            ? occlusion.getTriangleCount()
+                            : 0);
+    if (options.gpuCulling) {
+      // counts of the last cull the GPU finished
+      asteroidCuller->pollStatistics();
+      visibleCount = asteroidCuller->getVisibleCount();
+      asteroidTriangles = asteroidCuller->getTriangleCount();
+    }
+    profiler.setCounter("visible asteroids", visibleCount);
+    profiler.setCounter("instance KiB",
+                        options.gpuCulling
+                            ? 0.0
+                            : visibleCount * sizeof(InstanceTRS) / 1024.0);
+    profiler.setCounter("asteroid ktriangles", asteroidTriangles / 1000.0);
+    Shader::resetLookupCount();
+    profiler.setCounter("stream waits", uniformStream.getWaitCount() +
+                                            instanceStream.getWaitCount() -
+                                            streamWaits);
+    streamWaits = uniformStream.getWaitCount() + instanceStream.getWaitCount();
+    profiler.setCounter("texture resident KiB",
+                        streamer.getResidentBytes() / 1024);
+    profiler.setCounter("texture loads pending", streamer.getPendingCount());
+    profiler.endFrame();
   }
 
-  glfwTerminate();
+  uniformStream.destroy();
+  instanceStream.destroy();
+  if (asteroidCuller)
+    asteroidCuller->destroy();
+  batches.destroy();
+  GeometryPool::get().destroy();
+  streamer.shutdown();
+
+  profiler.finish();
+  profiler.report(std::cout);
+
+  if (!options.headless)
+    glfwTerminate();
   return 0;
 }
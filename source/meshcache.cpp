@@ -0,0 +1,259 @@
+#include "meshcache.h"
+#include "model.h"
+
+#include "glm/gtc/type_ptr.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+static_assert(std::is_trivially_copyable<Vertex>::value,
+              "Vertex is written to the mesh cache as raw bytes");
+static_assert(sizeof(Vertex) % 4 == 0, "Vertex must keep 4-byte alignment");
+static_assert(std::is_trivially_copyable<PackedVertex>::value,
+              "PackedVertex is written to the mesh cache as raw bytes");
+static_assert(std::is_trivially_copyable<MeshNode>::value &&
+                  sizeof(MeshNode) % 4 == 0,
+              "MeshNode is written to the mesh cache as raw bytes");
+
+namespace {
+
+const char kMagic[8] = {'M', 'E', 'S', 'H', 'C', 'C', 'H', '\0'};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t meshCount;
+  uint64_t sourceHash;
+  uint32_t nodeCount;
+  uint32_t reserved;
+};
+
+struct MeshRecord {
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t textureCount;
+  uint32_t lodCount;
+  float boundsMin[3];
+  float boundsMax[3];
+  uint32_t packedCount;
+  float packOffset[3];
+  float packScale[3];
+};
+
+size_t align4(size_t value) { return (value + 3) & ~size_t(3); }
+
+// Bounds-checked cursor over the mapped file
+struct Reader {
+  const char *data;
+  size_t size;
+  size_t offset;
+
+  const void *take(size_t bytes) {
+    if (bytes > size - offset)
+      return nullptr;
+    const void *ptr = data + offset;
+    offset = align4(offset + bytes);
+    if (offset > size)
+      offset = size;
+    return ptr;
+  }
+};
+
+void writePadded(std::ofstream &out, const void *data, size_t bytes) {
+  static const char zeros[4] = {};
+  out.write((const char *)data, bytes);
+  out.write(zeros, align4(bytes) - bytes);
+}
+
+} // namespace
+
+MeshCache::~MeshCache() { close(); }
+
+bool MeshCache::open(const std::string &cachePath, uint64_t sourceHash) {
+  close();
+
+  int fd = ::open(cachePath.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+
+  void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  m_data = data;
+  m_size = info.st_size;
+
+  if (!parse(sourceHash)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MeshCache::close() {
+  if (m_data)
+    munmap(m_data, m_size);
+  m_data = nullptr;
+  m_size = 0;
+  m_meshes.clear();
+  m_nodes = nullptr;
+  m_nodeCount = 0;
+}
+
+bool MeshCache::parse(uint64_t sourceHash) {
+  Reader reader{(const char *)m_data, m_size, 0};
+
+  const Header *header = (const Header *)reader.take(sizeof(Header));
+  if (!header || std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion || header->sourceHash != sourceHash)
+    return false;
+
+  m_meshes.resize(header->meshCount);
+  for (MeshView &mesh : m_meshes) {
+    const MeshRecord *record =
+        (const MeshRecord *)reader.take(sizeof(MeshRecord));
+    if (!record)
+      return false;
+
+    mesh.textures.resize(record->textureCount);
+    for (TextureRef &texture : mesh.textures) {
+      const uint32_t *textureHeader =
+          (const uint32_t *)reader.take(2 * sizeof(uint32_t));
+      if (!textureHeader)
+        return false;
+      const char *path = (const char *)reader.take(textureHeader[1]);
+      if (!path)
+        return false;
+      texture.type = (TextureType)textureHeader[0];
+      texture.path.assign(path, textureHeader[1]);
+    }
+
+    mesh.vertexCount = record->vertexCount;
+    mesh.bounds.min = glm::make_vec3(record->boundsMin);
+    mesh.bounds.max = glm::make_vec3(record->boundsMax);
+    mesh.indexCount = record->indexCount;
+    mesh.vertices = (const Vertex *)reader.take(
+        (size_t)record->vertexCount * sizeof(Vertex));
+    mesh.packedCount = record->packedCount;
+    mesh.packOffset = glm::make_vec3(record->packOffset);
+    mesh.packScale = glm::make_vec3(record->packScale);
+    mesh.packedVertices = (const PackedVertex *)reader.take(
+        (size_t)record->packedCount * sizeof(PackedVertex));
+    mesh.indices = (const GLuint *)reader.take((size_t)record->indexCount *
+                                               sizeof(GLuint));
+    mesh.lodCount = record->lodCount;
+    mesh.lods = (const MeshLod *)reader.take((size_t)record->lodCount *
+                                             sizeof(MeshLod));
+    if (!mesh.vertices || !mesh.packedVertices || !mesh.indices ||
+        !mesh.lods ||
+        (mesh.packedCount != 0 && mesh.packedCount != mesh.vertexCount))
+      return false;
+  }
+
+  m_nodeCount = header->nodeCount;
+  m_nodes = (const MeshNode *)reader.take((size_t)header->nodeCount *
+                                          sizeof(MeshNode));
+  if (!m_nodes)
+    return false;
+  // a node's meshes must exist, parents must come first
+  for (uint32_t i = 0; i < m_nodeCount; ++i) {
+    const MeshNode &node = m_nodes[i];
+    if ((node.parent != UINT32_MAX && node.parent >= i) ||
+        node.firstMesh > m_meshes.size() ||
+        node.meshCount > m_meshes.size() - node.firstMesh)
+      return false;
+  }
+  return true;
+}
+
+bool MeshCache::write(const std::string &cachePath, uint64_t sourceHash,
+                      const std::vector<MeshCacheSource> &meshes,
+                      const std::vector<MeshNode> &nodes) {
+  // write to a temporary file first so a crash never leaves a torn cache
+  std::string tempPath = cachePath + ".tmp";
+  std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+  if (!out)
+    return false;
+
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.meshCount = (uint32_t)meshes.size();
+  header.sourceHash = sourceHash;
+  header.nodeCount = (uint32_t)nodes.size();
+  header.reserved = 0;
+  out.write((const char *)&header, sizeof(header));
+
+  for (const MeshCacheSource &mesh : meshes) {
+    MeshRecord record;
+    record.vertexCount = (uint32_t)mesh.vertexCount;
+    record.indexCount = (uint32_t)mesh.indexCount;
+    record.textureCount = (uint32_t)mesh.textures->size();
+    record.lodCount = (uint32_t)mesh.lods->size();
+    for (int axis = 0; axis < 3; ++axis) {
+      record.boundsMin[axis] = mesh.bounds.min[axis];
+      record.boundsMax[axis] = mesh.bounds.max[axis];
+      record.packOffset[axis] = mesh.packed->offset[axis];
+      record.packScale[axis] = mesh.packed->scale[axis];
+    }
+    record.packedCount = (uint32_t)mesh.packed->vertices.size();
+    out.write((const char *)&record, sizeof(record));
+
+    for (const TextureRef &texture : *mesh.textures) {
+      uint32_t textureHeader[2] = {(uint32_t)texture.type,
+                                   (uint32_t)texture.path.size()};
+      out.write((const char *)textureHeader, sizeof(textureHeader));
+      writePadded(out, texture.path.data(), texture.path.size());
+    }
+
+    out.write((const char *)mesh.vertices, mesh.vertexCount * sizeof(Vertex));
+    out.write((const char *)mesh.packed->vertices.data(),
+              mesh.packed->vertices.size() * sizeof(PackedVertex));
+    out.write((const char *)mesh.indices, mesh.indexCount * sizeof(GLuint));
+    out.write((const char *)mesh.lods->data(),
+              mesh.lods->size() * sizeof(MeshLod));
+  }
+  out.write((const char *)nodes.data(), nodes.size() * sizeof(MeshNode));
+
+  out.close();
+  if (!out || std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+    std::remove(tempPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+uint64_t MeshCache::hashFile(const std::string &path, uint64_t seed) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return 0;
+
+  uint64_t hash = 14695981039346656037ull ^ seed;
+  char buffer[1 << 16];
+  while (file) {
+    file.read(buffer, sizeof(buffer));
+    std::streamsize count = file.gcount();
+    for (std::streamsize i = 0; i < count; ++i) {
+      hash ^= (unsigned char)buffer[i];
+      hash *= 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+std::string MeshCache::cachePathFor(const std::string &sourcePath) {
+  return sourcePath + ".meshcache";
+}
@@ -0,0 +1,120 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "culling.h"
+#include "enums.h"
+#include "vertexformat.h"
+#include "glew/glew.h"
+#include "glm/ext/matrix_float4x4.hpp"
+
+struct Vertex;
+
+// Texture reference as written in the material, relative to the model dir
+struct TextureRef {
+  TextureType type;
+  std::string path;
+};
+
+// One level of detail: a range of the mesh's index buffer, drawn against
+// the shared vertex buffer. error is the simplification error in mesh units.
+struct MeshLod {
+  uint32_t indexOffset;
+  uint32_t indexCount;
+  float error;
+  uint32_t reserved;
+};
+
+// Node of the imported hierarchy, every parent before its children. The
+// node's meshes are [firstMesh, firstMesh + meshCount) of the model.
+struct MeshNode {
+  // relative to the parent
+  glm::mat4 transform;
+  // UINT32_MAX for the root
+  uint32_t parent;
+  uint32_t firstMesh;
+  uint32_t meshCount;
+  uint32_t reserved;
+};
+
+// Mesh data as handed to the cache writer
+struct MeshCacheSource {
+  const Vertex *vertices;
+  size_t vertexCount;
+  const GLuint *indices;
+  size_t indexCount;
+  const std::vector<TextureRef> *textures;
+  const std::vector<MeshLod> *lods;
+  Aabb bounds;
+  // empty unless the model packs its vertices
+  const PackedMesh *packed;
+};
+
+// Read-only view of a binary mesh cache file, mapped with a single mmap.
+// Vertex and index arrays point straight into the mapping, so loading does
+// no per-vertex work. Files carry a format version and a hash of the source
+// asset and are rejected when either does not match.
+//
+// Layout (native endianness, every block 4-byte aligned):
+//   Header
+//   per mesh: MeshRecord, texture refs (type, length, path padded to 4),
+//             Vertex[vertexCount], PackedVertex[packedCount],
+//             GLuint[indexCount], MeshLod[lodCount]
+//   MeshNode[nodeCount]
+class MeshCache {
+public:
+  static const uint32_t kVersion = 5;
+
+  struct MeshView {
+    const Vertex *vertices;
+    uint32_t vertexCount;
+    const GLuint *indices;
+    uint32_t indexCount;
+    const MeshLod *lods;
+    uint32_t lodCount;
+    // of the vertex positions
+    Aabb bounds;
+    // vertexCount or 0, decoded with packOffset / packScale
+    const PackedVertex *packedVertices;
+    uint32_t packedCount;
+    glm::vec3 packOffset;
+    glm::vec3 packScale;
+    std::vector<TextureRef> textures;
+  };
+
+  MeshCache() = default;
+  ~MeshCache();
+
+  MeshCache(const MeshCache &) = delete;
+  MeshCache &operator=(const MeshCache &) = delete;
+
+  bool open(const std::string &cachePath, uint64_t sourceHash);
+  void close();
+
+  const std::vector<MeshView> &getMeshes() const { return m_meshes; }
+  const MeshNode *getNodes() const { return m_nodes; }
+  uint32_t getNodeCount() const { return m_nodeCount; }
+
+  static bool write(const std::string &cachePath, uint64_t sourceHash,
+                    const std::vector<MeshCacheSource> &meshes,
+                    const std::vector<MeshNode> &nodes);
+
+  // FNV-1a of the file content, 0 if the file can not be read
+  static uint64_t hashFile(const std::string &path, uint64_t seed);
+  static std::string cachePathFor(const std::string &sourcePath);
+
+private:
+  void *m_data = nullptr;
+  size_t m_size = 0;
+  std::vector<MeshView> m_meshes;
+  const MeshNode *m_nodes = nullptr;
+  uint32_t m_nodeCount = 0;
+
+  bool parse(uint64_t sourceHash);
+};
+
+#endif // !MESHCACHE_H
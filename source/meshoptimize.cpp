@@ -0,0 +1,299 @@
+#include "meshoptimize.h"
+#include "model.h"
+
+#include "glm/geometric.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+static_assert(sizeof(Vertex) == 8 * sizeof(float),
+              "deduplicateVertices compares vertices bytewise");
+
+namespace {
+
+uint32_t hashVertex(const Vertex &vertex) {
+  uint32_t words[8];
+  std::memcpy(words, &vertex, sizeof(words));
+  uint32_t hash = 2166136261u;
+  for (uint32_t word : words) {
+    hash ^= word;
+    hash *= 16777619u;
+    hash ^= hash >> 15;
+  }
+  return hash;
+}
+
+struct Cluster {
+  size_t begin;
+  size_t end;
+  float sortKey;
+};
+
+} // namespace
+
+VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t indexCount,
+                                    size_t vertexCount,
+                                    unsigned int cacheSize) {
+  VertexCacheStats stats;
+  if (indexCount < 3)
+    return stats;
+
+  // a vertex is still cached while fewer than cacheSize misses followed it
+  std::vector<uint32_t> stamp(vertexCount, 0);
+  std::vector<bool> referenced(vertexCount, false);
+  uint32_t time = cacheSize + 1;
+  size_t misses = 0, unique = 0;
+  for (size_t i = 0; i < indexCount; ++i) {
+    uint32_t vertex = indices[i];
+    if (time - stamp[vertex] > cacheSize) {
+      stamp[vertex] = time++;
+      ++misses;
+    }
+    if (!referenced[vertex]) {
+      referenced[vertex] = true;
+      ++unique;
+    }
+  }
+
+  stats.acmr = (float)misses / (float)(indexCount / 3);
+  stats.atvr = (float)misses / (float)unique;
+  return stats;
+}
+
+size_t deduplicateVertices(std::vector<Vertex> &vertices,
+                           std::vector<uint32_t> &indices) {
+  size_t tableSize = 1;
+  while (tableSize < vertices.size() * 2)
+    tableSize *= 2;
+  const uint32_t kEmpty = UINT32_MAX;
+  std::vector<uint32_t> table(tableSize, kEmpty);
+
+  std::vector<uint32_t> remap(vertices.size());
+  size_t unique = 0;
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const Vertex &vertex = vertices[i];
+    size_t slot = hashVertex(vertex) & (tableSize - 1);
+    // linear probing, the table is at most half full
+    while (table[slot] != kEmpty &&
+           std::memcmp(&vertices[table[slot]], &vertex, sizeof(Vertex)) != 0)
+      slot = (slot + 1) & (tableSize - 1);
+
+    if (table[slot] == kEmpty) {
+      // compacting in place is safe, unique never passes i
+      vertices[unique] = vertex;
+      table[slot] = (uint32_t)unique++;
+    }
+    remap[i] = table[slot];
+  }
+
+  vertices.resize(unique);
+  for (uint32_t &index : indices)
+    index = remap[index];
+  return unique;
+}
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount,
+                         unsigned int cacheSize,
+                         std::vector<size_t> *clusterStarts) {
+  size_t triangleCount = indices.size() / 3;
+  if (clusterStarts)
+    clusterStarts->assign(1, 0);
+  if (triangleCount == 0)
+    return;
+
+  // triangles around every vertex, packed by counting sort
+  std::vector<uint32_t> live(vertexCount, 0);
+  for (uint32_t index : indices)
+    ++live[index];
+  std::vector<uint32_t> offsets(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; ++v)
+    offsets[v + 1] = offsets[v] + live[v];
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); ++i)
+    adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+  std::vector<uint32_t> stamp(vertexCount, 0);
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> deadEnd;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  uint32_t time = cacheSize + 1;
+  size_t cursor = 0;
+
+  // next vertex with triangles left: the most recent dead end, else the
+  // lowest index not yet finished
+  auto skipDeadEnd = [&]() -> int64_t {
+    while (!deadEnd.empty()) {
+      uint32_t vertex = deadEnd.back();
+      deadEnd.pop_back();
+      if (live[vertex] > 0)
+        return vertex;
+    }
+    while (cursor < vertexCount) {
+      if (live[cursor] > 0)
+        return (int64_t)cursor;
+      ++cursor;
+    }
+    return -1;
+  };
+
+  int64_t fan = skipDeadEnd();
+  while (fan >= 0) {
+    candidates.clear();
+    for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a) {
+      uint32_t triangle = adjacency[a];
+      if (emitted[triangle])
+        continue;
+      emitted[triangle] = true;
+      for (int corner = 0; corner < 3; ++corner) {
+        uint32_t vertex = indices[triangle * 3 + corner];
+        result.push_back(vertex);
+        deadEnd.push_back(vertex);
+        candidates.push_back(vertex);
+        --live[vertex];
+        if (time - stamp[vertex] > cacheSize)
+          stamp[vertex] = time++;
+      }
+    }
+
+    // the 1-ring vertex that stays in the cache after its remaining
+    // triangles are emitted, preferring the oldest one
+    int64_t next = -1;
+    int64_t best = -1;
+    for (uint32_t vertex : candidates) {
+      if (live[vertex] == 0)
+        continue;
+      int64_t priority = 0;
+      if (time - stamp[vertex] + 2 * live[vertex] <= cacheSize)
+        priority = time - stamp[vertex];
+      if (priority > best) {
+        best = priority;
+        next = vertex;
+      }
+    }
+    if (next < 0) {
+      next = skipDeadEnd();
+      if (clusterStarts && next >= 0 && result.size() > clusterStarts->back())
+        clusterStarts->push_back(result.size());
+    }
+    fan = next;
+  }
+
+  indices.swap(result);
+}
+
+void optimizeOverdraw(std::vector<uint32_t> &indices,
+                      const std::vector<size_t> &clusterStarts,
+                      const std::vector<Vertex> &vertices, float threshold,
+                      unsigned int cacheSize) {
+  if (clusterStarts.size() < 2)
+    return;
+
+  // area weighted centroid of the whole mesh
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const glm::vec3 &a = vertices[indices[i]].Position;
+    const glm::vec3 &b = vertices[indices[i + 1]].Position;
+    const glm::vec3 &c = vertices[indices[i + 2]].Position;
+    float area = glm::length(glm::cross(b - a, c - a));
+    meshCentroid += area * (a + b + c) / 3.0f;
+    meshArea += area;
+  }
+  if (meshArea <= 0.0f)
+    return;
+  meshCentroid /= meshArea;
+
+  std::vector<Cluster> clusters;
+  for (size_t c = 0; c < clusterStarts.size(); ++c) {
+    Cluster cluster;
+    cluster.begin = clusterStarts[c];
+    cluster.end =
+        c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : indices.size();
+
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for (size_t i = cluster.begin; i < cluster.end; i += 3) {
+      const glm::vec3 &a = vertices[indices[i]].Position;
+      const glm::vec3 &b = vertices[indices[i + 1]].Position;
+      const glm::vec3 &c = vertices[indices[i + 2]].Position;
+      glm::vec3 cross = glm::cross(b - a, c - a);
+      float triangleArea = glm::length(cross);
+      centroid += triangleArea * (a + b + c) / 3.0f;
+      normal += cross;
+      area += triangleArea;
+    }
+    if (area > 0.0f)
+      centroid /= area;
+    float length = glm::length(normal);
+    // outward facing clusters far from the center occlude the most
+    cluster.sortKey =
+        length > 0.0f ? glm::dot(centroid - meshCentroid, normal / length)
+                      : 0.0f;
+    clusters.push_back(cluster);
+  }
+
+  std::stable_sort(clusters.begin(), clusters.end(),
+                   [](const Cluster &a, const Cluster &b) {
+                     return a.sortKey > b.sortKey;
+                   });
+
+  std::vector<uint32_t> sorted;
+  sorted.reserve(indices.size());
+  for (const Cluster &cluster : clusters)
+    sorted.insert(sorted.end(), indices.begin() + cluster.begin,
+                  indices.begin() + cluster.end);
+
+  float cacheAcmr = analyzeVertexCache(indices.data(), indices.size(),
+                                       vertices.size(), cacheSize)
+                        .acmr;
+  float sortedAcmr = analyzeVertexCache(sorted.data(), sorted.size(),
+                                        vertices.size(), cacheSize)
+                         .acmr;
+  if (sortedAcmr <= cacheAcmr * threshold)
+    indices.swap(sorted);
+}
+
+void optimizeVertexFetch(std::vector<Vertex> &vertices,
+                         std::vector<uint32_t> &indices) {
+  const uint32_t kUnused = UINT32_MAX;
+  std::vector<uint32_t> remap(vertices.size(), kUnused);
+  std::vector<Vertex> ordered;
+  ordered.reserve(vertices.size());
+  for (uint32_t &index : indices) {
+    if (remap[index] == kUnused) {
+      remap[index] = (uint32_t)ordered.size();
+      ordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(ordered);
+}
+
+MeshOptimizeStats optimizeMesh(std::vector<Vertex> &vertices,
+                               std::vector<uint32_t> &indices,
+                               float overdrawThreshold) {
+  MeshOptimizeStats stats;
+  stats.vertexCountBefore = vertices.size();
+  stats.before =
+      analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+  // points and lines left over by aiProcess_Triangulate are not touched
+  if (indices.size() % 3 == 0) {
+    deduplicateVertices(vertices, indices);
+    std::vector<size_t> clusterStarts;
+    optimizeVertexCache(indices, vertices.size(), kVertexCacheSize,
+                        &clusterStarts);
+    if (overdrawThreshold > 0.0f)
+      optimizeOverdraw(indices, clusterStarts, vertices, overdrawThreshold);
+    optimizeVertexFetch(vertices, indices);
+  }
+
+  stats.vertexCountAfter = vertices.size();
+  stats.after =
+      analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+  return stats;
+}
@@ -0,0 +1,71 @@
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Vertex;
+
+// Import time mesh optimization for indexed triangle lists. Nothing here
+// touches GL; Model runs it before the mesh cache is written, so cache hits
+// load the optimized layout directly (see --mesh-report).
+
+// Post-transform vertex cache entries assumed by the reordering and the
+// statistics, a FIFO of this size is a safe guess for current GPUs.
+const unsigned int kVertexCacheSize = 16;
+
+struct VertexCacheStats {
+  // cache misses per triangle, 0.5 is the ideal for large regular meshes
+  // and 3 means every corner is transformed again
+  float acmr = 0.0f;
+  // cache misses per referenced vertex, 1 is the ideal
+  float atvr = 0.0f;
+};
+
+// Simulates a FIFO post-transform cache over the triangle list.
+VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t indexCount,
+                                    size_t vertexCount,
+                                    unsigned int cacheSize = kVertexCacheSize);
+
+// Merges bitwise identical vertices through a hash table and remaps the
+// indices, returns the new vertex count.
+size_t deduplicateVertices(std::vector<Vertex> &vertices,
+                           std::vector<uint32_t> &indices);
+
+// Tipsify (Sander, Nehab, Barczak 2007): reorders triangles for the
+// post-transform cache in linear time. clusterStarts, if given, receives
+// the first index of every run that began at a dead end; those runs can be
+// reordered among themselves without a large cache penalty.
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount,
+                         unsigned int cacheSize = kVertexCacheSize,
+                         std::vector<size_t> *clusterStarts = nullptr);
+
+// Sorts the clusters of optimizeVertexCache so that the ones facing away
+// from the mesh center draw first and occlude the rest. Keeps the cache
+// order when the new one raises the ACMR by more than the threshold factor.
+void optimizeOverdraw(std::vector<uint32_t> &indices,
+                      const std::vector<size_t> &clusterStarts,
+                      const std::vector<Vertex> &vertices,
+                      float threshold = 1.05f,
+                      unsigned int cacheSize = kVertexCacheSize);
+
+// Renumbers the vertices in the order the indices first use them, so the
+// vertex fetch walks the buffer linearly. Unreferenced vertices are dropped.
+void optimizeVertexFetch(std::vector<Vertex> &vertices,
+                         std::vector<uint32_t> &indices);
+
+struct MeshOptimizeStats {
+  size_t vertexCountBefore = 0;
+  size_t vertexCountAfter = 0;
+  VertexCacheStats before;
+  VertexCacheStats after;
+};
+
+// All of the above in order: deduplication, cache order, overdraw order
+// (skipped when overdrawThreshold is 0) and fetch order.
+MeshOptimizeStats optimizeMesh(std::vector<Vertex> &vertices,
+                               std::vector<uint32_t> &indices,
+                               float overdrawThreshold = 1.05f);
+
+#endif // !MESHOPTIMIZE_H
@@ -0,0 +1,335 @@
+#include "meshsimplify.h"
+#include "culling.h"
+#include "meshoptimize.h"
+#include "model.h"
+
+#include "glm/geometric.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// Symmetric 4x4 quadric, Q(p) = p'Ap + 2b'p + c summed over weighted
+// planes
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0, c = 0;
+  double weight = 0;
+
+  void addPlane(const glm::vec3 &normal, float distance, float w) {
+    double x = normal.x, y = normal.y, z = normal.z, d = distance;
+    a00 += w * x * x, a01 += w * x * y, a02 += w * x * z;
+    a11 += w * y * y, a12 += w * y * z, a22 += w * z * z;
+    b0 += w * x * d, b1 += w * y * d, b2 += w * z * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric &q) {
+    a00 += q.a00, a01 += q.a01, a02 += q.a02;
+    a11 += q.a11, a12 += q.a12, a22 += q.a22;
+    b0 += q.b0, b1 += q.b1, b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+  }
+
+  // weighted mean of the squared distances of p to the planes
+  double evaluate(const glm::vec3 &p) const {
+    if (weight <= 0.0)
+      return 0.0;
+    double x = p.x, y = p.y, z = p.z;
+    double result = a00 * x * x + a11 * y * y + a22 * z * z +
+                    2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                    2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return std::max(result / weight, 0.0);
+  }
+};
+
+const float kBorderWeight = 10.0f;
+
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  double cost;
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+  if (a > b)
+    std::swap(a, b);
+  return ((uint64_t)a << 32) | b;
+}
+
+// Vertices sharing a position form one class; collapses work on classes
+std::vector<uint32_t> positionClasses(const std::vector<Vertex> &vertices) {
+  size_t tableSize = 1;
+  while (tableSize < vertices.size() * 2)
+    tableSize *= 2;
+  const uint32_t kEmpty = UINT32_MAX;
+  std::vector<uint32_t> table(tableSize, kEmpty);
+
+  std::vector<uint32_t> classes(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const glm::vec3 &position = vertices[i].Position;
+    uint32_t words[3];
+    std::memcpy(words, &position, sizeof(words));
+    uint32_t hash = (words[0] * 73856093u) ^ (words[1] * 19349663u) ^
+                    (words[2] * 83492791u);
+    size_t slot = hash & (tableSize - 1);
+    while (table[slot] != kEmpty &&
+           vertices[table[slot]].Position != position)
+      slot = (slot + 1) & (tableSize - 1);
+    if (table[slot] == kEmpty)
+      table[slot] = (uint32_t)i;
+    classes[i] = table[slot];
+  }
+  return classes;
+}
+
+} // namespace
+
+float simplifyMesh(const std::vector<Vertex> &vertices,
+                   const std::vector<uint32_t> &indices,
+                   size_t targetIndexCount, float maxError,
+                   std::vector<uint32_t> &result) {
+  result = indices;
+  if (indices.size() % 3 != 0 || indices.size() <= targetIndexCount)
+    return 0.0f;
+
+  // a class is named after its first vertex
+  std::vector<uint32_t> classOf = positionClasses(vertices);
+  size_t vertexCount = vertices.size();
+  auto position = [&](uint32_t cls) -> const glm::vec3 & {
+    return vertices[cls].Position;
+  };
+
+  // face planes weighted by area, plus planes through every open edge
+  // perpendicular to its face so borders only slide along themselves
+  std::vector<Quadric> quadrics(vertexCount);
+  std::vector<uint64_t> edges;
+  for (size_t i = 0; i < indices.size(); i += 3)
+    for (int e = 0; e < 3; ++e)
+      edges.push_back(edgeKey(classOf[indices[i + e]],
+                              classOf[indices[i + (e + 1) % 3]]));
+  std::sort(edges.begin(), edges.end());
+
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    uint32_t corner[3] = {classOf[indices[i]], classOf[indices[i + 1]],
+                          classOf[indices[i + 2]]};
+    glm::vec3 normal = glm::cross(position(corner[1]) - position(corner[0]),
+                                  position(corner[2]) - position(corner[0]));
+    float length = glm::length(normal);
+    if (length <= 0.0f)
+      continue;
+    normal /= length;
+    float area = 0.5f * length;
+    for (uint32_t cls : corner)
+      quadrics[cls].addPlane(normal, -glm::dot(normal, position(corner[0])),
+                             area);
+
+    for (int e = 0; e < 3; ++e) {
+      uint32_t a = corner[e], b = corner[(e + 1) % 3];
+      auto range =
+          std::equal_range(edges.begin(), edges.end(), edgeKey(a, b));
+      if (range.second - range.first != 1)
+        continue;
+      glm::vec3 side = glm::cross(position(b) - position(a), normal);
+      float sideLength = glm::length(side);
+      if (sideLength <= 0.0f)
+        continue;
+      side /= sideLength;
+      float distance = -glm::dot(side, position(a));
+      // the squared edge length keeps the weight in area units
+      float weight = kBorderWeight * sideLength * sideLength;
+      quadrics[a].addPlane(side, distance, weight);
+      quadrics[b].addPlane(side, distance, weight);
+    }
+  }
+
+  double maxCost = (double)maxError * maxError;
+  double acceptedCost = 0.0;
+  std::vector<uint32_t> remap(vertexCount);
+  std::vector<uint32_t> offsets(vertexCount + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<char> touched(vertexCount);
+  std::vector<Collapse> collapses;
+  std::vector<std::pair<uint32_t, uint32_t>> mapping;
+
+  // Seam aware collapse of class from onto class to: every vertex of from
+  // needs an edge to a vertex of to, and moves onto that one.
+  auto findMapping = [&](uint32_t from, uint32_t to) {
+    mapping.clear();
+    for (uint32_t a = offsets[from]; a < offsets[from + 1]; ++a) {
+      const uint32_t *triangle = &result[adjacency[a] * 3];
+      uint32_t source = UINT32_MAX, target = UINT32_MAX;
+      for (int k = 0; k < 3; ++k) {
+        if (classOf[triangle[k]] == from)
+          source = triangle[k];
+        else if (classOf[triangle[k]] == to)
+          target = triangle[k];
+      }
+      auto it = std::find_if(mapping.begin(), mapping.end(),
+                             [&](const std::pair<uint32_t, uint32_t> &m) {
+                               return m.first == source;
+                             });
+      if (it == mapping.end())
+        mapping.emplace_back(source, target);
+      else if (it->second == UINT32_MAX)
+        it->second = target;
+    }
+    for (const auto &m : mapping)
+      if (m.second == UINT32_MAX)
+        return false;
+    return true;
+  };
+
+  // moving from onto to must not turn any remaining triangle over
+  auto flips = [&](uint32_t from, uint32_t to) {
+    for (uint32_t a = offsets[from]; a < offsets[from + 1]; ++a) {
+      const uint32_t *triangle = &result[adjacency[a] * 3];
+      glm::vec3 before[3], after[3];
+      bool shared = false;
+      for (int k = 0; k < 3; ++k) {
+        uint32_t cls = classOf[triangle[k]];
+        shared = shared || cls == to;
+        before[k] = position(cls);
+        after[k] = cls == from ? position(to) : before[k];
+      }
+      if (shared)
+        continue;
+      glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+      glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+      if (glm::dot(n0, n1) <= 0.0f)
+        return true;
+    }
+    return false;
+  };
+
+  for (;;) {
+    size_t triangleCount = result.size() / 3;
+    if (result.size() <= targetIndexCount)
+      break;
+
+    // triangles around every class
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (uint32_t index : result)
+      ++offsets[classOf[index] + 1];
+    for (size_t v = 0; v < vertexCount; ++v)
+      offsets[v + 1] += offsets[v];
+    adjacency.resize(result.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < result.size(); ++i)
+      adjacency[fill[classOf[result[i]]]++] = (uint32_t)(i / 3);
+
+    edges.clear();
+    for (size_t i = 0; i < result.size(); i += 3)
+      for (int e = 0; e < 3; ++e)
+        edges.push_back(edgeKey(classOf[result[i + e]],
+                                classOf[result[i + (e + 1) % 3]]));
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    collapses.clear();
+    for (uint64_t edge : edges) {
+      uint32_t a = (uint32_t)(edge >> 32), b = (uint32_t)edge;
+      Quadric q = quadrics[a];
+      q.add(quadrics[b]);
+      double toB = findMapping(a, b) ? q.evaluate(position(b)) : -1.0;
+      double toA = findMapping(b, a) ? q.evaluate(position(a)) : -1.0;
+      if (toB >= 0.0 && (toA < 0.0 || toB <= toA))
+        collapses.push_back({a, b, toB});
+      else if (toA >= 0.0)
+        collapses.push_back({b, a, toA});
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &x, const Collapse &y) {
+                return x.cost < y.cost;
+              });
+
+    // independent collapses only, the neighbourhoods they change are
+    // locked until the next pass
+    for (size_t v = 0; v < vertexCount; ++v)
+      remap[v] = (uint32_t)v;
+    std::fill(touched.begin(), touched.end(), 0);
+    size_t toRemove = triangleCount - targetIndexCount / 3;
+    size_t removed = 0, applied = 0;
+    for (const Collapse &collapse : collapses) {
+      if (collapse.cost > maxCost || removed >= toRemove)
+        break;
+      if (touched[collapse.from] || touched[collapse.to])
+        continue;
+      if (!findMapping(collapse.from, collapse.to) ||
+          flips(collapse.from, collapse.to))
+        continue;
+
+      for (const auto &m : mapping)
+        remap[m.first] = m.second;
+      quadrics[collapse.to].add(quadrics[collapse.from]);
+      acceptedCost = std::max(acceptedCost, collapse.cost);
+      ++applied;
+
+      touched[collapse.to] = 1;
+      for (uint32_t a = offsets[collapse.from]; a < offsets[collapse.from + 1];
+           ++a) {
+        const uint32_t *triangle = &result[adjacency[a] * 3];
+        bool shared = false;
+        for (int k = 0; k < 3; ++k) {
+          touched[classOf[triangle[k]]] = 1;
+          shared = shared || classOf[triangle[k]] == collapse.to;
+        }
+        removed += shared;
+      }
+    }
+    if (applied == 0)
+      break;
+
+    // drop the triangles that lost an edge
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t a = remap[result[i]], b = remap[result[i + 1]],
+               c = remap[result[i + 2]];
+      if (classOf[a] == classOf[b] || classOf[b] == classOf[c] ||
+          classOf[a] == classOf[c])
+        continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+  }
+
+  return (float)std::sqrt(acceptedCost);
+}
+
+void generateLods(const std::vector<Vertex> &vertices,
+                  std::vector<uint32_t> &indices, std::vector<MeshLod> &lods,
+                  float maxRelativeError) {
+  lods.clear();
+  lods.push_back({0, (uint32_t)indices.size(), 0.0f, 0});
+  if (vertices.empty())
+    return;
+
+  float radius = boundingRadius(positionsOf(vertices), vertices.size(),
+                                sizeof(Vertex));
+  // every level starts from the full mesh so the quadrics measure the
+  // distance to the original surface
+  std::vector<uint32_t> base(indices);
+  std::vector<uint32_t> level;
+  size_t previousCount = base.size();
+  while (lods.size() < kMaxLods) {
+    size_t target = base.size() / 3 >> lods.size();
+    float error = simplifyMesh(vertices, base, target * 3,
+                               maxRelativeError * radius, level);
+    // not worth a level, the error bound stopped it early
+    if (level.size() * 10 > previousCount * 9)
+      break;
+    previousCount = level.size();
+
+    optimizeVertexCache(level, vertices.size());
+    lods.push_back(
+        {(uint32_t)indices.size(), (uint32_t)level.size(), error, 0});
+    indices.insert(indices.end(), level.begin(), level.end());
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "meshcache.h"
+
+struct Vertex;
+
+// Quadric error metric simplification (Garland, Heckbert 1997) by half edge
+// collapses. Vertices only ever move onto an existing neighbour, so the
+// result indexes the unchanged vertex buffer and every level of detail can
+// share one VBO. Vertices split along UV seams collapse together, and only
+// along the seam, so the simplified mesh opens no cracks.
+
+// Collapses the cheapest edges until at most targetIndexCount indices are
+// left or the next collapse would cost more than maxError. The error is
+// the area weighted RMS distance of the moved vertex to the original faces
+// around it, in mesh units. Returns the largest error accepted.
+float simplifyMesh(const std::vector<Vertex> &vertices,
+                   const std::vector<uint32_t> &indices,
+                   size_t targetIndexCount, float maxError,
+                   std::vector<uint32_t> &result);
+
+// Levels including the original one
+const size_t kMaxLods = 4;
+
+// Appends up to kMaxLods - 1 coarser levels to indices, each with about half
+// the triangles of the previous one and an error of at most maxRelativeError
+// times the mesh radius. lods receives every level, the original one first.
+// Each level is reordered for the vertex cache.
+void generateLods(const std::vector<Vertex> &vertices,
+                  std::vector<uint32_t> &indices, std::vector<MeshLod> &lods,
+                  float maxRelativeError = 0.25f);
+
+#endif // !MESHSIMPLIFY_H
@@ -1,4 +1,5 @@
 #include "model.h"
+#include "assetloader.h"
 #include "assimp/Importer.hpp"
 #include "assimp/cexport.h"
 #include "assimp/material.h"
@@ -6,91 +7,194 @@
 #include "assimp/postprocess.h"
 #include "assimp/scene.h"
 #include "assimp/types.h"
+#include "culling.h"
 #include "enums.h"
 #include "glm/ext/vector_float3.hpp"
+#include "renderstate.h"
 #include "shader.h"
 #include "stb/stb_image.h"
+#include "texturecache.h"
+#include "texturestreamer.h"
+#include "utilities.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+static const unsigned int kImportFlags =
+    aiProcess_Triangulate | aiProcess_GenNormals;
+
+bool Model::s_meshCacheEnabled = true;
+bool Model::s_meshOptimizeEnabled = true;
+
+// bumped whenever optimizeMesh / generateLods produce a different layout
+static const uint64_t kMeshOptimizeVersion = 1;
+static const uint64_t kLodVersion = 1;
+
+// Mixes the material libraries an .obj names ("mtllib") into hash, the
+// materials come from them. A library that can not be read is left out,
+// the import reports it.
+static uint64_t hashMaterialLibraries(const std::string &path,
+                                      const std::string &directory,
+                                      uint64_t hash) {
+  std::ifstream obj(path);
+  std::string line;
+  while (std::getline(obj, line)) {
+    std::istringstream words(line);
+    std::string word, name;
+    if (!(words >> word) || word != "mtllib")
+      continue;
+    // the name is the rest of the line, it may hold spaces
+    std::getline(words >> std::ws, name);
+    while (!name.empty() && std::isspace((unsigned char)name.back()))
+      name.pop_back();
+    uint64_t libraryHash = MeshCache::hashFile(directory + '/' + name, hash);
+    if (libraryHash)
+      hash = libraryHash;
+  }
+  return hash;
+}
+
 Mesh::Mesh(std::vector<Vertex> &vertices, std::vector<GLuint> &indices,
            std::vector<Texture> &texture)
-    : m_vertices(vertices), m_indices(indices), m_textures(texture) {
-  setupMesh();
+    : m_vertices(vertices), m_indices(indices), m_textures(texture),
+      m_bounds(boundingBox(positionsOf(m_vertices), m_vertices.size(),
+                           sizeof(Vertex))) {
+  setupMesh({});
 }
 
-void Mesh::setupMesh() {
-
-  glGenVertexArrays(1, &m_VAO);
-  glGenBuffers(1, &m_VBO);
-  glGenBuffers(1, &m_EBO);
-
-  glBindVertexArray(m_VAO);
-  glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-
-  glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex),
-               m_vertices.data(), GL_STATIC_DRAW);
+Mesh::Mesh(std::vector<Vertex> &&vertices, std::vector<GLuint> &&indices,
+           std::vector<Texture> &texture, const PackedMesh &packed,
+           std::vector<MeshLod> lods, const Aabb &bounds)
+    : m_vertices(std::move(vertices)), m_indices(std::move(indices)),
+      m_textures(texture), m_lods(std::move(lods)), m_bounds(bounds) {
+  if (m_bounds.isEmpty())
+    m_bounds = boundingBox(positionsOf(m_vertices), m_vertices.size(),
+                           sizeof(Vertex));
+  setupMesh(packed);
+}
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLuint),
-               m_indices.data(), GL_STATIC_DRAW);
+void Mesh::setupMesh(const PackedMesh &packed) {
+  if (m_lods.empty())
+    m_lods.push_back({0, (uint32_t)m_indices.size(), 0.0f, 0});
+
+  GeometryPool &pool = GeometryPool::get();
+  m_packed = !packed.vertices.empty();
+  if (m_packed) {
+    m_positionOffset = packed.offset;
+    m_positionScale = packed.scale;
+    m_geometry = pool.add(VertexLayout::Packed, packed.vertices.data(),
+                          packed.vertices.size(), m_indices.data(),
+                          m_indices.size());
+  } else {
+    m_geometry = pool.add(VertexLayout::Float, m_vertices.data(),
+                          m_vertices.size(), m_indices.data(),
+                          m_indices.size());
+  }
+  m_VAO = pool.getVertexArray(m_geometry.layout);
+}
 
-  // vertex position
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+void Mesh::Draw(Shader &shader, bool drawTexture) {
+  if (drawTexture)
+    bindMaterial(shader);
+  setVertexDecode(shader);
+  // draw mesh
+  RenderState &state = RenderState::get();
+  state.bindVertexArray(m_VAO);
+  GLuint firstIndex = m_geometry.firstIndex + m_lods[0].indexOffset;
+  glDrawElementsBaseVertex(GL_TRIANGLES, m_lods[0].indexCount,
+                           GL_UNSIGNED_INT,
+                           (void *)(firstIndex * sizeof(GLuint)),
+                           m_geometry.baseVertex);
+  state.countDraws(1);
+}
 
-  // vertex normals
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)offsetof(Vertex, Normal));
+void Mesh::bindMaterial(Shader &shader) const {
+  RenderState &state = RenderState::get();
+  const Shader::MaterialUniforms &material = shader.getMaterialUniforms();
+  GLuint diffuseNr = 0;
+  GLuint specularNr = 0;
+  for (GLuint i = 0; i < m_textures.size(); ++i) {
+    TextureType type = m_textures[i].type;
+    UniformHandle sampler;
+
+    if (type == TextureType::Diffuse &&
+        diffuseNr < Shader::kMaxMaterialTextures)
+      sampler = material.diffuse[diffuseNr++];
+    else if (type == TextureType::Specular &&
+             specularNr < Shader::kMaxMaterialTextures)
+      sampler = material.specular[specularNr++];
+
+    shader.setInt(sampler, i);
+    state.bindTexture(i, GL_TEXTURE_2D, m_textures[i].id);
+  }
+  shader.setFloat(material.shininess, 64.f);
+  shader.setFloat(material.pointConstant, 1.0f);
+  shader.setFloat(material.pointLinear, 0.14f);
+  shader.setFloat(material.pointQuadratic, 0.07f);
+}
 
-  // vertex tex TexCoords
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)offsetof(Vertex, TexCoords));
+size_t Mesh::selectLod(float pixelsPerUnit, float maxErrorPixels) const {
+  size_t lod = 0;
+  while (lod + 1 < m_lods.size() &&
+         m_lods[lod + 1].error * pixelsPerUnit <= maxErrorPixels)
+    ++lod;
+  return lod;
+}
 
-  glBindVertexArray(0);
+void Mesh::setVertexDecode(Shader &shader) const {
+  const Shader::VertexDecodeUniforms &decode = shader.getVertexDecodeUniforms();
+  shader.setVec3(decode.positionOffset, m_positionOffset);
+  shader.setVec3(decode.positionScale, m_positionScale);
+  shader.setBool(decode.octNormals, m_packed);
 }
 
-void Mesh::Draw(Shader &shader, bool drawTexture) {
-  if (drawTexture) {
-    GLuint diffuseNr = 1;
-    GLuint specularNr = 1;
-    for (GLuint i = 0; i < m_textures.size(); ++i) {
-      glActiveTexture(GL_TEXTURE0 + i);
-
-      TextureType type = m_textures[i].type;
-      std::string number;
-      std::string name;
-
-      if (type == TextureType::Diffuse) {
-        number = std::to_string(diffuseNr++);
-        name = "material.texture_diffuse" + number;
-      } else if (type == TextureType::Specular) {
-        number = std::to_string(specularNr++);
-        name = "material.texture_specular" + number;
-      }
+Model::Model(const char *path, bool flipTexture, bool gamma, bool instance,
+             bool packVertices, bool generateLods)
+    : m_flipTexture(flipTexture), m_gamma(gamma), m_instance(instance),
+      m_packVertices(packVertices), m_generateLods(generateLods) {
+  if (!importMeshes(path))
+    return;
 
-      shader.setInt(name.c_str(), i);
-      glBindTexture(GL_TEXTURE_2D, m_textures[i].id);
+  TextureCache &cache = TextureCache::get();
+  for (const std::string &texturePath : getTexturePaths()) {
+    std::string key = textureKey(texturePath);
+    GLuint id = 0;
+    // a pending entry belongs to an async load whose upload can not run
+    // before this returns, so that case takes a private copy
+    TextureCache::Status status = cache.acquire(key, id, false);
+    if (status != TextureCache::Status::Ready) {
+      ImageData image = decodeTexture(texturePath);
+      size_t bytes = 0;
+      id = uploadTexture(texturePath, image, bytes);
+      if (status == TextureCache::Status::Reserved)
+        cache.publish(key, id, bytes);
     }
-    shader.setFloat("material.shininess", 64.f);
-    shader.setFloat("pointLight.constant", 1.0f);
-    shader.setFloat("pointLight.linear", 0.14f);
-    shader.setFloat("pointLight.quadratic", 0.07f);
+    addTexture(texturePath, id);
   }
-  // draw mesh
-  glBindVertexArray(m_VAO);
-  glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, 0);
-  glBindVertexArray(0);
+  buildMeshes();
+}
 
-  // glActiveTexture(GL_TEXTURE0);
+Model::Model(AssetLoader &loader, const char *path, bool flipTexture,
+             bool gamma, bool instance, bool packVertices,
+             bool generateLods)
+    : m_flipTexture(flipTexture), m_gamma(gamma), m_instance(instance),
+      m_packVertices(packVertices), m_generateLods(generateLods) {
+  loader.load(*this, path);
 }
 
-Model::Model(const char *path, bool flipTexture, bool gamma, bool instance)
-    : m_flipTexture(flipTexture), m_instance(instance) {
-  loadModel(path);
+Model::~Model() {
+  for (const Texture &texture : m_textures_loaded)
+    if (TextureCache::get().release(texture.id))
+      TextureStreamer::get().forget(texture.id);
 }
 
 void Model::Draw(Shader &shader, bool drawTexture) {
@@ -98,43 +202,189 @@ void Model::Draw(Shader &shader, bool drawTexture) {
     m_meshes[i].Draw(shader, drawTexture);
 }
 
-void Model::loadModel(const std::string &path) {
-  Assimp::Importer import;
+void Model::Draw(Shader &shader, const SceneGraph &scene, uint32_t root,
+                 const glm::mat4 &view, bool drawTexture) {
+  const Shader::TransformUniforms &transform = shader.getTransformUniforms();
+  glm::mat3 viewRotation(view);
+  for (size_t i = 0; i < m_nodes.size(); ++i) {
+    const MeshNode &node = m_nodes[i];
+    if (node.meshCount == 0)
+      continue;
+    uint32_t sceneNode = root + (uint32_t)i;
+    shader.setMat4(transform.model, scene.getWorld(sceneNode));
+    shader.setMat3(transform.inverse,
+                   viewRotation * scene.getNormal(sceneNode));
+    for (uint32_t mesh = 0; mesh < node.meshCount; ++mesh)
+      m_meshes[node.firstMesh + mesh].Draw(shader, drawTexture);
+  }
+}
 
-  const aiScene *scene =
-      import.ReadFile(path, aiProcess_Triangulate | aiProcess_GenNormals);
+uint32_t Model::addToScene(SceneGraph &scene, uint32_t parent) const {
+  uint32_t root = (uint32_t)scene.size();
+  for (const MeshNode &node : m_nodes)
+    scene.addNode(node.parent == UINT32_MAX ? parent : root + node.parent,
+                  node.transform);
+  return m_nodes.empty() ? parent : root;
+}
 
-  if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
-      !scene->mRootNode) {
-    std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
-    return;
-  } else
-    std::cout << "ASSIMP READ FILE: " << path << std::endl;
+Aabb Model::getBounds(const SceneGraph &scene, uint32_t root) const {
+  Aabb bounds = Aabb::empty();
+  for (size_t i = 0; i < m_nodes.size(); ++i) {
+    const MeshNode &node = m_nodes[i];
+    const glm::mat4 &world = scene.getWorld(root + (uint32_t)i);
+    for (uint32_t mesh = 0; mesh < node.meshCount; ++mesh)
+      bounds.expand(m_meshes[node.firstMesh + mesh].getBounds().transformed(
+          world));
+  }
+  return bounds;
+}
 
+bool Model::importMeshes(const std::string &path) {
+  auto start = std::chrono::steady_clock::now();
   m_directory = path.substr(0, path.find_last_of('/'));
-  processNode(scene->mRootNode, scene);
 
-  std::cout << "Meshes count: " << m_meshes.size() << std::endl;
+  // the import flags change the produced meshes, so they are part of the key
+  std::string cachePath = MeshCache::cachePathFor(path);
+  uint64_t sourceHash = 0;
+  if (s_meshCacheEnabled)
+    sourceHash = MeshCache::hashFile(
+        path, ((uint64_t)MeshCache::kVersion << 32) | kImportFlags |
+                  (m_packVertices ? 1ull << 40 : 0) |
+                  (s_meshOptimizeEnabled ? kMeshOptimizeVersion << 48 : 0) |
+                  (m_generateLods ? kLodVersion << 56 : 0));
+  // so are the materials, an edited .mtl must not reuse the cached meshes
+  if (sourceHash)
+    sourceHash = hashMaterialLibraries(path, m_directory, sourceHash);
+
+  bool cacheHit = sourceHash && loadFromCache(cachePath, sourceHash);
+  if (!cacheHit) {
+    Assimp::Importer import;
+
+    const aiScene *scene = import.ReadFile(path, kImportFlags);
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
+        !scene->mRootNode) {
+      std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+      return false;
+    } else
+      std::cout << "ASSIMP READ FILE: " << path << std::endl;
+
+    processNode(scene->mRootNode, scene);
+
+    if (s_meshOptimizeEnabled) {
+      size_t triangles = 0;
+      float missesBefore = 0.0f, missesAfter = 0.0f;
+      for (const MeshData &mesh : m_meshData) {
+        size_t meshTriangles =
+            (mesh.lods.empty() ? mesh.indices.size()
+                               : mesh.lods[0].indexCount) /
+            3;
+        triangles += meshTriangles;
+        missesBefore += mesh.optimizeStats.before.acmr * meshTriangles;
+        missesAfter += mesh.optimizeStats.after.acmr * meshTriangles;
+      }
+      if (triangles > 0)
+        std::cout << "Mesh optimize: " << path << ", ACMR "
+                  << missesBefore / triangles << " -> "
+                  << missesAfter / triangles << std::endl;
+    }
+
+    for (size_t i = 0; i < m_meshData.size(); ++i) {
+      const std::vector<MeshLod> &lods = m_meshData[i].lods;
+      if (lods.size() < 2)
+        continue;
+      std::cout << "Mesh LODs: " << path << " mesh " << i << ", triangles";
+      for (const MeshLod &lod : lods)
+        std::cout << ' ' << lod.indexCount / 3;
+      std::cout << ", error";
+      for (const MeshLod &lod : lods)
+        std::cout << ' ' << lod.error;
+      std::cout << std::endl;
+    }
+
+    if (sourceHash)
+      writeCache(cachePath, sourceHash);
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  std::cout << "Model import: " << path << ", " << m_meshData.size()
+            << " meshes"
+            << (cacheHit ? " (mesh cache hit) " : " (mesh cache miss) ") << ms
+            << " ms" << std::endl;
+  return true;
 }
 
-void Model::processNode(aiNode *node, const aiScene *scene) {
+bool Model::loadFromCache(const std::string &cachePath, uint64_t sourceHash) {
+  MeshCache cache;
+  if (!cache.open(cachePath, sourceHash))
+    return false;
+
+  // one bulk copy per array out of the mapping, nothing per vertex
+  for (const MeshCache::MeshView &view : cache.getMeshes()) {
+    MeshData mesh;
+    mesh.vertices.assign(view.vertices, view.vertices + view.vertexCount);
+    mesh.indices.assign(view.indices, view.indices + view.indexCount);
+    mesh.lods.assign(view.lods, view.lods + view.lodCount);
+    mesh.textures = view.textures;
+    mesh.bounds = view.bounds;
+    // the packing flag is part of the key, packed models find theirs
+    mesh.packed.vertices.assign(view.packedVertices,
+                                view.packedVertices + view.packedCount);
+    mesh.packed.offset = view.packOffset;
+    mesh.packed.scale = view.packScale;
+    m_meshData.push_back(std::move(mesh));
+  }
+  m_nodes.assign(cache.getNodes(), cache.getNodes() + cache.getNodeCount());
+  return true;
+}
+
+void Model::writeCache(const std::string &cachePath,
+                       uint64_t sourceHash) const {
+  std::vector<MeshCacheSource> sources;
+  for (const MeshData &mesh : m_meshData)
+    sources.push_back(MeshCacheSource{mesh.vertices.data(),
+                                      mesh.vertices.size(), mesh.indices.data(),
+                                      mesh.indices.size(), &mesh.textures,
+                                      &mesh.lods, mesh.bounds, &mesh.packed});
+
+  if (!MeshCache::write(cachePath, sourceHash, sources, m_nodes))
+    std::cout << "Mesh cache write failed: " << cachePath << std::endl;
+}
+
+void Model::processNode(aiNode *node, const aiScene *scene,
+                        uint32_t parent) {
+  // pre-order keeps every parent before its children and the meshes of
+  // one node contiguous
+  uint32_t index = (uint32_t)m_nodes.size();
+  MeshNode record;
+  // Assimp matrices are row major
+  record.transform = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+  record.parent = parent;
+  record.firstMesh = (uint32_t)m_meshData.size();
+  record.meshCount = node->mNumMeshes;
+  record.reserved = 0;
+  m_nodes.push_back(record);
+
   // process all the nodes meshes
   for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
     aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-    m_meshes.push_back(processMesh(mesh, scene));
+    m_meshData.push_back(processMesh(mesh, scene));
   }
 
   // the same for each of its children
   for (unsigned int i = 0; i < node->mNumChildren; i++) {
-    processNode(node->mChildren[i], scene);
+    processNode(node->mChildren[i], scene, index);
   }
 }
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
-  std::vector<Vertex> vertices;
-  std::vector<unsigned int> indices;
-  std::vector<Texture> textures;
+MeshData Model::processMesh(aiMesh *mesh, const aiScene *scene) {
+  MeshData data;
+  std::vector<Vertex> &vertices = data.vertices;
+  std::vector<unsigned int> &indices = data.indices;
 
+  vertices.reserve(mesh->mNumVertices);
   for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
     Vertex vertex;
 
@@ -166,87 +416,163 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
   if (mesh->mMaterialIndex >= 0) {
     aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
 
-    std::vector<Texture> diffuseMaps =
-        loadMaterialTexture(material, aiTextureType_DIFFUSE);
-    textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-    std::vector<Texture> specularMaps =
-        loadMaterialTexture(material, aiTextureType_SPECULAR);
-    textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+    data.textures = getMaterialTextures(material, aiTextureType_DIFFUSE);
+    std::vector<TextureRef> specularRefs =
+        getMaterialTextures(material, aiTextureType_SPECULAR);
+    data.textures.insert(data.textures.end(), specularRefs.begin(),
+                         specularRefs.end());
   }
 
-  return Mesh(vertices, indices, textures);
+  if (s_meshOptimizeEnabled)
+    data.optimizeStats = optimizeMesh(vertices, indices);
+  if (m_generateLods)
+    generateLods(vertices, indices, data.lods);
+
+  data.bounds = boundingBox(positionsOf(vertices), vertices.size(),
+                            sizeof(Vertex));
+  if (m_packVertices)
+    packVertices(data.vertices.data(), data.vertices.size(), data.packed);
+  return data;
+}
+
+bool Model::reportMeshOptimization(const std::string &path,
+                                   std::ostream &out) {
+  Assimp::Importer import;
+  const aiScene *scene = import.ReadFile(path, kImportFlags);
+  if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
+      !scene->mRootNode) {
+    out << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+    return false;
+  }
+
+  bool optimize = s_meshOptimizeEnabled;
+  s_meshOptimizeEnabled = true;
+  Model model;
+  model.processNode(scene->mRootNode, scene);
+  s_meshOptimizeEnabled = optimize;
+
+  for (size_t i = 0; i < model.m_meshData.size(); ++i) {
+    const MeshData &mesh = model.m_meshData[i];
+    const MeshOptimizeStats &stats = mesh.optimizeStats;
+    out << std::setw(32) << path << std::setw(5) << i << std::setw(9)
+        << mesh.indices.size() / 3 << std::setw(9) << stats.vertexCountBefore
+        << std::setw(9) << stats.vertexCountAfter << std::setw(8)
+        << stats.before.acmr << std::setw(8) << stats.after.acmr
+        << std::setw(8) << stats.before.atvr << std::setw(8)
+        << stats.after.atvr << std::endl;
+  }
+  return true;
 }
 
-std::vector<Texture> Model::loadMaterialTexture(aiMaterial *mat,
-                                                aiTextureType type) {
-  std::vector<Texture> textures;
+std::vector<TextureRef> Model::getMaterialTextures(aiMaterial *mat,
+                                                   aiTextureType type) {
+  std::vector<TextureRef> refs;
   for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
     aiString str;
     mat->GetTexture(type, i, &str);
 
-    bool skip = false;
-    for (unsigned int j = 0; j < m_textures_loaded.size(); j++) {
-      if (std::strcmp(m_textures_loaded[j].path.data(), str.C_Str()) == 0) {
-        textures.push_back(m_textures_loaded[j]);
-        skip = true; // a texture with the same filepath has already been
-        break;
-      }
-    }
-    if (!skip) { // if texture hasn't been loaded already, load it
-      Texture texture;
-      texture.id = TextureFromFile(str.C_Str(), this->m_directory);
-
-      switch (type) {
-      case aiTextureType_DIFFUSE:
-        texture.type = TextureType::Diffuse;
-        break;
-      case aiTextureType_SPECULAR:
-        texture.type = TextureType::Specular;
-        break;
-      default:
-        break;
-      }
-
-      texture.path = str.C_Str();
-      textures.push_back(texture);
-      m_textures_loaded.push_back(
-          texture); // store it as texture loaded for entire model, to ensure we
+    TextureRef ref;
+    switch (type) {
+    case aiTextureType_DIFFUSE:
+      ref.type = TextureType::Diffuse;
+      break;
+    case aiTextureType_SPECULAR:
+      ref.type = TextureType::Specular;
+      break;
+    default:
+      ref.type = TextureType::Normal;
+      break;
     }
+    ref.path = str.C_Str();
+    refs.push_back(ref);
   }
-  return textures;
-};
+  return refs;
+}
 
-unsigned int Model::TextureFromFile(const char *path,
-                                    const std::string &directory, bool gamma) {
-  std::string filename = path;
-  filename = directory + '/' + filename;
+std::vector<std::string> Model::getTexturePaths() const {
+  std::vector<std::string> paths;
+  std::unordered_set<std::string> seen;
+  for (const MeshData &mesh : m_meshData)
+    for (const TextureRef &ref : mesh.textures)
+      if (seen.insert(ref.path).second)
+        paths.push_back(ref.path);
+  return paths;
+}
+
+std::string Model::textureKey(const std::string &path) const {
+  return TextureCache::makeKey(m_directory + '/' + path, m_flipTexture,
+                               m_gamma);
+}
+
+ImageData Model::decodeTexture(const std::string &path) const {
+  std::string filename = m_directory + '/' + path;
 
   std::cout << "Texture path: " << filename << std::endl;
 
+  ImageData image;
+  int maxSize = TextureStreamer::get().isEnabled() ? TextureStreamer::kTailSize
+                                                   : 0;
+  if (loadCompressedTexture(filename, m_flipTexture, image.compressed,
+                            maxSize))
+    return image;
+
+  // the thread local flag keeps parallel decodes from racing on it
+  stbi_set_flip_vertically_on_load_thread(m_flipTexture);
+  image.pixels = stbi_load(filename.c_str(), &image.width, &image.height,
+                           &image.channels, 0);
+  return image;
+}
+
+GLuint Model::uploadTexture(const std::string &path, ImageData &image,
+                            size_t &bytes) {
   unsigned int textureID;
   glGenTextures(1, &textureID);
+  bytes = 0;
+
+  if (!image.compressed.levels.empty()) {
+    std::cout << "Format: BC" << (int)image.compressed.format << std::endl;
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    bytes = uploadCompressedTexture(GL_TEXTURE_2D, image.compressed);
+    // files converted with --no-mips stop early
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    (GLint)image.compressed.levels.size() - 1);
+    if (image.compressed.levels[0].empty()) {
+      // only the mip tail was read, the streamer brings in the rest
+      TextureStreamer &streamer = TextureStreamer::get();
+      streamer.track(textureID, m_directory + '/' + path, m_flipTexture,
+                     image.compressed);
+      size_t tail = 0;
+      while (image.compressed.levels[tail].empty())
+        ++tail;
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)tail);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-  stbi_set_flip_vertically_on_load(m_flipTexture);
-  int width, height, nrComponents;
-  unsigned char *data =
-      stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-  if (data) {
+    image.compressed.levels.clear();
+  } else if (image.pixels) {
     GLenum format;
-    if (nrComponents == 1) {
+    if (image.channels == 1) {
       format = GL_RED;
       std::cout << "Format: GL_RED" << std::endl;
-    } else if (nrComponents == 3) {
+    } else if (image.channels == 3) {
       format = GL_RGB;
       std::cout << "Format: GL_RGB" << std::endl;
-    } else if (nrComponents == 4) {
+    } else if (image.channels == 4) {
       format = GL_RGBA;
       std::cout << "Format: GL_RGBA" << std::endl;
     }
 
     glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0,
+                 format, GL_UNSIGNED_BYTE, image.pixels);
     glGenerateMipmap(GL_TEXTURE_2D);
+    // the mip chain adds a third
+    bytes = (size_t)image.width * image.height * image.channels * 4 / 3;
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -254,14 +580,56 @@ unsigned int Model::TextureFromFile(const char *path,
                     GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    stbi_image_free(data);
+    stbi_image_free(image.pixels);
+    image.pixels = nullptr;
   } else {
     std::cout << "Texture failed to load at path: " << path << std::endl;
-    stbi_image_free(data);
   }
-
   return textureID;
 }
+
+void Model::addTexture(const std::string &path, GLuint id) {
+  // the first material that references a file decides its type
+  Texture texture;
+  texture.id = id;
+  texture.path = path;
+  texture.type = TextureType::Diffuse;
+  for (const MeshData &mesh : m_meshData) {
+    auto it = std::find_if(
+        mesh.textures.begin(), mesh.textures.end(),
+        [&path](const TextureRef &ref) { return ref.path == path; });
+    if (it != mesh.textures.end()) {
+      texture.type = it->type;
+      break;
+    }
+  }
+  m_textures_loaded.push_back(texture);
+}
+
+void Model::buildMeshes() {
+  std::unordered_map<std::string, const Texture *> loaded;
+  for (const Texture &texture : m_textures_loaded)
+    loaded.emplace(texture.path, &texture);
+
+  for (MeshData &data : m_meshData) {
+    m_boundingRadius = std::max(
+        m_boundingRadius, boundingRadius(positionsOf(data.vertices),
+                                         data.vertices.size(), sizeof(Vertex)));
+
+    std::vector<Texture> textures;
+    for (const TextureRef &ref : data.textures) {
+      auto it = loaded.find(ref.path);
+      if (it != loaded.end())
+        textures.push_back(*it->second);
+    }
+    m_meshes.push_back(Mesh(std::move(data.vertices), std::move(data.indices),
+                            textures, data.packed, std::move(data.lods),
+                            data.bounds));
+  }
+  m_meshData.clear();
+  m_meshData.shrink_to_fit();
+}
+
 Mesh &Model::getMesh(unsigned int index) {
 
   unsigned int size = m_meshes.size();
@@ -1,11 +1,19 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <iosfwd>
 #include <string>
 #include <vector>
 
+#include "compressedtexture.h"
 #include "enums.h"
+#include "geometrypool.h"
+#include "meshcache.h"
+#include "meshoptimize.h"
+#include "meshsimplify.h"
+#include "scenegraph.h"
 #include "shader.h"
+#include "vertexformat.h"
 
 #include "assimp/Importer.hpp"
 #include "assimp/postprocess.h"
@@ -19,57 +27,199 @@ struct Vertex {
   glm::vec2 TexCoords;
 };
 
+// Positions of a vertex array for boundingBox / boundingRadius (stride
+// sizeof(Vertex)), null for an empty one, which has no element to take
+// the address of.
+inline const glm::vec3 *positionsOf(const std::vector<Vertex> &vertices) {
+  return vertices.empty() ? nullptr : &vertices.data()->Position;
+}
+
 struct Texture {
   GLuint id;
   TextureType type;
   std::string path;
 };
 
+// CPU side of a mesh, produced by the import stage on any thread
+struct MeshData {
+  std::vector<Vertex> vertices;
+  std::vector<GLuint> indices;
+  std::vector<TextureRef> textures;
+  // GPU layout of vertices, only filled for models that pack them
+  PackedMesh packed;
+  // set when the mesh went through optimizeMesh on import
+  MeshOptimizeStats optimizeStats;
+  // levels of detail appended to indices, empty if none were generated
+  std::vector<MeshLod> lods;
+  // of the vertex positions, computed on import
+  Aabb bounds = Aabb::empty();
+};
+
+// Decoded image, pixels are owned by stb_image until uploaded. When a
+// converted file is found, compressed holds its levels and pixels is null.
+struct ImageData {
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  unsigned char *pixels = nullptr;
+  CompressedTexture compressed;
+};
+
+class AssetLoader;
+
 class Mesh {
 public:
-  // mesh data
+  // mesh data, the indices of every level of detail (see getLods)
   std::vector<Vertex> m_vertices;
   std::vector<GLuint> m_indices;
   std::vector<Texture> m_textures;
 
   Mesh(std::vector<Vertex> &vertices, std::vector<GLuint> &indices,
        std::vector<Texture> &texture);
+  // A non-empty packed mesh is uploaded instead of vertices, which stay on
+  // the CPU for bounds and picking. lods as made by generateLods, empty
+  // bounds are computed from vertices.
+  Mesh(std::vector<Vertex> &&vertices, std::vector<GLuint> &&indices,
+       std::vector<Texture> &texture, const PackedMesh &packed = {},
+       std::vector<MeshLod> lods = {}, const Aabb &bounds = Aabb::empty());
+  // Draws the finest level
   void Draw(Shader &shader, bool drawTexture);
+  // Binds the textures and sets the material uniforms Draw sets, for
+  // batches of this mesh drawn without it (see BatchRenderer)
+  void bindMaterial(Shader &shader) const;
+
+  // Finest first, at least one level covering the whole mesh
+  const std::vector<MeshLod> &getLods() const { return m_lods; }
+  // Coarsest level whose error stays within maxErrorPixels when one mesh
+  // unit covers pixelsPerUnit pixels on screen
+  size_t selectLod(float pixelsPerUnit, float maxErrorPixels) const;
+  // in mesh units
+  const Aabb &getBounds() const { return m_bounds; }
 
-  GLuint &getVAO() { return m_VAO; }
+  // Sets the position / normal decode uniforms for this mesh's layout.
+  // Draw does it; draws issued outside of it (instancing) call it first.
+  void setVertexDecode(Shader &shader) const;
+  bool isPacked() const { return m_packed; }
+
+  // Where the vertices and indices live in GeometryPool
+  const GeometryRange &getGeometry() const { return m_geometry; }
+  // The pool's shared VAO for this mesh's layout
+  GLuint getVAO() const { return m_VAO; }
 
 private:
-  GLuint m_VAO, m_VBO, m_EBO;
-  void setupMesh();
+  GLuint m_VAO;
+  GeometryRange m_geometry;
+  std::vector<MeshLod> m_lods;
+  Aabb m_bounds;
+  bool m_packed = false;
+  glm::vec3 m_positionOffset{0.0f};
+  glm::vec3 m_positionScale{1.0f};
+  void setupMesh(const PackedMesh &packed);
 };
 
 class Model {
 public:
+  // packVertices uploads PackedVertex instead of Vertex; only for models
+  // drawn with shaders that decode it (object, instance). generateLods
+  // simplifies every mesh into coarser levels, see Mesh::getLods.
   Model(const char *path, bool flipTexture = false, bool gamma = false,
-        bool instance = false);
+        bool instance = false, bool packVertices = false,
+        bool generateLods = false);
+  // Loads on the loader's worker threads, usable after loader.finish()
+  Model(AssetLoader &loader, const char *path, bool flipTexture = false,
+        bool gamma = false, bool instance = false, bool packVertices = false,
+        bool generateLods = false);
+  // Releases the textures in TextureCache
+  ~Model();
+
+  Model(const Model &) = delete;
+  Model &operator=(const Model &) = delete;
 
   void Draw(Shader &shader, bool drawTexture = true);
+  // Draws every mesh with the world matrix of its node, root as returned
+  // by addToScene. Sets the shader's model and view space inverse (normal
+  // matrix) uniforms, view must be rigid.
+  void Draw(Shader &shader, const SceneGraph &scene, uint32_t root,
+            const glm::mat4 &view, bool drawTexture = true);
+
+  // Adds the imported node hierarchy under parent. Node i of getNodes()
+  // becomes root + i; returns root, or parent for a model without nodes.
+  uint32_t addToScene(SceneGraph &scene,
+                      uint32_t parent = SceneGraph::kNoParent) const;
 
   const std::vector<Texture> &getTextures() const { return m_textures_loaded; }
   const std::vector<Mesh> &getMeshes() const { return m_meshes; }
+  // Assimp node hierarchy with the node transforms, parents first
+  const std::vector<MeshNode> &getNodes() const { return m_nodes; }
+  // around the model origin, in model units
+  float getBoundingRadius() const { return m_boundingRadius; }
+  // World space box of the meshes as placed by addToScene, empty for a
+  // model without nodes
+  Aabb getBounds(const SceneGraph &scene, uint32_t root) const;
   Mesh &getMesh(unsigned int index);
 
+  // Binary mesh cache next to the asset, see MeshCache. On by default.
+  static void setMeshCacheEnabled(bool enabled) {
+    s_meshCacheEnabled = enabled;
+  }
+  // Vertex cache / overdraw / fetch ordering at import, see optimizeMesh.
+  // On by default, part of the mesh cache key.
+  static void setMeshOptimizeEnabled(bool enabled) {
+    s_meshOptimizeEnabled = enabled;
+  }
+
+  // Imports path without the mesh cache or GL and prints the vertex cache
+  // statistics of every mesh before and after optimizeMesh.
+  static bool reportMeshOptimization(const std::string &path,
+                                     std::ostream &out);
+
 private:
+  friend class AssetLoader;
+
+  // import only, for reportMeshOptimization
+  Model()
+      : m_instance(false), m_flipTexture(false), m_gamma(false),
+        m_alpha(false), m_packVertices(false), m_generateLods(false) {}
+
   // model data
   std::vector<Texture> m_textures_loaded;
   std::vector<Mesh> m_meshes;
+  std::vector<MeshNode> m_nodes;
   std::string m_directory;
+  float m_boundingRadius = 0.0f;
+
+  // import stage output, turned into Mesh objects by buildMeshes()
+  std::vector<MeshData> m_meshData;
+  size_t m_pendingTextures = 0;
 
   // model setting
   bool m_instance;
   bool m_flipTexture;
+  bool m_gamma;
   bool m_alpha;
+  bool m_packVertices;
+  bool m_generateLods;
+
+  static bool s_meshCacheEnabled;
+  static bool s_meshOptimizeEnabled;
+
+  // CPU stage, safe on any thread
+  bool importMeshes(const std::string &path);
+  bool loadFromCache(const std::string &cachePath, uint64_t sourceHash);
+  void writeCache(const std::string &cachePath, uint64_t sourceHash) const;
+  void processNode(aiNode *node, const aiScene *scene,
+                   uint32_t parent = UINT32_MAX);
+  MeshData processMesh(aiMesh *mesh, const aiScene *scene);
+  std::vector<TextureRef> getMaterialTextures(aiMaterial *mat,
+                                              aiTextureType type);
+  std::vector<std::string> getTexturePaths() const;
+  std::string textureKey(const std::string &path) const;
+  ImageData decodeTexture(const std::string &path) const;
 
-  void loadModel(const std::string &path);
-  void processNode(aiNode *node, const aiScene *scene);
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene);
-  std::vector<Texture> loadMaterialTexture(aiMaterial *mat, aiTextureType type);
-  unsigned int TextureFromFile(const char *path, const std::string &directory,
-                               bool gamma = true);
+  // GL stage, GL thread only
+  GLuint uploadTexture(const std::string &path, ImageData &image,
+                       size_t &bytes);
+  void addTexture(const std::string &path, GLuint id);
+  void buildMeshes();
 };
 #endif // MODEL_H
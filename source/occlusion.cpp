@@ -0,0 +1,234 @@
+#include "occlusion.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+namespace {
+
+// rows rasterized by one task, whole tiles
+const int kBandRows = 2 * OcclusionBuffer::kTileSize;
+
+int roundUpToTile(int value) {
+  int tile = OcclusionBuffer::kTileSize;
+  return (std::max(value, 1) + tile - 1) / tile * tile;
+}
+
+} // namespace
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+    : m_Width(roundUpToTile(width)), m_Height(roundUpToTile(height)),
+      m_TilesX(m_Width / kTileSize), m_TilesY(m_Height / kTileSize),
+      m_Depth((size_t)m_Width * m_Height, 0.0f),
+      m_TileDepth((size_t)m_TilesX * m_TilesY, 0.0f) {}
+
+void OcclusionBuffer::begin(const glm::mat4 &viewProjection) {
+  m_ViewProjection = viewProjection;
+  m_Occluders.clear();
+}
+
+void OcclusionBuffer::addOccluder(const OccluderMesh &mesh,
+                                  const glm::mat4 &model) {
+  m_Occluders.push_back({&mesh, m_ViewProjection * model});
+}
+
+void OcclusionBuffer::setupTriangles() {
+  m_Vertices.clear();
+  m_Triangles.clear();
+  for (const Occluder &occluder : m_Occluders) {
+    const OccluderMesh &mesh = *occluder.mesh;
+    size_t base = m_Vertices.size();
+    for (const glm::vec3 &position : mesh.positions) {
+      glm::vec4 clip = occluder.transform * glm::vec4(position, 1.0f);
+      if (clip.w <= 0.0f || clip.z < -clip.w) {
+        m_Vertices.push_back(glm::vec4(0.0f));
+        continue;
+      }
+      float inverseW = 1.0f / clip.w;
+      m_Vertices.push_back(
+          {(clip.x * inverseW * 0.5f + 0.5f) * m_Width,
+           (clip.y * inverseW * 0.5f + 0.5f) * m_Height, inverseW, 1.0f});
+    }
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+      const glm::vec4 &v0 = m_Vertices[base + mesh.indices[i]];
+      const glm::vec4 &v1 = m_Vertices[base + mesh.indices[i + 1]];
+      const glm::vec4 &v2 = m_Vertices[base + mesh.indices[i + 2]];
+      // clipping would only add occlusion, dropping is conservative
+      if (v0.w == 0.0f || v1.w == 0.0f || v2.w == 0.0f)
+        continue;
+      float area =
+          (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+      if (!(area > 0.0f))
+        continue;
+
+      // pixels lying entirely in the bounding rectangle
+      Triangle triangle;
+      triangle.minX =
+          std::max(0, (int)std::ceil(std::min({v0.x, v1.x, v2.x})));
+      triangle.maxX = std::min(
+          m_Width - 1, (int)std::floor(std::max({v0.x, v1.x, v2.x})) - 1);
+      triangle.minY =
+          std::max(0, (int)std::ceil(std::min({v0.y, v1.y, v2.y})));
+      triangle.maxY = std::min(
+          m_Height - 1, (int)std::floor(std::max({v0.y, v1.y, v2.y})) - 1);
+      if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        continue;
+
+      const glm::vec4 *corners[3] = {&v0, &v1, &v2};
+      for (int edge = 0; edge < 3; ++edge) {
+        const glm::vec4 &from = *corners[edge];
+        const glm::vec4 &to = *corners[(edge + 1) % 3];
+        triangle.a[edge] = from.y - to.y;
+        triangle.b[edge] = to.x - from.x;
+        // evaluated at pixel centers, the shift moves each test to the
+        // pixel's corner nearest the outside: a pixel passes only if the
+        // triangle covers all of it
+        triangle.c[edge] = from.x * to.y - from.y * to.x -
+                           0.5f * (std::abs(triangle.a[edge]) +
+                                   std::abs(triangle.b[edge]));
+      }
+      triangle.depth = std::min({v0.z, v1.z, v2.z});
+      m_Triangles.push_back(triangle);
+    }
+  }
+}
+
+void OcclusionBuffer::rasterize(ThreadPool *workers) {
+  setupTriangles();
+  int bandCount = (m_Height + kBandRows - 1) / kBandRows;
+  auto rasterizeBands = [&](size_t begin, size_t end) {
+    for (size_t band = begin; band < end; ++band)
+      rasterizeRows((int)band * kBandRows,
+                    std::min(m_Height, ((int)band + 1) * kBandRows));
+  };
+  if (workers)
+    workers->parallelFor(bandCount, 1, rasterizeBands);
+  else
+    rasterizeBands(0, bandCount);
+}
+
+void OcclusionBuffer::rasterizeRows(int firstRow, int endRow) {
+  std::fill(m_Depth.begin() + (size_t)firstRow * m_Width,
+            m_Depth.begin() + (size_t)endRow * m_Width, 0.0f);
+
+  for (const Triangle &triangle : m_Triangles) {
+    int minY = std::max(triangle.minY, firstRow);
+    int maxY = std::min(triangle.maxY, endRow - 1);
+    for (int y = minY; y <= maxY; ++y) {
+      float *row = m_Depth.data() + (size_t)y * m_Width;
+      float centerY = y + 0.5f;
+#ifdef OCCLUSION_SSE
+      // four pixels at a time from a multiple of 4, the width is one too;
+      // pixels left of minX are outside the triangle anyway
+      __m128 a[3], rowC[3];
+      for (int edge = 0; edge < 3; ++edge) {
+        a[edge] = _mm_set1_ps(triangle.a[edge]);
+        rowC[edge] =
+            _mm_set1_ps(triangle.b[edge] * centerY + triangle.c[edge]);
+      }
+      const __m128 depth = _mm_set1_ps(triangle.depth);
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 laneOffset = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+      for (int x = triangle.minX & ~3; x <= triangle.maxX; x += 4) {
+        __m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), laneOffset);
+        __m128 inside = _mm_cmpge_ps(
+            _mm_add_ps(_mm_mul_ps(a[0], centerX), rowC[0]), zero);
+        for (int edge = 1; edge < 3; ++edge)
+          inside = _mm_and_ps(
+              inside,
+              _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[edge], centerX),
+                                      rowC[edge]),
+                           zero));
+        // depths are positive, the lanes outside keep what is there
+        __m128 stored = _mm_loadu_ps(row + x);
+        _mm_storeu_ps(row + x,
+                      _mm_max_ps(stored, _mm_and_ps(inside, depth)));
+      }
+#else
+      for (int x = triangle.minX; x <= triangle.maxX; ++x) {
+        float centerX = x + 0.5f;
+        bool inside = true;
+        for (int edge = 0; edge < 3; ++edge)
+          inside = inside && triangle.a[edge] * centerX +
+                                     triangle.b[edge] * centerY +
+                                     triangle.c[edge] >=
+                                 0.0f;
+        if (inside)
+          row[x] = std::max(row[x], triangle.depth);
+      }
+#endif
+    }
+  }
+
+  for (int tileY = firstRow / kTileSize; tileY < endRow / kTileSize;
+       ++tileY) {
+    for (int tileX = 0; tileX < m_TilesX; ++tileX) {
+      float farthest = INFINITY;
+      for (int y = tileY * kTileSize; y < (tileY + 1) * kTileSize; ++y) {
+        const float *row =
+            m_Depth.data() + (size_t)y * m_Width + tileX * kTileSize;
+        for (int x = 0; x < kTileSize; ++x)
+          farthest = std::min(farthest, row[x]);
+      }
+      m_TileDepth[(size_t)tileY * m_TilesX + tileX] = farthest;
+    }
+  }
+}
+
+bool OcclusionBuffer::isVisible(const Aabb &box) const {
+  if (box.isEmpty())
+    return false;
+
+  // w is affine, so the nearest point of the box is a corner
+  float minX = INFINITY, maxX = -INFINITY, minY = INFINITY, maxY = -INFINITY;
+  float nearest = 0.0f;
+  for (int corner = 0; corner < 8; ++corner) {
+    glm::vec3 position(corner & 1 ? box.max.x : box.min.x,
+                       corner & 2 ? box.max.y : box.min.y,
+                       corner & 4 ? box.max.z : box.min.z);
+    glm::vec4 clip = m_ViewProjection * glm::vec4(position, 1.0f);
+    if (clip.w <= 0.0f || clip.z < -clip.w)
+      return true;
+    float inverseW = 1.0f / clip.w;
+    float x = (clip.x * inverseW * 0.5f + 0.5f) * m_Width;
+    float y = (clip.y * inverseW * 0.5f + 0.5f) * m_Height;
+    minX = std::min(minX, x);
+    maxX = std::max(maxX, x);
+    minY = std::min(minY, y);
+    maxY = std::max(maxY, y);
+    nearest = std::max(nearest, inverseW);
+  }
+
+  // every pixel the rectangle touches, the part off screen is not drawn
+  int pixelMinX = std::max(0, (int)std::floor(minX));
+  int pixelMaxX = std::min(m_Width - 1, (int)std::ceil(maxX) - 1);
+  int pixelMinY = std::max(0, (int)std::floor(minY));
+  int pixelMaxY = std::min(m_Height - 1, (int)std::ceil(maxY) - 1);
+  if (pixelMinX > pixelMaxX || pixelMinY > pixelMaxY)
+    return true;
+
+  for (int tileY = pixelMinY / kTileSize; tileY <= pixelMaxY / kTileSize;
+       ++tileY) {
+    for (int tileX = pixelMinX / kTileSize; tileX <= pixelMaxX / kTileSize;
+         ++tileX) {
+      // every pixel of the tile is nearer than the box
+      if (m_TileDepth[(size_t)tileY * m_TilesX + tileX] > nearest)
+        continue;
+      int endY = std::min(pixelMaxY, (tileY + 1) * kTileSize - 1);
+      int endX = std::min(pixelMaxX, (tileX + 1) * kTileSize - 1);
+      for (int y = std::max(pixelMinY, tileY * kTileSize); y <= endY; ++y) {
+        const float *row = m_Depth.data() + (size_t)y * m_Width;
+        for (int x = std::max(pixelMinX, tileX * kTileSize); x <= endX; ++x)
+          if (row[x] <= nearest)
+            return true;
+      }
+    }
+  }
+  return false;
+}
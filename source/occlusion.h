@@ -0,0 +1,88 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "culling.h"
+
+#include "glm/ext/matrix_float4x4.hpp"
+#include "glm/ext/vector_float3.hpp"
+#include "glm/ext/vector_float4.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Triangles drawn into an OcclusionBuffer, counter-clockwise like the GL
+// front faces. They must lie inside the object they stand for, see
+// makeOccluder in main.cpp.
+struct OccluderMesh {
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+};
+
+// Software occlusion culling, GL free like culling.h. The occluders are
+// rasterized on the CPU into a small depth buffer, then bounding boxes are
+// tested against it before anything is submitted.
+//
+// Depth is 1 / w, which is linear in screen space and makes 0 (the clear
+// value) infinitely far. A triangle writes the depth of its farthest
+// vertex and only to pixels it covers entirely, so no part of a pixel
+// claims to be nearer than the occluder. Per 8x8 tile the farthest depth
+// is kept as well, most boxes are decided on the tiles alone.
+class OcclusionBuffer {
+public:
+  static const int kTileSize = 8;
+
+  // Rounded up to whole tiles
+  explicit OcclusionBuffer(int width = 256, int height = 128);
+
+  // Starts a new view with no occluders
+  void begin(const glm::mat4 &viewProjection);
+  // mesh must stay alive until rasterize()
+  void addOccluder(const OccluderMesh &mesh, const glm::mat4 &model);
+  // Draws the occluders in bands of rows on the workers (on the calling
+  // thread without them). Uses SSE when the target has it.
+  void rasterize(ThreadPool *workers = nullptr);
+
+  // As of the last rasterize(): false only if every pixel the box covers
+  // holds a nearer occluder. Boxes crossing the near plane are visible.
+  bool isVisible(const Aabb &box) const;
+
+  int getWidth() const { return m_Width; }
+  int getHeight() const { return m_Height; }
+  // Row major, bottom row first
+  const float *getDepth() const { return m_Depth.data(); }
+  // Front facing triangles in front of the near plane, last rasterize()
+  size_t getTriangleCount() const { return m_Triangles.size(); }
+
+private:
+  struct Occluder {
+    const OccluderMesh *mesh;
+    // view projection * model
+    glm::mat4 transform;
+  };
+
+  // Edge functions a * x + b * y + c, non-negative inside
+  struct Triangle {
+    float a[3], b[3], c[3];
+    float depth;
+    int minX, maxX, minY, maxY;
+  };
+
+  int m_Width, m_Height;
+  int m_TilesX, m_TilesY;
+  glm::mat4 m_ViewProjection{1.0f};
+  std::vector<Occluder> m_Occluders;
+  // screen x, y, 1 / w and 1, all 0 for vertices behind the near plane
+  std::vector<glm::vec4> m_Vertices;
+  std::vector<Triangle> m_Triangles;
+  std::vector<float> m_Depth;
+  // farthest depth of each tile
+  std::vector<float> m_TileDepth;
+
+  void setupTriangles();
+  void rasterizeRows(int firstRow, int endRow);
+};
+
+#endif // !OCCLUSION_H
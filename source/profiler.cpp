@@ -0,0 +1,198 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+namespace {
+
+struct Stats {
+  double min = 0.0;
+  double median = 0.0;
+  double p99 = 0.0;
+};
+
+Stats computeStats(std::vector<double> samples) {
+  Stats stats;
+  if (samples.empty())
+    return stats;
+
+  std::sort(samples.begin(), samples.end());
+  size_t count = samples.size();
+  size_t p99Index = (size_t)std::ceil(0.99 * count) - 1;
+
+  stats.min = samples.front();
+  stats.median = count % 2
+                     ? samples[count / 2]
+                     : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+  stats.p99 = samples[std::min(p99Index, count - 1)];
+  return stats;
+}
+
+void printStats(std::ostream &out, const std::vector<double> &samples) {
+  if (samples.empty()) {
+    out << std::setw(30) << "-";
+    return;
+  }
+  Stats stats = computeStats(samples);
+  out << std::setw(10) << stats.min << std::setw(10) << stats.median
+      << std::setw(10) << stats.p99;
+}
+
+} // namespace
+
+void FrameProfiler::Samples::add(double value) {
+  // statistics ignore the order, the oldest slot is overwritten in place
+  if (values.size() < kMaxSamples)
+    values.push_back(value);
+  else
+    values[count % kMaxSamples] = value;
+  ++count;
+}
+
+FrameProfiler::FrameProfiler(bool gpuTimers, unsigned int warmupFrames)
+    : m_GpuTimers(gpuTimers), m_WarmupFrames(warmupFrames) {}
+
+FrameProfiler::~FrameProfiler() {
+  for (Pass &pass : m_Passes)
+    for (GLuint &query : pass.queries)
+      if (query)
+        glDeleteQueries(1, &query);
+}
+
+void FrameProfiler::beginFrame() {
+  // The slot we are about to reuse was issued kFrameLatency frames ago.
+  collect(m_Frame % kFrameLatency, true);
+  m_FrameStart = Clock::now();
+}
+
+void FrameProfiler::endFrame() {
+  if (m_ActivePass != -1)
+    endPass();
+
+  double frameMs =
+      std::chrono::duration<double, std::milli>(Clock::now() - m_FrameStart)
+          .count();
+  if (isRecording())
+    m_FrameMs.add(frameMs);
+  ++m_Frame;
+}
+
+void FrameProfiler::beginPass(const std::string &name) {
+  if (m_ActivePass != -1)
+    endPass();
+
+  auto it = m_PassIndex.find(name);
+  if (it == m_PassIndex.end()) {
+    it = m_PassIndex.emplace(name, m_Passes.size()).first;
+    m_Passes.emplace_back();
+    m_Passes.back().name = name;
+  }
+  m_ActivePass = (int)it->second;
+
+  if (m_GpuTimers) {
+    Pass &pass = m_Passes[m_ActivePass];
+    int slot = m_Frame % kFrameLatency;
+    if (pass.queries[slot] == 0)
+      glGenQueries(1, &pass.queries[slot]);
+    glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+  }
+  m_PassStart = Clock::now();
+}
+
+void FrameProfiler::endPass() {
+  if (m_ActivePass == -1)
+    return;
+
+  Pass &pass = m_Passes[m_ActivePass];
+  double passMs =
+      std::chrono::duration<double, std::milli>(Clock::now() - m_PassStart)
+          .count();
+  if (isRecording())
+    pass.cpuMs.add(passMs);
+
+  if (m_GpuTimers) {
+    int slot = m_Frame % kFrameLatency;
+    glEndQuery(GL_TIME_ELAPSED);
+    pass.pending[slot] = true;
+    pass.recorded[slot] = isRecording();
+  }
+  m_ActivePass = -1;
+}
+
+void FrameProfiler::setCounter(const std::string &name, double value) {
+  if (!isRecording())
+    return;
+
+  auto it = m_CounterIndex.find(name);
+  if (it == m_CounterIndex.end()) {
+    it = m_CounterIndex.emplace(name, m_Counters.size()).first;
+    m_Counters.emplace_back();
+    m_Counters.back().name = name;
+  }
+  m_Counters[it->second].samples.add(value);
+}
+
+void FrameProfiler::collect(int slot, bool wait) {
+  for (Pass &pass : m_Passes) {
+    if (!pass.pending[slot])
+      continue;
+
+    if (!wait) {
+      GLint available = 0;
+      glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE,
+                         &available);
+      if (!available)
+        continue;
+    }
+
+    GLuint64 elapsedNs = 0;
+    glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &elapsedNs);
+    if (pass.recorded[slot])
+      pass.gpuMs.add(elapsedNs / 1.0e6);
+    pass.pending[slot] = false;
+  }
+}
+
+void FrameProfiler::finish() {
+  if (m_ActivePass != -1)
+    endPass();
+  for (int slot = 0; slot < kFrameLatency; ++slot)
+    collect(slot, true);
+}
+
+void FrameProfiler::report(std::ostream &out) const {
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(3);
+
+  out << "Frames: " << m_FrameMs.count << " (warmup " << m_WarmupFrames;
+  if (m_FrameMs.count > m_FrameMs.values.size())
+    out << ", statistics of the last " << m_FrameMs.values.size();
+  out << ")" << std::endl;
+  out << std::left << std::setw(14) << "pass" << std::right
+      << std::setw(30) << "CPU ms  min / median / p99"
+      << std::setw(30) << "GPU ms  min / median / p99" << std::endl;
+
+  out << std::left << std::setw(14) << "frame" << std::right;
+  printStats(out, m_FrameMs.values);
+  out << std::setw(30) << "-" << std::endl;
+
+  for (const Pass &pass : m_Passes) {
+    out << std::left << std::setw(14) << pass.name << std::right;
+    printStats(out, pass.cpuMs.values);
+    printStats(out, pass.gpuMs.values);
+    out << std::endl;
+  }
+
+  if (!m_Counters.empty()) {
+    out << std::setprecision(1);
+    out << std::left << std::setw(24) << "counter" << std::right
+        << std::setw(30) << "per frame  min / median / p99" << std::endl;
+    for (const Counter &counter : m_Counters) {
+      out << std::left << std::setw(24) << counter.name << std::right;
+      printStats(out, counter.samples.values);
+      out << std::endl;
+    }
+  }
+  out.flags(flags);
+}
@@ -0,0 +1,87 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "glew/glew.h"
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Per-pass CPU and GPU frame timings. Passes are flat (no nesting) because
+// GL_TIME_ELAPSED queries can not overlap. GPU results are read back
+// kFrameLatency frames later so the query never stalls the pipeline.
+// Statistics cover the last kMaxSamples frames, an interactive session
+// keeps a rolling window instead of every frame.
+class FrameProfiler {
+public:
+  static const int kFrameLatency = 4;
+  static const size_t kMaxSamples = 4096;
+
+  FrameProfiler(bool gpuTimers = true, unsigned int warmupFrames = 0);
+  ~FrameProfiler();
+
+  FrameProfiler(const FrameProfiler &) = delete;
+  FrameProfiler &operator=(const FrameProfiler &) = delete;
+
+  void beginFrame();
+  void endFrame();
+
+  void beginPass(const std::string &name);
+  void endPass();
+
+  // Per frame counter (uniform lookups, GL calls, ...), reported with the
+  // same statistics as the timings.
+  void setCounter(const std::string &name, double value);
+
+  // Waits for all outstanding GPU queries. Call before report().
+  void finish();
+  void report(std::ostream &out) const;
+
+  unsigned int getFrameCount() const { return m_Frame; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // the last kMaxSamples values, in no particular order
+  struct Samples {
+    std::vector<double> values;
+    size_t count = 0; // recorded so far
+    void add(double value);
+  };
+
+  struct Pass {
+    std::string name;
+    GLuint queries[kFrameLatency] = {};
+    bool pending[kFrameLatency] = {};
+    bool recorded[kFrameLatency] = {};
+    Samples cpuMs;
+    Samples gpuMs;
+  };
+
+  bool m_GpuTimers;
+  unsigned int m_WarmupFrames;
+  unsigned int m_Frame = 0;
+
+  struct Counter {
+    std::string name;
+    Samples samples;
+  };
+
+  std::vector<Pass> m_Passes;
+  std::unordered_map<std::string, size_t> m_PassIndex;
+  int m_ActivePass = -1;
+
+  std::vector<Counter> m_Counters;
+  std::unordered_map<std::string, size_t> m_CounterIndex;
+
+  Clock::time_point m_FrameStart;
+  Clock::time_point m_PassStart;
+  Samples m_FrameMs;
+
+  bool isRecording() const { return m_Frame >= m_WarmupFrames; }
+  void collect(int slot, bool wait);
+};
+
+#endif // !PROFILER_H
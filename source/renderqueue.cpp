@@ -0,0 +1,98 @@
+#include "renderqueue.h"
+
+#include <algorithm>
+
+namespace {
+
+const uint32_t kDepthMax = (1u << 24) - 1;
+
+} // namespace
+
+uint64_t RenderQueue::makeKey(RenderPass pass, uint32_t program,
+                              uint32_t material, float depth) const {
+  float normalized = (depth - m_Near) / (m_Far - m_Near);
+  normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+  uint64_t quantized = (uint64_t)(normalized * kDepthMax);
+
+  uint64_t key = (uint64_t)pass << 56;
+  program &= 0xFFFF;
+  material &= 0xFFFF;
+  if (pass == RenderPass::Transparent) {
+    key |= (kDepthMax - quantized) << 32;
+    key |= (uint64_t)program << 16;
+    key |= material;
+  } else {
+    key |= (uint64_t)program << 40;
+    key |= (uint64_t)material << 24;
+    key |= quantized;
+  }
+  return key;
+}
+
+void RenderQueue::setDepthRange(float nearPlane, float farPlane) {
+  m_Near = nearPlane;
+  m_Far = farPlane;
+}
+
+void RenderQueue::setPassState(RenderPass pass, std::function<void()> setup) {
+  m_PassState[(int)pass] = std::move(setup);
+}
+
+void RenderQueue::submit(uint64_t key, std::function<void()> draw) {
+  m_Commands.push_back({key, std::move(draw)});
+}
+
+void RenderQueue::sort() {
+  size_t count = m_Commands.size();
+  m_Keys.resize(count);
+  m_KeysTemp.resize(count);
+  m_Order.resize(count);
+  m_OrderTemp.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    m_Keys[i] = m_Commands[i].key;
+    m_Order[i] = (uint32_t)i;
+  }
+
+  // LSD radix sort, one byte per pass. Stable, so equal keys keep their
+  // submission order. Bytes every key shares are skipped.
+  for (int shift = 0; shift < 64; shift += 8) {
+    size_t histogram[256] = {};
+    for (uint64_t key : m_Keys)
+      ++histogram[(key >> shift) & 0xFF];
+    if (histogram[(m_Keys[0] >> shift) & 0xFF] == count)
+      continue;
+
+    size_t offset = 0;
+    for (size_t &bucket : histogram) {
+      size_t bucketCount = bucket;
+      bucket = offset;
+      offset += bucketCount;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      size_t dst = histogram[(m_Keys[i] >> shift) & 0xFF]++;
+      m_KeysTemp[dst] = m_Keys[i];
+      m_OrderTemp[dst] = m_Order[i];
+    }
+    m_Keys.swap(m_KeysTemp);
+    m_Order.swap(m_OrderTemp);
+  }
+}
+
+void RenderQueue::execute() {
+  if (!m_Commands.empty()) {
+    sort();
+
+    int pass = -1;
+    for (uint32_t index : m_Order) {
+      DrawCommand &command = m_Commands[index];
+      int commandPass = (int)(command.key >> 56);
+      if (commandPass != pass) {
+        pass = commandPass;
+        if (pass < (int)RenderPass::Count && m_PassState[pass])
+          m_PassState[pass]();
+      }
+      command.draw();
+    }
+  }
+  m_Commands.clear();
+}
@@ -0,0 +1,64 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Draws are submitted in any order with a 64 bit sort key, radix sorted and
+// executed once per frame. The pass sits in the top byte so passes run in
+// enum order, each preceded by its state setup. Below it:
+//
+//   opaque passes  | program 16 | material 16 | depth 24, front to back |
+//   transparent    | depth 24, back to front | program 16 | material 16 |
+//
+// Equal keys keep their submission order.
+enum class RenderPass : uint8_t {
+  Opaque,
+  StencilWrite,
+  Outline,
+  Skybox,
+  Transparent,
+  Count
+};
+
+struct DrawCommand {
+  uint64_t key;
+  // sets the per draw uniforms / bindings and issues the draw
+  std::function<void()> draw;
+};
+
+class RenderQueue {
+public:
+  // depth is the view distance, quantized over setDepthRange()
+  uint64_t makeKey(RenderPass pass, uint32_t program, uint32_t material,
+                   float depth) const;
+
+  // Depth range mapped onto the 24 key bits, values outside are clamped.
+  void setDepthRange(float nearPlane, float farPlane);
+
+  // Runs before the first command of the pass, every frame.
+  void setPassState(RenderPass pass, std::function<void()> setup);
+
+  void submit(uint64_t key, std::function<void()> draw);
+
+  // Sorts, runs every command and clears the queue.
+  void execute();
+
+  size_t size() const { return m_Commands.size(); }
+
+private:
+  std::vector<DrawCommand> m_Commands;
+  std::function<void()> m_PassState[(int)RenderPass::Count];
+
+  // scratch for the radix sort, kept between frames
+  std::vector<uint64_t> m_Keys, m_KeysTemp;
+  std::vector<uint32_t> m_Order, m_OrderTemp;
+
+  float m_Near = 0.1f;
+  float m_Far = 200.0f;
+
+  void sort();
+};
+
+#endif // !RENDERQUEUE_H
@@ -0,0 +1,191 @@
+#include "renderstate.h"
+
+namespace {
+
+// Never a valid value for the cached enums and names, so after reset()
+// every comparison differs and the call goes through.
+const GLuint kUnknown = 0xFFFFFFFFu;
+
+} // namespace
+
+RenderState &RenderState::get() {
+  static RenderState state;
+  return state;
+}
+
+RenderState::RenderState() { reset(); }
+
+void RenderState::reset() {
+  for (int &cap : m_Caps)
+    cap = -1;
+
+  m_DepthMask = -1;
+  m_DepthFunc = kUnknown;
+  m_StencilMask = kUnknown;
+  m_StencilFunc = kUnknown;
+  m_StencilRef = -1;
+  m_StencilFuncMask = kUnknown;
+  for (GLenum &op : m_StencilOp)
+    op = kUnknown;
+  for (GLenum &factor : m_BlendFunc)
+    factor = kUnknown;
+  m_CullFace = kUnknown;
+  m_FrontFace = kUnknown;
+
+  m_Program = kUnknown;
+  m_VertexArray = kUnknown;
+  m_ActiveUnit = kUnknown;
+  for (int unit = 0; unit < kTextureUnits; ++unit) {
+    m_Texture2D[unit] = kUnknown;
+    m_TextureCube[unit] = kUnknown;
+  }
+}
+
+void RenderState::resetCounters() {
+  m_Issued = 0;
+  m_Elided = 0;
+  m_Draws = 0;
+}
+
+bool RenderState::changed(bool differs) {
+  if (differs)
+    ++m_Issued;
+  else
+    ++m_Elided;
+  return differs;
+}
+
+void RenderState::setCap(GLenum cap, bool enabled) {
+  int index;
+  switch (cap) {
+  case GL_DEPTH_TEST:
+    index = DepthTest;
+    break;
+  case GL_STENCIL_TEST:
+    index = StencilTest;
+    break;
+  case GL_BLEND:
+    index = Blend;
+    break;
+  case GL_CULL_FACE:
+    index = CullFace;
+    break;
+  default:
+    ++m_Issued;
+    enabled ? glEnable(cap) : glDisable(cap);
+    return;
+  }
+
+  if (!changed(m_Caps[index] != (int)enabled))
+    return;
+  m_Caps[index] = enabled;
+  enabled ? glEnable(cap) : glDisable(cap);
+}
+
+void RenderState::enable(GLenum cap) { setCap(cap, true); }
+
+void RenderState::disable(GLenum cap) { setCap(cap, false); }
+
+void RenderState::depthMask(GLboolean flag) {
+  if (!changed(m_DepthMask != (flag ? 1 : 0)))
+    return;
+  m_DepthMask = flag ? 1 : 0;
+  glDepthMask(flag);
+}
+
+void RenderState::depthFunc(GLenum func) {
+  if (!changed(m_DepthFunc != func))
+    return;
+  m_DepthFunc = func;
+  glDepthFunc(func);
+}
+
+void RenderState::stencilMask(GLuint mask) {
+  if (!changed(m_StencilMask != mask))
+    return;
+  m_StencilMask = mask;
+  glStencilMask(mask);
+}
+
+void RenderState::stencilFunc(GLenum func, GLint ref, GLuint mask) {
+  if (!changed(m_StencilFunc != func || m_StencilRef != ref ||
+               m_StencilFuncMask != mask))
+    return;
+  m_StencilFunc = func;
+  m_StencilRef = ref;
+  m_StencilFuncMask = mask;
+  glStencilFunc(func, ref, mask);
+}
+
+void RenderState::stencilOp(GLenum sfail, GLenum dpfail, GLenum dppass) {
+  if (!changed(m_StencilOp[0] != sfail || m_StencilOp[1] != dpfail ||
+               m_StencilOp[2] != dppass))
+    return;
+  m_StencilOp[0] = sfail;
+  m_StencilOp[1] = dpfail;
+  m_StencilOp[2] = dppass;
+  glStencilOp(sfail, dpfail, dppass);
+}
+
+void RenderState::blendFunc(GLenum sfactor, GLenum dfactor) {
+  if (!changed(m_BlendFunc[0] != sfactor || m_BlendFunc[1] != dfactor))
+    return;
+  m_BlendFunc[0] = sfactor;
+  m_BlendFunc[1] = dfactor;
+  glBlendFunc(sfactor, dfactor);
+}
+
+void RenderState::cullFace(GLenum mode) {
+  if (!changed(m_CullFace != mode))
+    return;
+  m_CullFace = mode;
+  glCullFace(mode);
+}
+
+void RenderState::frontFace(GLenum mode) {
+  if (!changed(m_FrontFace != mode))
+    return;
+  m_FrontFace = mode;
+  glFrontFace(mode);
+}
+
+void RenderState::useProgram(GLuint program) {
+  if (!changed(m_Program != program))
+    return;
+  m_Program = program;
+  glUseProgram(program);
+}
+
+void RenderState::bindVertexArray(GLuint vao) {
+  if (!changed(m_VertexArray != vao))
+    return;
+  m_VertexArray = vao;
+  glBindVertexArray(vao);
+}
+
+void RenderState::activeTexture(GLuint unit) {
+  if (m_ActiveUnit == unit)
+    return;
+  m_ActiveUnit = unit;
+  glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+void RenderState::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+  GLuint *bound = nullptr;
+  if (unit < (GLuint)kTextureUnits) {
+    if (target == GL_TEXTURE_2D)
+      bound = &m_Texture2D[unit];
+    else if (target == GL_TEXTURE_CUBE_MAP)
+      bound = &m_TextureCube[unit];
+  }
+
+  if (bound && !changed(*bound != texture))
+    return;
+  if (!bound)
+    ++m_Issued;
+
+  activeTexture(unit);
+  glBindTexture(target, texture);
+  if (bound)
+    *bound = texture;
+}
@@ -0,0 +1,86 @@
+#ifndef RENDERSTATE_H
+#define RENDERSTATE_H
+
+#include "glew/glew.h"
+
+// Shadow copy of the GL state the frame loop keeps toggling. Calls that
+// would set a value that is already current are dropped and counted.
+//
+// The shadow is only right while every change of the tracked state goes
+// through here. Code that calls GL directly (setup, resource creation,
+// deleting a bound texture or program) must be followed by reset().
+class RenderState {
+public:
+  static const int kTextureUnits = 16;
+
+  // One per process, there is only one GL context.
+  static RenderState &get();
+
+  RenderState(const RenderState &) = delete;
+  RenderState &operator=(const RenderState &) = delete;
+
+  // Forget the shadow, the next call of every kind reaches GL.
+  void reset();
+
+  // GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND and GL_CULL_FACE are cached,
+  // any other cap is passed through.
+  void enable(GLenum cap);
+  void disable(GLenum cap);
+
+  void depthMask(GLboolean flag);
+  void depthFunc(GLenum func);
+  void stencilMask(GLuint mask);
+  void stencilFunc(GLenum func, GLint ref, GLuint mask);
+  void stencilOp(GLenum sfail, GLenum dpfail, GLenum dppass);
+  void blendFunc(GLenum sfactor, GLenum dfactor);
+  void cullFace(GLenum mode);
+  void frontFace(GLenum mode);
+
+  void useProgram(GLuint program);
+  void bindVertexArray(GLuint vao);
+  // GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP are cached per unit. Only
+  // switches the active unit when the binding actually changes.
+  void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+  // Calls forwarded to GL / dropped since resetCounters()
+  unsigned int getIssuedCount() const { return m_Issued; }
+  unsigned int getElidedCount() const { return m_Elided; }
+  // Draw calls reported through countDraws() since resetCounters()
+  void countDraws(unsigned int draws) { m_Draws += draws; }
+  unsigned int getDrawCount() const { return m_Draws; }
+  void resetCounters();
+
+private:
+  RenderState();
+
+  enum Cap { DepthTest, StencilTest, Blend, CullFace, CapCount };
+  // -1 unknown, else the last value set
+  int m_Caps[CapCount];
+
+  GLint m_DepthMask;
+  GLenum m_DepthFunc;
+  GLuint m_StencilMask;
+  GLenum m_StencilFunc;
+  GLint m_StencilRef;
+  GLuint m_StencilFuncMask;
+  GLenum m_StencilOp[3];
+  GLenum m_BlendFunc[2];
+  GLenum m_CullFace;
+  GLenum m_FrontFace;
+
+  GLuint m_Program;
+  GLuint m_VertexArray;
+  GLuint m_ActiveUnit;
+  GLuint m_Texture2D[kTextureUnits];
+  GLuint m_TextureCube[kTextureUnits];
+
+  unsigned int m_Issued = 0;
+  unsigned int m_Elided = 0;
+  unsigned int m_Draws = 0;
+
+  bool changed(bool differs);
+  void setCap(GLenum cap, bool enabled);
+  void activeTexture(GLuint unit);
+};
+
+#endif // !RENDERSTATE_H
@@ -0,0 +1,64 @@
+#include "scenegraph.h"
+
+#include "glm/matrix.hpp"
+
+#include <algorithm>
+
+const uint32_t SceneGraph::kNoParent;
+
+void SceneGraph::reserve(size_t count) {
+  m_Parent.reserve(count);
+  m_Local.reserve(count);
+  m_World.reserve(count);
+  m_Normal.reserve(count);
+  m_Dirty.reserve(count);
+}
+
+void SceneGraph::clear() {
+  m_Parent.clear();
+  m_Local.clear();
+  m_World.clear();
+  m_Normal.clear();
+  m_Dirty.clear();
+  m_FirstDirty = 0;
+}
+
+uint32_t SceneGraph::addNode(uint32_t parent, const glm::mat4 &local) {
+  uint32_t node = (uint32_t)m_Parent.size();
+  m_Parent.push_back(parent < node ? parent : kNoParent);
+  m_Local.push_back(local);
+  m_World.push_back(local);
+  m_Normal.emplace_back(1.0f);
+  m_Dirty.push_back(1);
+  m_FirstDirty = std::min(m_FirstDirty, (size_t)node);
+  return node;
+}
+
+void SceneGraph::setLocal(uint32_t node, const glm::mat4 &local) {
+  m_Local[node] = local;
+  m_Dirty[node] = 1;
+  m_FirstDirty = std::min(m_FirstDirty, (size_t)node);
+}
+
+size_t SceneGraph::update() {
+  size_t count = size();
+  size_t updated = 0;
+  for (size_t node = m_FirstDirty; node < count; ++node) {
+    uint32_t parent = m_Parent[node];
+    // parents come first, their flag is final by now
+    if (parent != kNoParent && m_Dirty[parent])
+      m_Dirty[node] = 1;
+    if (!m_Dirty[node])
+      continue;
+
+    m_World[node] = parent == kNoParent ? m_Local[node]
+                                        : m_World[parent] * m_Local[node];
+    m_Normal[node] = glm::transpose(glm::inverse(glm::mat3(m_World[node])));
+    ++updated;
+  }
+  // flags stay set during the sweep for the children, cleared after it
+  if (m_FirstDirty < count)
+    std::fill(m_Dirty.begin() + m_FirstDirty, m_Dirty.end(), 0);
+  m_FirstDirty = count;
+  return updated;
+}
@@ -0,0 +1,53 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include "glm/ext/matrix_float3x3.hpp"
+#include "glm/ext/matrix_float4x4.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Transform hierarchy, GL free like culling.h. Nodes live in contiguous
+// arrays indexed by node id, every parent before its children, so one
+// forward sweep propagates world matrices without recursion.
+//
+// setLocal() only marks the node dirty; update() recomputes the world and
+// normal matrices of the dirty nodes and of everything below them, and
+// leaves the rest of the graph untouched. The sweep starts at the first
+// dirty node.
+class SceneGraph {
+public:
+  static const uint32_t kNoParent = UINT32_MAX;
+
+  void reserve(size_t count);
+  void clear();
+  // parent must be kNoParent or an existing node. The new node is dirty.
+  uint32_t addNode(uint32_t parent, const glm::mat4 &local = glm::mat4(1.0f));
+
+  void setLocal(uint32_t node, const glm::mat4 &local);
+  const glm::mat4 &getLocal(uint32_t node) const { return m_Local[node]; }
+  uint32_t getParent(uint32_t node) const { return m_Parent[node]; }
+
+  // As of the last update()
+  const glm::mat4 &getWorld(uint32_t node) const { return m_World[node]; }
+  // transpose(inverse(mat3(world))), world space normals. For view space
+  // normals with a rigid view: mat3(view) * getNormal(node).
+  const glm::mat3 &getNormal(uint32_t node) const { return m_Normal[node]; }
+
+  // Returns the number of nodes recomputed
+  size_t update();
+
+  size_t size() const { return m_Parent.size(); }
+
+private:
+  std::vector<uint32_t> m_Parent;
+  std::vector<glm::mat4> m_Local;
+  std::vector<glm::mat4> m_World;
+  std::vector<glm::mat3> m_Normal;
+  std::vector<uint8_t> m_Dirty;
+  // lowest dirty node id, size() when clean
+  size_t m_FirstDirty = 0;
+};
+
+#endif // !SCENEGRAPH_H
@@ -1,12 +1,47 @@
 #include "shader.h"
+#include "renderstate.h"
+#include <algorithm>
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 // #define RELEASE
 
+unsigned int Shader::s_lookupCount = 0;
+bool Shader::s_programCacheEnabled = true;
+unsigned int Shader::s_programCount = 0;
+unsigned int Shader::s_programCacheHits = 0;
+std::string Shader::s_directory = "shader/";
+
+namespace {
+
+const char kProgramCacheMagic[4] = {'G', 'L', 'P', 'B'};
+const uint32_t kProgramCacheVersion = 1;
+
+struct ProgramCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t binaryFormat;
+  uint32_t binaryLength;
+};
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+} // namespace
+
 Shader::Shader(const char *vertexShaderPath, const char *fragmentShaderPath) {
   std::string vertexCode;
   std::string fragmentCode;
@@ -75,136 +110,609 @@ Shader::Shader(const char *vertexShaderPath, const char *fragmentShaderPath) {
   if (!success) {
     glGetProgramInfoLog(ID, 512, NULL, infoLog);
     std::cout << "ERROR::SHADER_PROGRAM::LINK_FAILED: " << infoLog << std::endl;
-  }
+  } else
+    introspectUniforms();
 
   glDeleteShader(vertex);
   glDeleteShader(fragment);
 }
 
-Shader::Shader(const char *shaderName) {
-  std::string vertexShaderPath{"shader/"};
-  std::string fragmentShaderPath{"shader/"};
-  std::string geometryShaderPath{"shader/"};
+Shader::Shader(const char *shaderName, ShaderBatch *batch)
+    : Shader(shaderName, ShaderDefines{}, batch) {}
 
-  vertexShaderPath += shaderName;
-  fragmentShaderPath += shaderName;
-  geometryShaderPath += shaderName;
+Shader::Shader(const char *shaderName, const ShaderDefines &defines,
+               ShaderBatch *batch)
+    : m_name(shaderName), m_defines(defines) {
+  build(batch);
+}
 
-  vertexShaderPath += "/vertex.vs";
-  fragmentShaderPath += "/fragment.fs";
-  geometryShaderPath += "/geometry.gs";
+Shader::Shader(Shader &root, const ShaderDefines &defines)
+    : m_name(root.m_name), m_defines(defines), m_root(&root),
+      m_blockBindings(root.m_blockBindings) {
+  build(nullptr);
+  applyBlockBindings();
+}
 
-  std::string vertexCode;
-  std::string fragmentCode;
-  std::string geometryCode;
-  std::ifstream vShaderFile;
-  std::ifstream fShaderFile;
-  std::ifstream gShaderFile;
+void Shader::build(ShaderBatch *batch) {
+  ++s_programCount;
+  std::string code[kStageCount];
+  if (!readSources(code)) {
+    std::cout << "SHADER: " << m_name << " NOT BUILT" << std::endl;
+    ID = 0;
+    return;
+  }
 
-  bool enableGeo = std::filesystem::exists(geometryShaderPath.c_str());
+  bool useCache = s_programCacheEnabled && programCacheSupported();
+  if (useCache) {
+    m_pendingCacheKey = programCacheKey(code, kStageCount);
+    if (loadProgramBinary(cachePath(), m_pendingCacheKey)) {
+      ++s_programCacheHits;
+      introspectUniforms();
+      return;
+    }
+    m_pendingCachePath = cachePath();
+  }
 
-  vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  if (enableGeo)
-    gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+  ID = submitProgram(code, useCache, m_feedbackVaryings, m_pendingStages);
+  if (batch)
+    batch->m_Pending.push_back(this);
+  else
+    finishBuild();
+}
 
-  try {
-    // openFiles
-    vShaderFile.open(vertexShaderPath);
-    fShaderFile.open(fragmentShaderPath);
-    if (enableGeo)
-      gShaderFile.open(geometryShaderPath);
-    std::stringstream vShaderStream, fShaderStream, gShaderStream;
+std::string Shader::cachePath() const {
+  if (m_defines.empty())
+    return s_directory + m_name + "/program.programcache";
+  // one file per permutation, named by its defines
+  std::string key = definesKey(m_defines);
+  char name[48];
+  std::snprintf(name, sizeof(name), "/program-%016llx.programcache",
+                (unsigned long long)hashBytes(14695981039346656037ull,
+                                              key.data(), key.size()));
+  return s_directory + m_name + name;
+}
 
-    vShaderStream << vShaderFile.rdbuf();
-    fShaderStream << fShaderFile.rdbuf();
-    if (enableGeo)
-      gShaderStream << gShaderFile.rdbuf();
+std::string Shader::stagePath(int stage) const {
+  static const char *kStageFiles[] = {"/vertex.vs", "/fragment.fs",
+                                      "/geometry.gs"};
+  return s_directory + m_name + kStageFiles[stage];
+}
 
-    vShaderFile.close();
-    fShaderFile.close();
-    if (enableGeo)
-      gShaderFile.close();
+bool Shader::readSources(std::string *code) {
+  m_includes.clear();
+  m_feedbackVaryings.clear();
+  for (int stage = 0; stage < kStageCount; ++stage) {
+    std::string path = stagePath(stage);
+    // the geometry stage is optional, the fragment stage checked below
+    if (stage != kVertexStage && !std::filesystem::exists(path))
+      continue;
+
+    std::vector<std::string> included;
+    if (!preprocess(path, 0, code[stage], included))
+      return false;
+    for (const std::string &include : included)
+      if (std::find(m_includes.begin(), m_includes.end(), include) ==
+          m_includes.end())
+        m_includes.push_back(include);
+
+    std::istringstream lines(code[stage]);
+    std::string line;
+    while (std::getline(lines, line)) {
+      std::istringstream words(line);
+      std::string word;
+      if (!(words >> word) || word != "#pragma" || !(words >> word) ||
+          word != "transform_feedback")
+        continue;
+      while (words >> word)
+        m_feedbackVaryings.push_back(word);
+    }
+  }
 
-    vertexCode = vShaderStream.str();
-    fragmentCode = fShaderStream.str();
-    if (enableGeo)
-      geometryCode = gShaderStream.str();
+  // only transform feedback programs may leave out the fragment stage
+  if (code[kFragmentStage].empty() && m_feedbackVaryings.empty()) {
+    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: "
+              << stagePath(kFragmentStage) << std::endl;
+    return false;
+  }
+  return true;
+}
 
-  } catch (std::ifstream::failure e) {
-    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-    enableGeo = false;
+bool Shader::preprocess(const std::string &path, int sourceNumber,
+                        std::string &out,
+                        std::vector<std::string> &included) const {
+  std::ifstream file(path);
+  std::stringstream stream;
+  if (file)
+    stream << file.rdbuf();
+  if (!file) {
+    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path
+              << std::endl;
+    return false;
   }
-  const char *vShaderCode = vertexCode.c_str();
-  const char *fShaderCode = fragmentCode.c_str();
-  const char *gShaderCode = nullptr;
-  if (enableGeo)
-    gShaderCode = geometryCode.c_str();
 
-  unsigned int vertex, fragment, geometry;
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(stream, line)) {
+    ++lineNumber;
+    size_t start = line.find_first_not_of(" \t");
+    bool directive = start != std::string::npos && line[start] == '#';
+
+    if (directive && line.compare(start, 8, "#include") == 0) {
+      size_t open = line.find('"', start);
+      size_t close =
+          open == std::string::npos ? open : line.find('"', open + 1);
+      if (close == std::string::npos) {
+        std::cout << "ERROR::SHADER::BAD_INCLUDE: " << path << ":"
+                  << lineNumber << std::endl;
+        return false;
+      }
+      std::string includePath =
+          s_directory + line.substr(open + 1, close - open - 1);
+      // every file once, like an include guard in each of them
+      if (std::find(included.begin(), included.end(), includePath) !=
+          included.end())
+        continue;
+      included.push_back(includePath);
+
+      // errors in the file report source string N, the Nth include
+      int includeNumber = (int)included.size();
+      out += "#line 1 " + std::to_string(includeNumber) + "\n";
+      if (!preprocess(includePath, includeNumber, out, included))
+        return false;
+      out += "#line " + std::to_string(lineNumber + 1) + " " +
+             std::to_string(sourceNumber) + "\n";
+      continue;
+    }
+
+    out += line;
+    out += '\n';
+    if (directive && sourceNumber == 0 &&
+        line.compare(start, 8, "#version") == 0 && !m_defines.empty()) {
+      for (const auto &define : m_defines)
+        out += "#define " + define.first + " " + define.second + "\n";
+      out += "#line " + std::to_string(lineNumber + 1) + " 0\n";
+    }
+  }
+  return true;
+}
+
+GLuint Shader::submitProgram(const std::string *code, bool retrievable,
+                             const std::vector<std::string> &varyings,
+                             std::vector<GLuint> &stages) {
+  // every stage and the link are submitted before any status query, the
+  // first query waits for the compile to finish
+  static const GLenum kStageTypes[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER,
+                                       GL_GEOMETRY_SHADER};
+  GLuint program = glCreateProgram();
+  for (int stage = 0; stage < kStageCount; ++stage) {
+    if (stage != kVertexStage && code[stage].empty())
+      continue;
+    const char *source = code[stage].c_str();
+    GLuint shader = glCreateShader(kStageTypes[stage]);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glAttachShader(program, shader);
+    stages.push_back(shader);
+  }
+  if (!varyings.empty()) {
+    std::vector<const char *> names;
+    for (const std::string &varying : varyings)
+      names.push_back(varying.c_str());
+    glTransformFeedbackVaryings(program, (GLsizei)names.size(), names.data(),
+                                GL_INTERLEAVED_ATTRIBS);
+  }
+  if (retrievable)
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(program);
+  return program;
+}
+
+bool Shader::checkProgram(GLuint program, std::vector<GLuint> &stages) {
   int success;
   char infoLog[512];
 
-  // vertex shader
-  vertex = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex, 1, &vShaderCode, NULL);
-  glCompileShader(vertex);
+  for (GLuint shader : stages) {
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+      // stages may be left out, the type names the failing one
+      GLint type = 0;
+      glGetShaderiv(shader, GL_SHADER_TYPE, &type);
+      const char *stageName = type == GL_VERTEX_SHADER     ? "VERTEX"
+                              : type == GL_FRAGMENT_SHADER ? "FRAGMENT"
+                                                           : "GEOMETRY";
+      glGetShaderInfoLog(shader, 512, NULL, infoLog);
+      std::cout << "ERROR::SHADER::" << stageName
+                << "::COMPILATION_FAILED: " << infoLog << std::endl;
+    }
+  }
+  for (GLuint shader : stages)
+    glDeleteShader(shader);
+  stages.clear();
 
-  glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED: " << infoLog
-              << std::endl;
+    glGetProgramInfoLog(program, 512, NULL, infoLog);
+    std::cout << "ERROR::SHADER_PROGRAM::LINK_FAILED: " << infoLog << std::endl;
+    return false;
   }
-  // fragment shader
-  fragment = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment, 1, &fShaderCode, NULL);
-  glCompileShader(fragment);
+  return true;
+}
 
-  glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED: " << infoLog
+void Shader::finishBuild() {
+  if (checkProgram(ID, m_pendingStages)) {
+    introspectUniforms();
+    if (!m_pendingCachePath.empty())
+      saveProgramBinary(m_pendingCachePath, m_pendingCacheKey);
+  }
+  m_pendingCachePath.clear();
+}
+
+void Shader::bindUniformBlock(const std::string &blockName,
+                              GLuint bindingPoint) {
+  GLuint blockIndex = glGetUniformBlockIndex(ID, blockName.c_str());
+  if (blockIndex == GL_INVALID_INDEX) {
+    std::cout << "SHADER BLOCK BINDING: INVALID INDEX: " << blockName
               << std::endl;
+    return;
   }
+  glUniformBlockBinding(ID, blockIndex, bindingPoint);
+  for (auto &variant : m_variants)
+    variant.second->bindUniformBlock(blockName, bindingPoint);
+
+  for (auto &binding : m_blockBindings) {
+    if (binding.first == blockName) {
+      binding.second = bindingPoint;
+      return;
+    }
+  }
+  m_blockBindings.emplace_back(blockName, bindingPoint);
+}
 
-  // geomety shader
-  if (enableGeo) {
-    geometry = glCreateShader(GL_GEOMETRY_SHADER);
-    glShaderSource(geometry, 1, &gShaderCode, NULL);
-    glCompileShader(geometry);
+bool Shader::beginReload() {
+  if (m_name.empty() || isReloading())
+    return false;
+  bool submitted = true;
+  forEachVariant([&](Shader &shader) {
+    std::string code[kStageCount];
+    if (!shader.readSources(code)) {
+      submitted = false;
+      return;
+    }
+    bool useCache = s_programCacheEnabled && programCacheSupported();
+    shader.m_reloadCacheKey =
+        useCache ? programCacheKey(code, kStageCount) : 0;
+    shader.m_reloadProgram =
+        submitProgram(code, useCache, shader.m_feedbackVaryings,
+                      shader.m_reloadStages);
+  });
+  return submitted;
+}
 
-    glGetShaderiv(geometry, GL_COMPILE_STATUS, &success);
-    if (!success) {
-      glGetShaderInfoLog(geometry, 512, NULL, infoLog);
-      std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED: " << infoLog
-                << std::endl;
+bool Shader::isReloading() const {
+  if (m_reloadProgram)
+    return true;
+  for (const auto &variant : m_variants)
+    if (variant.second->m_reloadProgram)
+      return true;
+  return false;
+}
+
+bool Shader::isReloadReady() const {
+  if (!isReloading())
+    return false;
+  if (!GLEW_KHR_parallel_shader_compile && !GLEW_ARB_parallel_shader_compile)
+    return true;
+  bool ready = true;
+  const_cast<Shader *>(this)->forEachVariant([&](Shader &shader) {
+    if (!shader.m_reloadProgram)
+      return;
+    GLint done = GL_FALSE;
+    glGetProgramiv(shader.m_reloadProgram, GL_COMPLETION_STATUS_KHR, &done);
+    ready = ready && done == GL_TRUE;
+  });
+  return ready;
+}
+
+bool Shader::finishReload() {
+  if (!isReloading())
+    return false;
+  bool swapped = true;
+  forEachVariant([&](Shader &shader) {
+    swapped = shader.swapReloadedProgram() && swapped;
+  });
+  // the old programs may be current, the shadow must not keep their IDs
+  RenderState::get().reset();
+  return swapped;
+}
+
+bool Shader::swapReloadedProgram() {
+  if (!m_reloadProgram)
+    return false;
+  GLuint program = m_reloadProgram;
+  m_reloadProgram = 0;
+  if (!checkProgram(program, m_reloadStages)) {
+    glDeleteProgram(program);
+    return false;
+  }
+
+  glDeleteProgram(ID);
+  ID = program;
+  introspectUniforms();
+  applyBlockBindings();
+  if (m_reloadCacheKey)
+    saveProgramBinary(cachePath(), m_reloadCacheKey);
+  return true;
+}
+
+void Shader::applyBlockBindings() const {
+  for (const auto &binding : m_blockBindings) {
+    GLuint blockIndex = glGetUniformBlockIndex(ID, binding.first.c_str());
+    if (blockIndex != GL_INVALID_INDEX)
+      glUniformBlockBinding(ID, blockIndex, binding.second);
+  }
+}
+
+std::string Shader::definesKey(const ShaderDefines &defines) {
+  ShaderDefines sorted = defines;
+  std::sort(sorted.begin(), sorted.end());
+  std::string key;
+  for (const auto &define : sorted)
+    key += define.first + "=" + define.second + ";";
+  return key;
+}
+
+Shader &Shader::variant(const ShaderDefines &defines) {
+  if (defines.empty())
+    return *this;
+
+  // this shader's defines, overridden by the requested ones
+  ShaderDefines merged = m_defines;
+  for (const auto &define : defines) {
+    auto same = std::find_if(merged.begin(), merged.end(),
+                             [&](const std::pair<std::string, std::string> &d) {
+                               return d.first == define.first;
+                             });
+    if (same != merged.end())
+      same->second = define.second;
+    else
+      merged.push_back(define);
+  }
+
+  // one family, one handle table
+  if (m_root != this)
+    return m_root->variant(merged);
+
+  std::string key = definesKey(merged);
+  auto it = m_variants.find(key);
+  if (it != m_variants.end())
+    return *it->second;
+
+  std::unique_ptr<Shader> shader(new Shader(*this, merged));
+  Shader &result = *shader;
+  m_variants.emplace(key, std::move(shader));
+  return result;
+}
+
+ShaderBatch::ShaderBatch()
+    : m_Parallel(GLEW_KHR_parallel_shader_compile ||
+                 GLEW_ARB_parallel_shader_compile) {
+  // as many driver threads as the implementation likes
+  if (GLEW_KHR_parallel_shader_compile)
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  else if (m_Parallel)
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+}
+
+ShaderBatch::~ShaderBatch() { finish(); }
+
+void ShaderBatch::finish() {
+  if (m_Parallel) {
+    // the completion query never blocks, the status queries below would
+    for (Shader *shader : m_Pending) {
+      GLint done = GL_FALSE;
+      glGetProgramiv(shader->ID, GL_COMPLETION_STATUS_KHR, &done);
+      while (!done) {
+        std::this_thread::yield();
+        glGetProgramiv(shader->ID, GL_COMPLETION_STATUS_KHR, &done);
+      }
     }
   }
+  for (Shader *shader : m_Pending)
+    shader->finishBuild();
+  m_Pending.clear();
+}
 
-  ID = glCreateProgram();
-  glAttachShader(ID, vertex);
-  glAttachShader(ID, fragment);
-  if (enableGeo)
-    glAttachShader(ID, geometry);
-  glLinkProgram(ID);
+void Shader::use() const { RenderState::get().useProgram(ID); }
+
+bool Shader::programCacheSupported() {
+  static int supported = -1;
+  if (supported < 0) {
+    GLint formats = 0;
+    if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    supported = formats > 0;
+  }
+  return supported > 0;
+}
+
+uint64_t Shader::programCacheKey(const std::string *sources, size_t count) {
+  // a binary is only valid for the driver build that produced it
+  uint64_t hash = 14695981039346656037ull ^ kProgramCacheVersion;
+  for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    const char *value = (const char *)glGetString(name);
+    if (value)
+      hash = hashBytes(hash, value, std::strlen(value) + 1);
+  }
+  // lengths keep text moving between stages from hashing the same
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t length = sources[i].size();
+    hash = hashBytes(hash, &length, sizeof(length));
+    hash = hashBytes(hash, sources[i].data(), sources[i].size());
+  }
+  return hash;
+}
+
+bool Shader::loadProgramBinary(const std::string &path, uint64_t key) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  ProgramCacheHeader header;
+  if (!in.read((char *)&header, sizeof(header)) ||
+      std::memcmp(header.magic, kProgramCacheMagic, 4) != 0 ||
+      header.version != kProgramCacheVersion || header.key != key)
+    return false;
+  std::vector<char> binary(header.binaryLength);
+  if (!in.read(binary.data(), binary.size()))
+    return false;
 
+  ID = glCreateProgram();
+  glProgramBinary(ID, header.binaryFormat, binary.data(),
+                  (GLsizei)binary.size());
+  GLint success = 0;
   glGetProgramiv(ID, GL_LINK_STATUS, &success);
   if (!success) {
-    glGetProgramInfoLog(ID, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER_PROGRAM::LINK_FAILED: " << infoLog << std::endl;
+    // a driver update the version string did not reveal
+    std::cout << "PROGRAM CACHE: " << path << " rejected, recompiling"
+              << std::endl;
+    glDeleteProgram(ID);
+    ID = 0;
+    return false;
+  }
+  return true;
+}
+
+void Shader::saveProgramBinary(const std::string &path, uint64_t key) const {
+  GLint length = 0;
+  glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(ID, length, &length, &format, binary.data());
+  if (length <= 0)
+    return;
+
+  ProgramCacheHeader header;
+  std::memcpy(header.magic, kProgramCacheMagic, 4);
+  header.version = kProgramCacheVersion;
+  header.key = key;
+  header.binaryFormat = format;
+  header.binaryLength = (uint32_t)length;
+
+  // same temporary file + rename as MeshCache::write
+  std::string tempPath = path + ".tmp";
+  std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+  if (!out)
+    return;
+  out.write((const char *)&header, sizeof(header));
+  out.write(binary.data(), length);
+  out.close();
+  if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+    std::remove(tempPath.c_str());
+    std::cout << "PROGRAM CACHE: write failed: " << path << std::endl;
   }
+}
 
-  glDeleteShader(vertex);
-  glDeleteShader(fragment);
-  if (enableGeo)
-    glDeleteShader(geometry);
+void Shader::introspectUniforms() {
+  m_uniformLocations.clear();
+
+  GLint count = 0, maxLength = 0;
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+  std::vector<char> nameBuffer(maxLength > 0 ? maxLength : 1);
+  for (GLint i = 0; i < count; ++i) {
+    GLsizei length = 0;
+    GLint size = 0;
+    GLenum type;
+    glGetActiveUniform(ID, i, (GLsizei)nameBuffer.size(), &length, &size, &type,
+                       nameBuffer.data());
+    std::string name(nameBuffer.data(), length);
+
+    // members of uniform blocks have no location
+    GLint location = glGetUniformLocation(ID, name.c_str());
+    if (location == -1)
+      continue;
+    m_uniformLocations[name] = location;
+
+    // arrays are reported as "name[0]", make "name" and every element
+    // reachable as well
+    size_t bracket = name.rfind("[0]");
+    if (bracket != std::string::npos && bracket + 3 == name.size()) {
+      std::string base = name.substr(0, bracket);
+      m_uniformLocations[base] = location;
+      for (GLint element = 1; element < size; ++element) {
+        std::string elementName = base + "[" + std::to_string(element) + "]";
+        m_uniformLocations[elementName] =
+            glGetUniformLocation(ID, elementName.c_str());
+      }
+    }
+  }
+
+  for (int i = 0; i < kMaxMaterialTextures; ++i) {
+    std::string number = std::to_string(i + 1);
+    m_material.diffuse[i] = getUniform("material.texture_diffuse" + number);
+    m_material.specular[i] = getUniform("material.texture_specular" + number);
+  }
+  m_material.shininess = getUniform("material.shininess");
+  m_material.pointConstant = getUniform("pointLight.constant");
+  m_material.pointLinear = getUniform("pointLight.linear");
+  m_material.pointQuadratic = getUniform("pointLight.quadratic");
+
+  m_vertexDecode.positionOffset = getUniform("positionOffset");
+  m_vertexDecode.positionScale = getUniform("positionScale");
+  m_vertexDecode.octNormals = getUniform("octNormals");
+
+  m_transform.model = getUniform("model");
+  m_transform.inverse = getUniform("inverse");
+
+  // resolve the whole table: handles handed out before (program relinked,
+  // or a new variant) and the ones added above
+  m_handleLocations.assign(m_root->m_handleNames.size(), -1);
+  for (size_t i = 0; i < m_handleLocations.size(); ++i)
+    resolveHandle(i);
+}
+
+void Shader::resolveHandle(size_t index) {
+  if (m_handleLocations.size() <= index)
+    m_handleLocations.resize(index + 1, -1);
+  auto it = m_uniformLocations.find(m_root->m_handleNames[index]);
+  m_handleLocations[index] =
+      it == m_uniformLocations.end() ? -1 : it->second;
+}
+
+UniformHandle Shader::getUniform(const std::string &name) {
+  if (m_root != this)
+    return m_root->getUniform(name);
+
+  UniformHandle handle;
+  for (size_t i = 0; i < m_handleNames.size(); ++i) {
+    if (m_handleNames[i] == name) {
+      handle.index = (int)i;
+      return handle;
+    }
+  }
+
+  m_handleNames.push_back(name);
+  handle.index = (int)m_handleNames.size() - 1;
+  // variants share the handle table, see variant()
+  forEachVariant([&](Shader &shader) { shader.resolveHandle(handle.index); });
+  return handle;
 }
 
-void Shader::use() const { glUseProgram(ID); }
+GLint Shader::findUniform(const std::string &name) const {
+  ++s_lookupCount;
+  auto it = m_uniformLocations.find(name);
+  return it == m_uniformLocations.end() ? -1 : it->second;
+}
+
+void Shader::setBool(const std::string &name, bool value) const {
+  setInt(name, (int)value);
+}
 
 void Shader::setFloat(const std::string &name, float value) const {
-  GLint location = glGetUniformLocation(ID, name.c_str());
+  GLint location = findUniform(name);
   if (location == -1) {
 #ifdef RELEASE
     std::cout << "Uniform float: " << name << " cant find" << std::endl;
@@ -215,7 +723,7 @@ void Shader::setFloat(const std::string &name, float value) const {
 }
 
 void Shader::setInt(const std::string &name, int value) const {
-  GLint location = glGetUniformLocation(ID, name.c_str());
+  GLint location = findUniform(name);
   if (location == -1) {
 #ifdef RELEASE
     std::cout << "Uniform int: " << name << " cant find" << std::endl;
@@ -226,7 +734,7 @@ void Shader::setInt(const std::string &name, int value) const {
 }
 
 void Shader::setMat4(const std::string &name, glm::mat4 value) const {
-  GLint location = glGetUniformLocation(ID, name.c_str());
+  GLint location = findUniform(name);
   if (location == -1) {
 #ifdef RELEASE
     std::cout << "Uniform mat4: " << name << " cant find." << std::endl;
@@ -237,7 +745,7 @@ void Shader::setMat4(const std::string &name, glm::mat4 value) const {
 }
 
 void Shader::setMat3(const std::string &name, glm::mat3 value) const {
-  GLint location = glGetUniformLocation(ID, name.c_str());
+  GLint location = findUniform(name);
   if (location == -1) {
 #ifdef RELEASE
     std::cout << "Uniform mat3: " << name << " cant find." << std::endl;
@@ -248,7 +756,7 @@ void Shader::setMat3(const std::string &name, glm::mat3 value) const {
 }
 
 void Shader::setVec3(const std::string &name, glm::vec3 value) const {
-  GLint location = glGetUniformLocation(ID, name.c_str());
+  GLint location = findUniform(name);
   if (location == -1) {
 #ifdef RELEASE
     std::cout << "Uniform vec3: " << name << " cant find." << std::endl;
@@ -257,3 +765,39 @@ void Shader::setVec3(const std::string &name, glm::vec3 value) const {
   }
   glUniform3f(location, value.x, value.y, value.z);
 }
+
+// Handle setters: an unresolved handle maps to location -1, which GL ignores.
+void Shader::setBool(UniformHandle handle, bool value) const {
+  glUniform1i(handleLocation(handle), (int)value);
+}
+
+void Shader::setFloat(UniformHandle handle, float value) const {
+  glUniform1f(handleLocation(handle), value);
+}
+
+void Shader::setInt(UniformHandle handle, int value) const {
+  glUniform1i(handleLocation(handle), value);
+}
+
+void Shader::setMat4(UniformHandle handle, const glm::mat4 &value) const {
+  glUniformMatrix4fv(handleLocation(handle), 1, GL_FALSE,
+                     glm::value_ptr(value));
+}
+
+void Shader::setMat3(UniformHandle handle, const glm::mat3 &value) const {
+  glUniformMatrix3fv(handleLocation(handle), 1, GL_FALSE,
+                     glm::value_ptr(value));
+}
+
+void Shader::setVec3(UniformHandle handle, const glm::vec3 &value) const {
+  glUniform3f(handleLocation(handle), value.x, value.y, value.z);
+}
+
+void Shader::setVec4(UniformHandle handle, const glm::vec4 &value) const {
+  glUniform4f(handleLocation(handle), value.x, value.y, value.z, value.w);
+}
+
+void Shader::setVec4(UniformHandle handle, const glm::vec4 *values,
+                     int count) const {
+  glUniform4fv(handleLocation(handle), count, glm::value_ptr(values[0]));
+}
@@ -5,28 +5,265 @@
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/mat4x4.hpp"
 
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+// Index into the handle table of the Shader that resolved it. Resolve once
+// with Shader::getUniform and reuse it every frame: setting a uniform through
+// a handle is a vector index, no hashing and no GL query.
+struct UniformHandle {
+  int index = -1;
+
+  bool isValid() const { return index >= 0; }
+};
+
+class ShaderBatch;
+
+// NAME VALUE pairs #defined at the top of every stage of a permutation
+using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
 
 class Shader {
 
 public:
+  static const int kMaxMaterialTextures = 4;
+  // source files of a named shader, see stagePath
+  enum { kVertexStage, kFragmentStage, kGeometryStage, kStageCount };
+
+  // Handles Mesh::Draw needs on every draw call, resolved at link time
+  struct MaterialUniforms {
+    UniformHandle diffuse[kMaxMaterialTextures];
+    UniformHandle specular[kMaxMaterialTextures];
+    UniformHandle shininess;
+    UniformHandle pointConstant;
+    UniformHandle pointLinear;
+    UniformHandle pointQuadratic;
+  };
+
+  // Object transform set by Model::Draw with a scene graph: the model
+  // matrix and the view space normal matrix
+  struct TransformUniforms {
+    UniformHandle model;
+    UniformHandle inverse;
+  };
+
+  // Layout of the mesh being drawn, see Mesh::setVertexDecode. Shaders that
+  // do not declare them get invalid handles and ignore the calls.
+  struct VertexDecodeUniforms {
+    UniformHandle positionOffset;
+    UniformHandle positionScale;
+    UniformHandle octNormals;
+  };
+
   // program ID
   unsigned int ID;
 
   Shader(const char *vertexShaderPath, const char *fragmentShaderPath);
-  Shader(const char *shaderName);
+  // Loads <directory>/<name>/{vertex.vs,fragment.fs,geometry.gs}. The linked
+  // program is kept in <name>/program.programcache and loaded with
+  // glProgramBinary while the sources and the driver stay the same.
+  // With a batch only the compile and link are submitted, the program is
+  // usable after batch->finish().
+  //
+  // Sources are preprocessed: #include "path" inserts path (relative to
+  // the shader directory, each file once per stage) and defines are
+  // placed right after #version. "#pragma transform_feedback a b ..."
+  // captures the outputs a, b, ... interleaved; such programs may have
+  // no fragment stage.
+  Shader(const char *shaderName, ShaderBatch *batch = nullptr);
+  Shader(const char *shaderName, const ShaderDefines &defines,
+         ShaderBatch *batch = nullptr);
+
+  Shader(const Shader &) = delete;
+  Shader &operator=(const Shader &) = delete;
+
+  // The permutation with defines added to this shader's (or replacing
+  // them), compiled on first use. Variants, also those asked of a
+  // variant, are kept by the root shader and share its handle table: a
+  // handle from any of them is valid on all. Block bindings are copied
+  // at creation; other program state, like uniform values, is per
+  // variant (see forEachVariant).
+  Shader &variant(const ShaderDefines &defines);
+  // This shader and every variant built so far
+  template <class Function> void forEachVariant(Function function) {
+    function(*this);
+    for (auto &variant : m_variants)
+      function(*variant.second);
+  }
   // use activate the program
   void use() const;
 
+  // Binds a uniform block, kept to be bound again after a reload
+  void bindUniformBlock(const std::string &blockName, GLuint bindingPoint);
+
+  // Hot reload of shaders built from a name and of their variants, see
+  // ShaderWatcher. Submits the current sources into new programs without
+  // waiting for them.
+  bool beginReload();
+  bool isReloading() const;
+  // True once finishReload() will not wait for the driver
+  bool isReloadReady() const;
+  // Swaps the new program in if it linked, else keeps the old one and
+  // returns false. Handles stay valid, block bindings are restored.
+  bool finishReload();
+
+  const std::string &getName() const { return m_name; }
+  // Root of the named shaders, "shader/" (next to the binary) by default
+  static void setDirectory(const std::string &directory) {
+    s_directory = directory;
+  }
+  static const std::string &getDirectory() { return s_directory; }
+  // File of one stage of a named shader
+  std::string stagePath(int stage) const;
+  // Files pulled in by #include, as of the last build
+  const std::vector<std::string> &getIncludes() const { return m_includes; }
+
+  UniformHandle getUniform(const std::string &name);
+  const MaterialUniforms &getMaterialUniforms() const { return m_material; }
+  const VertexDecodeUniforms &getVertexDecodeUniforms() const {
+    return m_vertexDecode;
+  }
+  const TransformUniforms &getTransformUniforms() const {
+    return m_transform;
+  }
+
   void setBool(const std::string &name, bool value) const;
   void setFloat(const std::string &name, float value) const;
   void setInt(const std::string &name, int value) const;
   void setMat4(const std::string &name, glm::mat4 value) const;
   void setMat3(const std::string &name, glm::mat3 value) const;
   void setVec3(const std::string &name, glm::vec3 value) const;
+
+  void setBool(UniformHandle handle, bool value) const;
+  void setFloat(UniformHandle handle, float value) const;
+  void setInt(UniformHandle handle, int value) const;
+  void setMat4(UniformHandle handle, const glm::mat4 &value) const;
+  void setMat3(UniformHandle handle, const glm::mat3 &value) const;
+  void setVec3(UniformHandle handle, const glm::vec3 &value) const;
+  void setVec4(UniformHandle handle, const glm::vec4 &value) const;
+  // count elements of a vec4 array from the handle of its name
+  void setVec4(UniformHandle handle, const glm::vec4 *values,
+               int count) const;
+
+  // Number of name based uniform lookups since the last reset, i.e. the
+  // calls that still hash a std::string on the hot path.
+  static unsigned int getLookupCount() { return s_lookupCount; }
+  static void resetLookupCount() { s_lookupCount = 0; }
+
+  // Program binary cache, see Shader(const char *). On by default, does
+  // nothing without GL_ARB_get_program_binary.
+  static void setProgramCacheEnabled(bool enabled) {
+    s_programCacheEnabled = enabled;
+  }
+  // Programs built by Shader(const char *) / loaded from the cache
+  static unsigned int getProgramCount() { return s_programCount; }
+  static unsigned int getProgramCacheHits() { return s_programCacheHits; }
+
+private:
+  friend class ShaderBatch;
+
+  // empty for shaders built from two paths
+  std::string m_name;
+  ShaderDefines m_defines;
+  std::vector<std::string> m_includes;
+  // from #pragma transform_feedback, as of the last build
+  std::vector<std::string> m_feedbackVaryings;
+  // by definesKey() of the merged defines, only filled on the root
+  std::unordered_map<std::string, std::unique_ptr<Shader>> m_variants;
+  // shader whose variant this is, this for a root
+  Shader *m_root = this;
+  std::vector<std::pair<std::string, GLuint>> m_blockBindings;
+
+  // name -> location of every active uniform, filled after linking
+  std::unordered_map<std::string, GLint> m_uniformLocations;
+
+  // handle table, m_handleLocations[handle.index]; the names are kept
+  // by the root only
+  std::vector<std::string> m_handleNames;
+  std::vector<GLint> m_handleLocations;
+
+  MaterialUniforms m_material;
+  VertexDecodeUniforms m_vertexDecode;
+  TransformUniforms m_transform;
+
+  // stages submitted but not checked yet, see ShaderBatch
+  std::vector<GLuint> m_pendingStages;
+  std::string m_pendingCachePath;
+  uint64_t m_pendingCacheKey = 0;
+
+  // program being built by beginReload()
+  GLuint m_reloadProgram = 0;
+  std::vector<GLuint> m_reloadStages;
+  uint64_t m_reloadCacheKey = 0;
+
+  static unsigned int s_lookupCount;
+  static bool s_programCacheEnabled;
+  static unsigned int s_programCount;
+  static unsigned int s_programCacheHits;
+  static std::string s_directory;
+
+  static bool programCacheSupported();
+  static uint64_t programCacheKey(const std::string *sources, size_t count);
+  bool loadProgramBinary(const std::string &path, uint64_t key);
+  void saveProgramBinary(const std::string &path, uint64_t key) const;
+
+  // a variant of root, built with its handle table
+  Shader(Shader &root, const ShaderDefines &defines);
+  void build(ShaderBatch *batch);
+
+  std::string cachePath() const;
+  bool readSources(std::string *code);
+  bool preprocess(const std::string &path, int sourceNumber,
+                  std::string &out, std::vector<std::string> &included) const;
+  static std::string definesKey(const ShaderDefines &defines);
+  bool swapReloadedProgram();
+  void applyBlockBindings() const;
+  static GLuint submitProgram(const std::string *code, bool retrievable,
+                              const std::vector<std::string> &varyings,
+                              std::vector<GLuint> &stages);
+  // Logs compile / link errors and deletes the stages
+  static bool checkProgram(GLuint program, std::vector<GLuint> &stages);
+  void finishBuild();
+  void introspectUniforms();
+  void resolveHandle(size_t index);
+  GLint findUniform(const std::string &name) const;
+  GLint handleLocation(UniformHandle handle) const {
+    return (size_t)handle.index < m_handleLocations.size()
+               ? m_handleLocations[handle.index]
+               : -1;
+  }
+};
+
+// Builds a set of programs together. Shaders constructed with the batch
+// only submit their compiles and links; finish() waits for all of them and
+// only then checks their status, so no query stalls on one program while
+// the driver could be compiling the others. With
+// GL_KHR_parallel_shader_compile the driver compiles on its own threads
+// and finish() polls GL_COMPLETION_STATUS_KHR.
+//
+// The shaders must stay in place until finish() returns.
+class ShaderBatch {
+public:
+  ShaderBatch();
+  // finishes what is still pending
+  ~ShaderBatch();
+
+  ShaderBatch(const ShaderBatch &) = delete;
+  ShaderBatch &operator=(const ShaderBatch &) = delete;
+
+  void finish();
+  bool isParallel() const { return m_Parallel; }
+
+private:
+  friend class Shader;
+
+  bool m_Parallel;
+  std::vector<Shader *> m_Pending;
 };
 
 #endif // SHADER_H
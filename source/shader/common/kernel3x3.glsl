@@ -0,0 +1,28 @@
+// 3x3 convolution of the post process shaders. The including shader
+// declares TexCoords and screenTexture before the #include.
+
+const float offset = 1.0 / 300.0;
+
+vec3 Convolve3x3(float kernel[9]){
+  vec2 offsets[9] = vec2[](
+  vec2(-offset, offset),
+  vec2(0.0f, offset),
+  vec2(offset, offset),
+  vec2(-offset, 0.0f),
+  vec2(0.0f, 0.0f),
+  vec2(offset, 0.0f),
+  vec2(-offset, -offset),
+  vec2(0.0f, -offset),
+  vec2(-offset, offset)
+  );
+
+  vec3 sampleTex[9];
+  for(int i = 0; i < 9; ++i){
+    sampleTex[i] = vec3(texture(screenTexture, TexCoords + offsets[i]));
+  }
+  vec3 col = vec3(0.0);
+  for(int i = 0; i < 9; ++i){
+    col += sampleTex[i] * kernel[i];
+  }
+  return col;
+}
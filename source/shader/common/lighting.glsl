@@ -1,5 +1,20 @@
-#version 330 core
-
+// Lights and material of the lit object shaders. The including fragment
+// shader declares FragPos (view space) and UVCord before the #include.
+//
+// Permutations, see Shader::variant:
+//   NUM_POINT_LIGHTS  0 or 1, default 1
+//   HAS_SPECULAR_MAP  0 takes the specular color from the diffuse texture,
+//                     default 1
+
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 1
+#endif
+#ifndef HAS_SPECULAR_MAP
+#define HAS_SPECULAR_MAP 1
+#endif
+#if NUM_POINT_LIGHTS > 1
+#error only one point light is supported
+#endif
 
 struct DirLight{
   vec3 direction;
@@ -32,40 +47,28 @@ struct FlashLight{
   float outerCutOff;
 };
 
+
 struct Material{
   sampler2D texture_diffuse1;
+#if HAS_SPECULAR_MAP
   sampler2D texture_specular1;
+#endif
   float shininess;
 };
 
-out vec4 FragColor;
-
+#if NUM_POINT_LIGHTS > 0
 uniform PointLight pointLight;
+#endif
 uniform DirLight dirLight;
 uniform FlashLight flashLight;
 uniform Material material;
 
-in vec3 Normal;
-in vec3 FragPos;
-in vec2 UVCord;
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal,vec3 viewDir);
-vec3 CalcFlashLight(FlashLight light, vec3 normal, vec3 viewDir);
-
-void main(){
-
-  vec3 viewFromFragToCamera = normalize(-FragPos);
-  vec3 normal = normalize(Normal);
-  vec3 result = vec3(0.0);
-   
-  result += CalcDirLight(dirLight ,normal, viewFromFragToCamera);
-  
-  result += CalcPointLight(pointLight, normal, viewFromFragToCamera);
-
-  result += CalcFlashLight(flashLight, normal, viewFromFragToCamera);
-
-  FragColor = vec4(result, 1.0);
+vec3 SampleSpecular(){
+#if HAS_SPECULAR_MAP
+  return vec3(texture(material.texture_specular1, UVCord));
+#else
+  return vec3(texture(material.texture_diffuse1, UVCord));
+#endif
 }
 
 vec3 CalcPointLight(PointLight light, vec3 normal,vec3 viewDir){
@@ -86,7 +89,7 @@ vec3 CalcPointLight(PointLight light, vec3 normal,vec3 viewDir){
   //combine
   vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, UVCord));
   vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, UVCord));
-  vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, UVCord));
+  vec3 specular = light.specular * spec * SampleSpecular();
 
   ambient *= attenuation;
   diffuse *= attenuation;
@@ -109,7 +112,7 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir) {
   //combine results
   vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, UVCord)); 
   vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, UVCord));
-  vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, UVCord));
+  vec3 specular = light.specular * spec * SampleSpecular();
 
   return (ambient + diffuse + specular);
 }
@@ -140,7 +143,7 @@ vec3 CalcFlashLight(FlashLight light, vec3 normal, vec3 viewDir){
     //combine
     diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, UVCord));
     diffuse *= intensity;
-    specular = light.specular * spec * vec3(texture(material.texture_specular1, UVCord));
+    specular = light.specular * spec * SampleSpecular();
     specular *= intensity;
     
   } else {
@@ -150,6 +153,3 @@ vec3 CalcFlashLight(FlashLight light, vec3 normal, vec3 viewDir){
   
   return (diffuse + specular);
 }
-
-
-
@@ -10,11 +10,12 @@ layout(std140) uniform Matrices{
   mat4 view;
 };
 
-uniform mat4 model;
+// per draw, instanced and selected by base instance, see BatchRenderer
+layout (location = 3) in mat4 aModel;
 
 out vec2 TexCoord;
 
 void main() {
   TexCoord = aTexCoord;
-  gl_Position = projection * view * model * vec4(aPos, 1.0);
+  gl_Position = projection * view * aModel * vec4(aPos, 1.0);
 }
@@ -0,0 +1,24 @@
+#version 330 core
+// Drops the instances the vertex stage did not keep, the survivors are
+// captured as InstanceTRS records
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+#pragma transform_feedback positionScale rotation
+
+in vec4 cullPositionScale[];
+in vec4 cullRotation[];
+flat in int keep[];
+
+out vec4 positionScale;
+out vec4 rotation;
+
+void main()
+{
+  if (keep[0] == 0)
+    return;
+  positionScale = cullPositionScale[0];
+  rotation = cullRotation[0];
+  EmitVertex();
+  EndPrimitive();
+}
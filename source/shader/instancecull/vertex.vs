@@ -0,0 +1,42 @@
+#version 330 core
+// InstanceTRS, see transforms.h
+layout (location = 0) in vec4 instancePositionScale;
+layout (location = 1) in vec4 instanceRotation;
+
+// Frustum::fromMatrix(projection * view), computed once per frame
+uniform vec4 planes[6];
+// bounding radius of the mesh around its origin
+uniform float meshRadius;
+// level of detail like Mesh::selectLod: the simplification error of the
+// levels, their count and the one this pass keeps
+uniform vec4 lodErrors;
+uniform int lodCount;
+uniform int lod;
+uniform vec3 eye;
+uniform float pixelsPerUnit;
+uniform float maxErrorPixels;
+
+out vec4 cullPositionScale;
+out vec4 cullRotation;
+flat out int keep;
+
+void main()
+{
+  cullPositionScale = instancePositionScale;
+  cullRotation = instanceRotation;
+  vec3 center = instancePositionScale.xyz;
+  float radius = meshRadius * instancePositionScale.w;
+
+  bool visible = true;
+  for (int i = 0; i < 6; ++i)
+    visible = visible && dot(planes[i].xyz, center) + planes[i].w >= -radius;
+
+  float distance = max(length(center - eye) - radius, 0.1);
+  float pixels = radius / meshRadius * pixelsPerUnit / distance;
+  int level = 0;
+  while (level + 1 < lodCount &&
+         lodErrors[level + 1] * pixels <= maxErrorPixels)
+    ++level;
+
+  keep = visible && level == lod ? 1 : 0;
+}
@@ -2,23 +2,60 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aUVCord;
+#ifdef INSTANCED
+// InstanceTRS, see transforms.h
+layout (location = 3) in vec4 instancePositionScale;
+layout (location = 4) in vec4 instanceRotation;
+#endif
 
 layout(std140) uniform Matrices{
   mat4 projection;
   mat4 view;
 };
 
+#ifndef INSTANCED
 uniform mat4 model;
 uniform mat3 inverse;
+#endif
+
+// packed meshes, see vertexformat.h
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionOffset;
+uniform bool octNormals;
 
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 UVCord;
 
+vec3 octDecode(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+  return normalize(n);
+}
+
+// v turned by the unit quaternion q
+vec3 quatRotate(vec4 q, vec3 v)
+{
+  return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
 void main()
 {
+  vec3 position = positionOffset + positionScale * aPos;
+  vec3 normal = octNormals ? octDecode(aNormal.xy) : aNormal;
   UVCord = aUVCord;
-  Normal = inverse * aNormal;
-  FragPos = vec3(view * model * vec4(aPos, 1.0));
-  gl_Position = projection * view * model * vec4(aPos, 1.0f);
+#ifdef INSTANCED
+  // the scale is uniform, the rotation alone turns the normal
+  Normal = mat3(view) * quatRotate(instanceRotation, normal);
+  vec3 world = instancePositionScale.xyz +
+               instancePositionScale.w * quatRotate(instanceRotation, position);
+  FragPos = vec3(view * vec4(world, 1.0));
+  gl_Position = projection * vec4(FragPos, 1.0f);
+#else
+  Normal = inverse * normal;
+  FragPos = vec3(view * model * vec4(position, 1.0));
+  gl_Position = projection * view * model * vec4(position, 1.0f);
+#endif
 }
@@ -0,0 +1,150 @@
+#include "shaderwatcher.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// editors save in several steps (truncate + write, write + rename), the
+// reload waits for the directory to be quiet this long
+const std::chrono::milliseconds kSettleTime(20);
+
+std::string normalPath(const std::string &path) {
+  return std::filesystem::path(path).lexically_normal().string();
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+ShaderWatcher::ShaderWatcher() {
+#ifdef __linux__
+  m_Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_Fd < 0)
+    std::cout << "SHADER WATCHER: INOTIFY UNAVAILABLE: "
+              << std::strerror(errno) << std::endl;
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher() {
+#ifdef __linux__
+  if (m_Fd >= 0)
+    close(m_Fd);
+#endif
+}
+
+void ShaderWatcher::watch(Shader &shader) {
+  if (m_Fd < 0 || shader.getName().empty())
+    return;
+  m_Entries.push_back({&shader, {}, false, {}, {}, {}});
+  watchFiles(m_Entries.back());
+}
+
+void ShaderWatcher::watchFiles(Entry &entry) {
+  const Shader &shader = *entry.shader;
+  entry.files.clear();
+  for (int stage = 0; stage < Shader::kStageCount; ++stage)
+    entry.files.push_back(normalPath(shader.stagePath(stage)));
+  for (const std::string &include : shader.getIncludes())
+    entry.files.push_back(normalPath(include));
+
+#ifdef __linux__
+  for (const std::string &file : entry.files) {
+    std::string directory =
+        std::filesystem::path(file).parent_path().string();
+    // a directory watched already returns its watch again; replaced
+    // files (IN_MOVED_TO) are how most editors save
+    int watch = inotify_add_watch(m_Fd, directory.c_str(),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch < 0) {
+      std::cout << "SHADER WATCHER: CAN NOT WATCH " << directory << ": "
+                << std::strerror(errno) << std::endl;
+      continue;
+    }
+    m_Directories[watch] = directory;
+  }
+#endif
+}
+
+void ShaderWatcher::readEvents() {
+#ifdef __linux__
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    ssize_t length = read(m_Fd, buffer, sizeof(buffer));
+    if (length <= 0)
+      return;
+
+    Clock::time_point now = Clock::now();
+    for (char *cursor = buffer; cursor < buffer + length;) {
+      const inotify_event *event = (const inotify_event *)cursor;
+      cursor += sizeof(inotify_event) + event->len;
+      auto directory = m_Directories.find(event->wd);
+      if (event->len == 0 || directory == m_Directories.end())
+        continue;
+      std::string path = normalPath(directory->second + "/" + event->name);
+
+      for (Entry &entry : m_Entries) {
+        if (std::find(entry.files.begin(), entry.files.end(), path) ==
+            entry.files.end())
+          continue;
+        if (!entry.dirty)
+          entry.changed = now;
+        entry.dirty = true;
+        entry.lastEvent = now;
+      }
+    }
+  }
+#endif
+}
+
+void ShaderWatcher::poll() {
+  if (m_Fd < 0)
+    return;
+  readEvents();
+
+  Clock::time_point now = Clock::now();
+  for (Entry &entry : m_Entries) {
+    Shader &shader = *entry.shader;
+
+    if (shader.isReloading()) {
+      // without parallel compile this is where the frame pays for it
+      if (!shader.isReloadReady())
+        continue;
+      bool swapped = shader.finishReload();
+      // the edit may have added an #include
+      watchFiles(entry);
+      if (swapped) {
+        if (m_Callback)
+          m_Callback(shader);
+        std::cout << "Shader reload: " << shader.getName() << ", "
+                  << millisecondsSince(entry.reloadFrom)
+                  << " ms after the change" << std::endl;
+      } else {
+        std::cout << "Shader reload failed: " << shader.getName()
+                  << ", keeping the previous program" << std::endl;
+      }
+      continue;
+    }
+
+    if (entry.dirty && now - entry.lastEvent >= kSettleTime) {
+      entry.dirty = false;
+      entry.reloadFrom = entry.changed;
+      if (!shader.beginReload())
+        std::cout << "Shader reload failed: " << shader.getName()
+                  << ", sources unreadable" << std::endl;
+    }
+  }
+}
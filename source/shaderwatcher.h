@@ -0,0 +1,67 @@
+#ifndef SHADERWATCHER_H
+#define SHADERWATCHER_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Shader;
+
+// Hot reload of named shaders. An inotify watch on the directories of every
+// shader's stage and #include files marks it dirty when one of them is
+// written or replaced; poll() then rebuilds it on the render thread with
+// Shader::beginReload and swaps the program in once the driver is done,
+// only if it linked. With parallel shader compile no frame waits for the
+// compiler. Without inotify (not Linux) the watcher stays inactive.
+class ShaderWatcher {
+public:
+  using ReloadCallback = std::function<void(Shader &)>;
+
+  ShaderWatcher();
+  ~ShaderWatcher();
+
+  ShaderWatcher(const ShaderWatcher &) = delete;
+  ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+  // shader must outlive the watcher
+  void watch(Shader &shader);
+  // Runs after a program was swapped in, for uniform values set once at
+  // startup (samplers, constants); block bindings are restored already.
+  void setReloadCallback(ReloadCallback callback) {
+    m_Callback = std::move(callback);
+  }
+
+  // Render thread, once per frame
+  void poll();
+
+  bool isActive() const { return m_Fd >= 0; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    Shader *shader;
+    // stage and include files, lexically normal
+    std::vector<std::string> files;
+    bool dirty;
+    // first change not yet reloaded, the reported latency starts here
+    Clock::time_point changed;
+    Clock::time_point lastEvent;
+    // change the running reload was started for
+    Clock::time_point reloadFrom;
+  };
+
+  int m_Fd = -1;
+  std::vector<Entry> m_Entries;
+  // inotify watch -> directory
+  std::unordered_map<int, std::string> m_Directories;
+  ReloadCallback m_Callback;
+
+  void readEvents();
+  // files of the shader's last build, watching new directories
+  void watchFiles(Entry &entry);
+};
+
+#endif // !SHADERWATCHER_H
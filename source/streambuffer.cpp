@@ -0,0 +1,125 @@
+#include "streambuffer.h"
+
+#include <iostream>
+
+namespace {
+
+GLsizeiptr alignUp(GLsizeiptr value, GLint alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+StreamBuffer::StreamBuffer(GLenum target, GLsizeiptr regionBytes,
+                           bool persistent)
+    : m_Target(target),
+      m_Persistent(persistent && GLEW_ARB_buffer_storage) {
+  // attributes only need 4 bytes, 16 keeps vec4 / mat rows aligned
+  m_Alignment = 16;
+  if (target == GL_UNIFORM_BUFFER) {
+    GLint uboAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlignment);
+    if (uboAlignment > m_Alignment)
+      m_Alignment = uboAlignment;
+  }
+  m_RegionBytes = alignUp(regionBytes, m_Alignment);
+
+  glGenBuffers(1, &m_Buffer);
+  glBindBuffer(m_Target, m_Buffer);
+  if (m_Persistent) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr totalBytes = m_RegionBytes * kRegionCount;
+    glBufferStorage(m_Target, totalBytes, nullptr, flags);
+    m_Mapped = (char *)glMapBufferRange(m_Target, 0, totalBytes, flags);
+    if (!m_Mapped) {
+      std::cout << "STREAM BUFFER: PERSISTENT MAP FAILED, FALLING BACK"
+                << std::endl;
+      glDeleteBuffers(1, &m_Buffer);
+      glGenBuffers(1, &m_Buffer);
+      glBindBuffer(m_Target, m_Buffer);
+      m_Persistent = false;
+    }
+  }
+  if (!m_Persistent)
+    glBufferData(m_Target, m_RegionBytes, nullptr, GL_STREAM_DRAW);
+  glBindBuffer(m_Target, 0);
+}
+
+StreamBuffer::~StreamBuffer() { destroy(); }
+
+void StreamBuffer::destroy() {
+  if (!m_Buffer)
+    return;
+  for (GLsync &fence : m_Fences) {
+    if (fence)
+      glDeleteSync(fence);
+    fence = nullptr;
+  }
+  if (m_Mapped) {
+    glBindBuffer(m_Target, m_Buffer);
+    glUnmapBuffer(m_Target);
+    glBindBuffer(m_Target, 0);
+  }
+  glDeleteBuffers(1, &m_Buffer);
+  m_Buffer = 0;
+  m_Mapped = nullptr;
+}
+
+void StreamBuffer::begin() {
+  m_Used = 0;
+
+  if (!m_Persistent) {
+    // orphan: the driver hands out fresh storage if the old one is in use
+    glBindBuffer(m_Target, m_Buffer);
+    glBufferData(m_Target, m_RegionBytes, nullptr, GL_STREAM_DRAW);
+    m_Mapped = (char *)glMapBufferRange(
+        m_Target, 0, m_RegionBytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(m_Target, 0);
+    m_RegionOffset = 0;
+    return;
+  }
+
+  m_Region = (m_Region + 1) % kRegionCount;
+  m_RegionOffset = m_Region * m_RegionBytes;
+
+  GLsync &fence = m_Fences[m_Region];
+  if (!fence)
+    return;
+  GLenum status = glClientWaitSync(fence, 0, 0);
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+    ++m_WaitCount;
+    do {
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+  }
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+void *StreamBuffer::allocate(GLsizeiptr bytes, GLintptr &offset) {
+  GLsizeiptr aligned = alignUp(bytes, m_Alignment);
+  if (!m_Mapped || m_Used + aligned > m_RegionBytes) {
+    std::cout << "STREAM BUFFER: REGION FULL" << std::endl;
+    return nullptr;
+  }
+  offset = m_RegionOffset + m_Used;
+  m_Used += aligned;
+  return m_Mapped + offset;
+}
+
+void StreamBuffer::commit() {
+  if (m_Persistent || !m_Mapped)
+    return;
+  glBindBuffer(m_Target, m_Buffer);
+  glUnmapBuffer(m_Target);
+  glBindBuffer(m_Target, 0);
+  m_Mapped = nullptr;
+}
+
+void StreamBuffer::end() {
+  if (m_Persistent)
+    m_Fences[m_Region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,59 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include "glew/glew.h"
+
+// Ring of kRegionCount regions for data rewritten every frame (UBOs, instance
+// attributes). With GL_ARB_buffer_storage the whole ring is mapped once,
+// persistent and coherent, and a fence per region keeps the CPU from
+// overwriting data the GPU still reads. Without it every frame orphans the
+// buffer and maps it again, leaving the renaming to the driver.
+//
+// Per frame:
+//   begin() -> allocate()... -> commit() -> draws -> end()
+class StreamBuffer {
+public:
+  static const int kRegionCount = 3;
+
+  // regionBytes is the most that can be allocated between begin() and end()
+  StreamBuffer(GLenum target, GLsizeiptr regionBytes, bool persistent = true);
+  ~StreamBuffer();
+
+  StreamBuffer(const StreamBuffer &) = delete;
+  StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+  // Frees the GL objects, call while the context is still current.
+  void destroy();
+
+  // Waits for the GPU to release the next region and maps it if needed.
+  void begin();
+  // Returns write-only memory inside the current region, offset receives the
+  // buffer offset to bind or point attributes at. nullptr if the region is
+  // full.
+  void *allocate(GLsizeiptr bytes, GLintptr &offset);
+  // Makes the writes visible to GL. Draws may only follow a commit().
+  void commit();
+  // Fences the region once every draw reading from it has been issued.
+  void end();
+
+  GLuint getBuffer() const { return m_Buffer; }
+  bool isPersistent() const { return m_Persistent; }
+  // Times begin() found its region still in use by the GPU
+  unsigned int getWaitCount() const { return m_WaitCount; }
+
+private:
+  GLenum m_Target;
+  GLuint m_Buffer = 0;
+  GLsizeiptr m_RegionBytes;
+  GLint m_Alignment = 1;
+  bool m_Persistent;
+
+  char *m_Mapped = nullptr;
+  GLsync m_Fences[kRegionCount] = {};
+  int m_Region = 0;
+  GLintptr m_RegionOffset = 0;
+  GLsizeiptr m_Used = 0;
+  unsigned int m_WaitCount = 0;
+};
+
+#endif // !STREAMBUFFER_H
@@ -1,16 +1,28 @@
 #include "system.h"
 #include "glfw/glfw3.h"
 
-System::System(const std::string &name, GLuint width, GLuint height)
-    : m_Time(glfwGetTime()), m_DeltaTime(0.0f), m_LastFrame(0.0f),
-      m_Width(width), m_Height(height), m_FbWidth(width), m_FbHight(height) {
-  m_Window = glfwCreateWindow(width, height, name.c_str(), NULL, NULL);
+System::System(const std::string &name, GLuint width, GLuint height,
+               bool headless)
+    : m_Window(NULL), m_IsHeadless(headless), m_Width(width),
+      m_Height(height), m_FbWidth(width), m_FbHight(height),
+      m_Time(headless ? 0.0f : glfwGetTime()), m_DeltaTime(0.0f),
+      m_LastFrame(0.0f), m_effectType(EffectType::NoEffect) {
+  if (headless)
+    m_Headless.create(3, 3);
+  else
+    m_Window = glfwCreateWindow(width, height, name.c_str(), NULL, NULL);
 }
 
-void System::update() {
-  m_Time = glfwGetTime();
+void System::update() { update(glfwGetTime()); }
+
+void System::update(float time) {
+  m_Time = time;
   m_DeltaTime = m_Time - m_LastFrame;
   m_LastFrame = m_Time;
 }
 
+bool System::isValid() const {
+  return m_IsHeadless ? m_Headless.isValid() : m_Window != NULL;
+}
+
 void System::setCamera(const Camera &camera) { m_Camera = camera; }
@@ -6,11 +6,14 @@
 #include "camera.h"
 #include "enums.h"
 #include "glfw/glfw3.h"
+#include "headless.h"
 
 class System {
 
 public:
   GLFWwindow *m_Window;
+  HeadlessContext m_Headless;
+  bool m_IsHeadless;
   GLuint m_Width, m_Height, m_FbWidth, m_FbHight;
   std::string m_Name;
 
@@ -23,8 +26,13 @@ public:
   EffectType m_effectType;
 
   void update();
+  // Fixed time step for headless runs, so every frame is reproducible.
+  void update(float time);
 
-  System(const std::string &name, GLuint width, GLuint height);
+  System(const std::string &name, GLuint width, GLuint height,
+         bool headless = false);
+
+  bool isValid() const;
 
   void setCamera(const Camera &camera);
 };
@@ -0,0 +1,177 @@
+// Offline texture converter: decodes JPG / PNG with stb_image, builds the
+// mip chain, block compresses every level and writes the CompressedTexture
+// file next to the source. Each level is decoded again and compared to its
+// reference image; the conversion fails when level 0 is below the PSNR
+// threshold. The smallest mips are a handful of busy blocks and score lower,
+// they are only reported.
+
+#include "blockcompress.h"
+#include "compressedtexture.h"
+#include "stb/stb_image.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct ConvertOptions {
+  bool autoFormat = true;
+  BlockFormat format = BlockFormat::BC1;
+  bool mips = true;
+  double minPsnr = 30.0;
+};
+
+const char *formatName(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::BC1:
+    return "BC1";
+  case BlockFormat::BC3:
+    return "BC3";
+  case BlockFormat::BC5:
+    return "BC5";
+  }
+  return "?";
+}
+
+// BC3 only when the image has alpha that is not fully opaque
+BlockFormat pickFormat(const uint8_t *rgba, size_t pixelCount, int channels) {
+  if (channels != 2 && channels != 4)
+    return BlockFormat::BC1;
+  for (size_t i = 0; i < pixelCount; ++i)
+    if (rgba[i * 4 + 3] != 255)
+      return BlockFormat::BC3;
+  return BlockFormat::BC1;
+}
+
+bool convert(const std::string &sourcePath, const ConvertOptions &options) {
+  int width = 0, height = 0, channels = 0;
+  stbi_set_flip_vertically_on_load(false);
+  uint8_t *pixels =
+      stbi_load(sourcePath.c_str(), &width, &height, &channels, 4);
+  if (!pixels) {
+    std::cout << sourcePath << ": " << stbi_failure_reason() << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> image(pixels, pixels + (size_t)width * height * 4);
+  stbi_image_free(pixels);
+
+  CompressedTexture texture;
+  texture.format = options.autoFormat
+                       ? pickFormat(image.data(), image.size() / 4, channels)
+                       : options.format;
+  texture.width = width;
+  texture.height = height;
+
+  double basePsnr = 0.0, worstPsnr = 99.0;
+  std::vector<uint8_t> decoded, next;
+  for (;;) {
+    size_t level = texture.levels.size();
+    int levelWidth = texture.levelWidth(level);
+    int levelHeight = texture.levelHeight(level);
+
+    std::vector<uint8_t> blocks(
+        compressedSize(texture.format, levelWidth, levelHeight));
+    compressImage(texture.format, image.data(), levelWidth, levelHeight,
+                  blocks.data());
+
+    decoded.resize(image.size());
+    decompressImage(texture.format, blocks.data(), levelWidth, levelHeight,
+                    decoded.data());
+    double levelPsnr = psnr(texture.format, image.data(), decoded.data(),
+                            (size_t)levelWidth * levelHeight);
+    worstPsnr = std::min(worstPsnr, levelPsnr);
+    if (level == 0)
+      basePsnr = levelPsnr;
+    texture.levels.push_back(std::move(blocks));
+
+    if (!options.mips || (levelWidth == 1 && levelHeight == 1))
+      break;
+    downsample(image.data(), levelWidth, levelHeight, next);
+    image.swap(next);
+  }
+
+  size_t compressedBytes = 0;
+  for (const std::vector<uint8_t> &level : texture.levels)
+    compressedBytes += level.size();
+  // what the uncompressed upload of the same chain costs
+  size_t rawBytes = (size_t)width * height * channels;
+  if (options.mips)
+    rawBytes = rawBytes * 4 / 3;
+
+  std::cout << std::fixed << std::setprecision(1) << sourcePath << ": "
+            << formatName(texture.format) << " " << width << "x" << height
+            << ", " << texture.levels.size() << " levels, "
+            << compressedBytes / 1024 << " KiB (" << rawBytes / 1024
+            << " KiB uncompressed), PSNR " << basePsnr << " dB (worst level "
+            << worstPsnr << " dB)" << std::endl;
+
+  if (basePsnr < options.minPsnr) {
+    std::cout << sourcePath << ": PSNR below " << options.minPsnr
+              << " dB, not written" << std::endl;
+    return false;
+  }
+
+  uint64_t sourceHash = CompressedTexture::hashSource(sourcePath);
+  std::string outputPath = CompressedTexture::pathFor(sourcePath);
+  if (!sourceHash || !texture.write(outputPath, sourceHash)) {
+    std::cout << outputPath << ": write failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool parseOptions(int argc, char **argv, ConvertOptions &options,
+                  std::vector<std::string> &inputs) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    bool hasValue = i + 1 < argc;
+
+    if (std::strcmp(arg, "--format") == 0 && hasValue) {
+      const char *name = argv[++i];
+      options.autoFormat = false;
+      if (std::strcmp(name, "auto") == 0)
+        options.autoFormat = true;
+      else if (std::strcmp(name, "bc1") == 0)
+        options.format = BlockFormat::BC1;
+      else if (std::strcmp(name, "bc3") == 0)
+        options.format = BlockFormat::BC3;
+      else if (std::strcmp(name, "bc5") == 0)
+        options.format = BlockFormat::BC5;
+      else
+        return false;
+    } else if (std::strcmp(arg, "--no-mips") == 0)
+      options.mips = false;
+    else if (std::strcmp(arg, "--min-psnr") == 0 && hasValue)
+      options.minPsnr = std::atof(argv[++i]);
+    else if (arg[0] != '-')
+      inputs.push_back(arg);
+    else
+      return false;
+  }
+  return !inputs.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  ConvertOptions options;
+  std::vector<std::string> inputs;
+  if (!parseOptions(argc, argv, options, inputs)) {
+    std::cout << "Usage: " << argv[0]
+              << " [--format auto|bc1|bc3|bc5] [--no-mips] [--min-psnr DB]"
+                 " image..."
+              << std::endl;
+    return 1;
+  }
+
+  bool ok = true;
+  for (const std::string &input : inputs)
+    ok = convert(input, options) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+#include "texturecache.h"
+
+#include <filesystem>
+
+TextureCache &TextureCache::get() {
+  static TextureCache cache;
+  return cache;
+}
+
+std::string TextureCache::makeKey(const std::string &path, bool flip,
+                                  bool gamma) {
+  std::error_code error;
+  std::filesystem::path canonical =
+      std::filesystem::weakly_canonical(path, error);
+  std::string key = error ? path : canonical.string();
+  key += flip ? "|flip" : "|noflip";
+  key += gamma ? "|srgb" : "|linear";
+  return key;
+}
+
+TextureCache::Status TextureCache::acquire(const std::string &key, GLuint &id,
+                                           bool canWait) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Entries.find(key);
+  if (it == m_Entries.end()) {
+    Entry &entry = m_Entries[key];
+    entry.refCount = 1;
+    ++m_Misses;
+    return Status::Reserved;
+  }
+
+  Entry &entry = it->second;
+  if (!entry.ready && !canWait)
+    return Status::Pending;
+
+  ++entry.refCount;
+  ++m_Hits;
+  if (!entry.ready) {
+    ++entry.pendingHits;
+    return Status::Pending;
+  }
+  m_BytesSaved += entry.bytes;
+  id = entry.id;
+  return Status::Ready;
+}
+
+void TextureCache::publish(const std::string &key, GLuint id, size_t bytes) {
+  std::vector<std::function<void(GLuint)>> waiting;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    Entry &entry = m_Entries[key];
+    entry.id = id;
+    entry.ready = true;
+    entry.bytes = bytes;
+    m_BytesSaved += bytes * entry.pendingHits;
+    entry.pendingHits = 0;
+    waiting.swap(entry.waiting);
+    m_Keys[id] = key;
+  }
+  for (std::function<void(GLuint)> &callback : waiting)
+    callback(id);
+}
+
+void TextureCache::whenReady(const std::string &key,
+                             std::function<void(GLuint)> callback) {
+  GLuint id;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    Entry &entry = m_Entries[key];
+    if (!entry.ready) {
+      entry.waiting.push_back(std::move(callback));
+      return;
+    }
+    id = entry.id;
+  }
+  callback(id);
+}
+
+bool TextureCache::release(GLuint id) {
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto key = m_Keys.find(id);
+    if (key != m_Keys.end()) {
+      auto entry = m_Entries.find(key->second);
+      if (--entry->second.refCount > 0)
+        return false;
+      m_Entries.erase(entry);
+      m_Keys.erase(key);
+    }
+  }
+  glDeleteTextures(1, &id);
+  return true;
+}
+
+void TextureCache::report(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  out << "Texture cache: " << m_Entries.size() << " textures, " << m_Hits
+      << " hits, " << m_Misses << " misses, " << m_BytesSaved / 1024
+      << " KiB GPU memory saved" << std::endl;
+}
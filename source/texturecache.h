@@ -0,0 +1,68 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include "glew/glew.h"
+
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Process wide, reference counted GL textures keyed by canonical path plus
+// the load flags, so every Model and loadCubemap share one upload per
+// image. acquire() is safe on any thread, everything that touches GL or
+// runs callbacks is GL thread only.
+class TextureCache {
+public:
+  enum class Status {
+    Ready,    // id is valid
+    Pending,  // another loader is decoding it, wait with whenReady()
+    Reserved, // the caller must load it and publish()
+  };
+
+  static TextureCache &get();
+
+  TextureCache(const TextureCache &) = delete;
+  TextureCache &operator=(const TextureCache &) = delete;
+
+  static std::string makeKey(const std::string &path, bool flip,
+                             bool gamma = false);
+
+  // Takes a reference on key unless Pending is returned while canWait is
+  // false; a caller that can not wait then loads a private copy.
+  Status acquire(const std::string &key, GLuint &id, bool canWait = true);
+  // Completes a Reserved entry and runs the callbacks waiting on it.
+  void publish(const std::string &key, GLuint id, size_t bytes);
+  // Runs callback now if key is ready, else when it is published.
+  void whenReady(const std::string &key, std::function<void(GLuint)> callback);
+  // Drops one reference, the texture is deleted with the last one. Ids the
+  // cache does not know are deleted right away. True if id was deleted.
+  bool release(GLuint id);
+
+  void report(std::ostream &out) const;
+
+private:
+  TextureCache() = default;
+
+  struct Entry {
+    GLuint id = 0;
+    bool ready = false;
+    unsigned int refCount = 0;
+    size_t bytes = 0;
+    // hits taken while pending, their savings are counted on publish
+    unsigned int pendingHits = 0;
+    std::vector<std::function<void(GLuint)>> waiting;
+  };
+
+  mutable std::mutex m_Mutex;
+  std::unordered_map<std::string, Entry> m_Entries;
+  std::unordered_map<GLuint, std::string> m_Keys;
+
+  unsigned int m_Hits = 0;
+  unsigned int m_Misses = 0;
+  size_t m_BytesSaved = 0;
+};
+
+#endif // !TEXTURECACHE_H
@@ -0,0 +1,247 @@
+#include "texturestreamer.h"
+#include "model.h"
+#include "renderstate.h"
+#include "utilities.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+TextureStreamer &TextureStreamer::get() {
+  static TextureStreamer streamer;
+  return streamer;
+}
+
+TextureStreamer::~TextureStreamer() { shutdown(); }
+
+void TextureStreamer::track(GLuint id, const std::string &path, bool flip,
+                            const CompressedTexture &texture) {
+  Entry &entry = m_Entries[id];
+  if (entry.id)
+    m_Resident -= std::accumulate(entry.levelBytes.begin() + entry.resident,
+                                  entry.levelBytes.end(), size_t(0));
+
+  entry = Entry{};
+  entry.id = id;
+  entry.serial = ++m_Serial;
+  entry.path = path;
+  entry.flip = flip;
+  entry.sourceHash = texture.sourceHash;
+  entry.width = texture.width;
+  entry.height = texture.height;
+  for (size_t level = 0; level < texture.levels.size(); ++level)
+    entry.levelBytes.push_back(compressedSize(texture.format,
+                                              texture.levelWidth(level),
+                                              texture.levelHeight(level)));
+
+  while (entry.tail + 1 < texture.levels.size() &&
+         texture.levels[entry.tail].empty())
+    ++entry.tail;
+  entry.resident = entry.tail;
+  entry.wanted = entry.levelBytes.size();
+  entry.lastNeeded = m_Frame;
+  m_Resident += std::accumulate(entry.levelBytes.begin() + entry.tail,
+                                entry.levelBytes.end(), size_t(0));
+}
+
+void TextureStreamer::forget(GLuint id) {
+  auto it = m_Entries.find(id);
+  if (it == m_Entries.end())
+    return;
+  const Entry &entry = it->second;
+  m_Resident -= std::accumulate(entry.levelBytes.begin() + entry.resident,
+                                entry.levelBytes.end(), size_t(0));
+  m_Entries.erase(it);
+}
+
+void TextureStreamer::request(const Texture &texture, float screenPixels) {
+  auto it = m_Entries.find(texture.id);
+  if (it == m_Entries.end())
+    return;
+  Entry &entry = it->second;
+
+  // one texel per pixel: every halving of the on-screen size drops a level
+  float ratio = std::max(entry.width, entry.height) / screenPixels;
+  size_t level = entry.tail;
+  if (ratio < (float)(1 << entry.tail))
+    level = ratio <= 1.0f ? 0 : (size_t)std::log2(ratio);
+
+  entry.wanted = std::min(entry.wanted, level);
+  entry.lastNeeded = m_Frame;
+}
+
+void TextureStreamer::update() {
+  std::vector<Load> done;
+  {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    done.swap(m_Done);
+  }
+  finishLoads(done);
+
+  while (m_Resident > m_Budget && evictOne(true))
+    ;
+  while (m_Resident > m_Budget && evictOne(false))
+    ;
+
+  // the textures missing the most levels go first
+  std::vector<Entry *> candidates;
+  for (auto &item : m_Entries) {
+    Entry &entry = item.second;
+    if (!entry.loading && entry.wanted < entry.resident)
+      candidates.push_back(&entry);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Entry *a, const Entry *b) {
+              return a->resident - a->wanted > b->resident - b->wanted;
+            });
+
+  for (Entry *entry : candidates) {
+    auto cost = [&](size_t firstLevel) {
+      return std::accumulate(entry->levelBytes.begin() + firstLevel,
+                             entry->levelBytes.begin() + entry->resident,
+                             size_t(0));
+    };
+    size_t firstLevel = entry->wanted;
+    while (m_Resident + m_PendingBytes + cost(firstLevel) > m_Budget &&
+           evictOne(true))
+      ;
+    // settle for the coarser levels that still fit
+    while (firstLevel < entry->resident &&
+           m_Resident + m_PendingBytes + cost(firstLevel) > m_Budget)
+      ++firstLevel;
+    if (firstLevel < entry->resident)
+      startLoad(*entry, firstLevel);
+  }
+
+  for (auto &item : m_Entries)
+    item.second.wanted = item.second.levelBytes.size();
+  ++m_Frame;
+
+  if (m_Synchronous && m_PendingCount > 0) {
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_Condition.wait(lock,
+                       [this] { return m_Done.size() == m_PendingCount; });
+      done.clear();
+      done.swap(m_Done);
+    }
+    finishLoads(done);
+  }
+}
+
+void TextureStreamer::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Stop = true;
+    m_Queue.clear();
+  }
+  m_Condition.notify_all();
+  if (m_Thread.joinable())
+    m_Thread.join();
+}
+
+void TextureStreamer::finishLoads(std::vector<Load> &done) {
+  for (Load &load : done) {
+    --m_PendingCount;
+    m_PendingBytes -= load.bytes;
+
+    auto it = m_Entries.find(load.id);
+    if (it == m_Entries.end() || it->second.serial != load.serial)
+      continue;
+    Entry &entry = it->second;
+    entry.loading = false;
+    if (!load.ok)
+      continue;
+
+    // evictOne skips loading entries, so resident is still lastLevel + 1
+    RenderState::get().bindTexture(0, GL_TEXTURE_2D, entry.id);
+    uploadCompressedTexture(GL_TEXTURE_2D, load.texture, load.firstLevel,
+                            load.lastLevel);
+    m_Resident += load.bytes;
+    m_Streamed += load.bytes;
+    entry.resident = load.firstLevel;
+    setBaseLevel(entry);
+  }
+}
+
+bool TextureStreamer::evictOne(bool onlyUnneeded) {
+  Entry *victim = nullptr;
+  for (auto &item : m_Entries) {
+    Entry &entry = item.second;
+    if (entry.loading || entry.resident >= entry.tail)
+      continue;
+    if (onlyUnneeded && entry.resident >= entry.wanted)
+      continue;
+    if (!victim || entry.lastNeeded < victim->lastNeeded)
+      victim = &entry;
+  }
+  if (!victim)
+    return false;
+
+  size_t level = victim->resident++;
+  m_Resident -= victim->levelBytes[level];
+  setBaseLevel(*victim);
+  // a zero sized image frees the level's storage, it is below BASE_LEVEL so
+  // its format does not matter for completeness
+  glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGBA8, 0, 0, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  return true;
+}
+
+void TextureStreamer::setBaseLevel(const Entry &entry) {
+  RenderState::get().bindTexture(0, GL_TEXTURE_2D, entry.id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)entry.resident);
+}
+
+void TextureStreamer::startLoad(Entry &entry, size_t firstLevel) {
+  Load load;
+  load.id = entry.id;
+  load.serial = entry.serial;
+  load.firstLevel = firstLevel;
+  load.lastLevel = entry.resident - 1;
+  load.path = entry.path;
+  load.flip = entry.flip;
+  load.sourceHash = entry.sourceHash;
+  load.bytes = std::accumulate(entry.levelBytes.begin() + firstLevel,
+                               entry.levelBytes.begin() + entry.resident,
+                               size_t(0));
+
+  entry.loading = true;
+  m_PendingBytes += load.bytes;
+  ++m_PendingCount;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_Thread.joinable()) {
+      m_Stop = false;
+      m_Thread = std::thread(&TextureStreamer::run, this);
+    }
+    m_Queue.push_back(std::move(load));
+  }
+  m_Condition.notify_all();
+}
+
+void TextureStreamer::run() {
+  for (;;) {
+    Load load;
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_Condition.wait(lock, [this] { return m_Stop || !m_Queue.empty(); });
+      if (m_Stop)
+        return;
+      load = std::move(m_Queue.front());
+      m_Queue.pop_front();
+    }
+
+    load.ok = load.texture.read(CompressedTexture::pathFor(load.path),
+                                load.sourceHash, load.firstLevel,
+                                load.lastLevel);
+    if (load.ok && load.flip)
+      load.texture.flipVertically();
+
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Done.push_back(std::move(load));
+    }
+    m_Condition.notify_all();
+  }
+}
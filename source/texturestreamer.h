@@ -0,0 +1,127 @@
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "compressedtexture.h"
+#include "glew/glew.h"
+
+struct Texture;
+
+// Mip residency for textures loaded from a CompressedTexture file. Only the
+// mip tail is uploaded at load time; the fine levels are read from disk on a
+// background thread once a draw asks for them and uploaded in update(). The
+// resident range is exposed to GL through GL_TEXTURE_BASE_LEVEL, so sampling
+// never touches a level that is not there.
+//
+// Above the budget, the finest level of the least recently needed texture is
+// dropped first. The tail itself is never evicted.
+class TextureStreamer {
+public:
+  // Levels of at most this many texels per side are resident from the start
+  static const int kTailSize = 64;
+
+  static TextureStreamer &get();
+
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+  // 0 turns streaming off, textures are then uploaded whole
+  void setBudget(size_t bytes) { m_Budget = bytes; }
+  size_t getBudget() const { return m_Budget; }
+  bool isEnabled() const { return m_Budget > 0; }
+
+  // Headless runs wait for every load issued by update(), so a frame
+  // always renders the same mips
+  void setSynchronous(bool synchronous) { m_Synchronous = synchronous; }
+
+  // GL thread: registers a texture uploaded from its first non-empty level
+  // on, see loadCompressedTexture's maxSize.
+  void track(GLuint id, const std::string &path, bool flip,
+             const CompressedTexture &texture);
+  // Drops a deleted texture, loads still in flight for it are discarded
+  void forget(GLuint id);
+
+  // Asks for the level that maps texture onto about screenPixels texels
+  // across; cheap, called per draw.
+  void request(const Texture &texture, float screenPixels);
+
+  // GL thread, once per frame after the requests: uploads finished loads,
+  // evicts down to the budget and issues loads for the new requests.
+  void update();
+  // Joins the loader thread, call before the GL context goes away
+  void shutdown();
+
+  size_t getResidentBytes() const { return m_Resident; }
+  size_t getPendingCount() const { return m_PendingCount; }
+  size_t getStreamedBytes() const { return m_Streamed; }
+
+private:
+  TextureStreamer() = default;
+  ~TextureStreamer();
+
+  struct Entry {
+    GLuint id = 0;
+    uint64_t serial = 0;
+    std::string path;
+    bool flip = false;
+    uint64_t sourceHash = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<size_t> levelBytes;
+    size_t tail = 0;
+    // finest level uploaded, BASE_LEVEL
+    size_t resident = 0;
+    // finest level asked for since the last update, levelBytes.size() if none
+    size_t wanted = 0;
+    uint64_t lastNeeded = 0;
+    bool loading = false;
+  };
+
+  struct Load {
+    GLuint id;
+    uint64_t serial;
+    size_t firstLevel;
+    size_t lastLevel;
+    std::string path;
+    bool flip;
+    uint64_t sourceHash;
+    size_t bytes;
+    CompressedTexture texture;
+    bool ok = false;
+  };
+
+  std::unordered_map<GLuint, Entry> m_Entries;
+  size_t m_Budget = 256u << 20;
+  bool m_Synchronous = false;
+  uint64_t m_Frame = 1;
+  uint64_t m_Serial = 0;
+  size_t m_Resident = 0;
+  size_t m_PendingBytes = 0;
+  size_t m_PendingCount = 0;
+  size_t m_Streamed = 0;
+
+  // loader thread
+  std::thread m_Thread;
+  std::mutex m_Mutex;
+  std::condition_variable m_Condition;
+  std::deque<Load> m_Queue;
+  std::vector<Load> m_Done;
+  bool m_Stop = false;
+
+  void finishLoads(std::vector<Load> &done);
+  bool evictOne(bool onlyUnneeded);
+  void setBaseLevel(const Entry &entry);
+  void startLoad(Entry &entry, size_t firstLevel);
+  void run();
+};
+
+#endif // !TEXTURESTREAMER_H
@@ -0,0 +1,94 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+  if (threadCount == 0)
+    threadCount = std::thread::hardware_concurrency();
+  if (threadCount == 0)
+    threadCount = 1;
+
+  for (unsigned int i = 0; i < threadCount; ++i)
+    m_workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_all();
+  for (std::thread &worker : m_workers)
+    worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(std::move(task));
+  }
+  m_condition.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+      // drain what is queued before stopping
+      if (m_tasks.empty())
+        return;
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain,
+                             const std::function<void(size_t, size_t)> &body) {
+  if (count == 0)
+    return;
+  grain = std::max<size_t>(grain, 1);
+  size_t chunkCount = (count + grain - 1) / grain;
+  if (chunkCount == 1) {
+    body(0, count);
+    return;
+  }
+
+  // Helpers may still be queued when the last chunk finishes, so everything
+  // they touch after that lives in shared state, never on this stack.
+  struct State {
+    std::atomic<size_t> next{0};
+    size_t done = 0;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  auto state = std::make_shared<State>();
+  const std::function<void(size_t, size_t)> *bodyPtr = &body;
+
+  auto run = [state, bodyPtr, count, grain, chunkCount] {
+    for (;;) {
+      size_t chunk = state->next++;
+      if (chunk >= chunkCount)
+        return;
+      size_t begin = chunk * grain;
+      (*bodyPtr)(begin, std::min(count, begin + grain));
+
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (++state->done == chunkCount)
+        state->finished.notify_all();
+    }
+  };
+
+  size_t helpers = std::min(chunkCount - 1, m_workers.size());
+  for (size_t i = 0; i < helpers; ++i)
+    submit(run);
+  run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock, [&] { return state->done == chunkCount; });
+}
@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks from one FIFO queue. Tasks must
+// not touch GL, there is no context on the workers.
+class ThreadPool {
+public:
+  // 0 uses one thread per hardware core
+  explicit ThreadPool(unsigned int threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task);
+
+  // Splits [0, count) into chunks of `grain` and runs body(begin, end) on
+  // the workers and the calling thread, returns once every chunk is done.
+  // Safe to call from a task, the caller never just waits for the queue.
+  void parallelFor(size_t count, size_t grain,
+                   const std::function<void(size_t, size_t)> &body);
+
+  unsigned int getThreadCount() const { return (unsigned int)m_workers.size(); }
+
+private:
+  std::vector<std::thread> m_workers;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  bool m_stop = false;
+
+  void workerLoop();
+};
+
+#endif // !THREADPOOL_H
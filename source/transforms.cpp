@@ -0,0 +1,113 @@
+#include "transforms.h"
+
+#include "glm/ext/matrix_transform.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "glm/matrix.hpp"
+
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#define TRANSFORMS_SSE 1
+#endif
+
+static const glm::mat4 &modelAt(const glm::mat4 *models,
+                                const uint32_t *indices, size_t i) {
+  return indices ? models[indices[i]] : models[i];
+}
+
+InstanceTRS makeInstanceTRS(const glm::vec3 &position, float scale,
+                            float angle, const glm::vec3 &axis) {
+  glm::quat rotation = glm::angleAxis(angle, glm::normalize(axis));
+  return {position, scale,
+          glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w)};
+}
+
+glm::mat4 instanceMatrix(const InstanceTRS &instance) {
+  const glm::vec4 &q = instance.rotation;
+  glm::mat4 model = glm::translate(glm::mat4(1.0f), instance.position);
+  model = glm::scale(model, glm::vec3(instance.scale));
+  return model * glm::mat4_cast(glm::quat(q.w, q.x, q.y, q.z));
+}
+
+void normalMatricesScalar(const glm::mat4 &view, const glm::mat4 *models,
+                          const uint32_t *indices, size_t count,
+                          glm::mat3 *out) {
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = glm::transpose(
+        glm::inverse(glm::mat3{view * modelAt(models, indices, i)}));
+  }
+}
+
+void normalMatrices(const glm::mat4 &view, const glm::mat4 *models,
+                    const uint32_t *indices, size_t count, glm::mat3 *out) {
+#ifdef TRANSFORMS_SSE
+  // upper 3x3 of the view, v[column][row], one broadcast per element
+  __m128 v[3][3];
+  for (int c = 0; c < 3; ++c) {
+    for (int r = 0; r < 3; ++r)
+      v[c][r] = _mm_set1_ps(view[c][r]);
+  }
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    // m[column][row] for four instances, one lane each
+    __m128 m[3][4];
+    for (int c = 0; c < 3; ++c) {
+      for (int lane = 0; lane < 4; ++lane)
+        m[c][lane] = _mm_loadu_ps(&modelAt(models, indices, i + lane)[c][0]);
+      _MM_TRANSPOSE4_PS(m[c][0], m[c][1], m[c][2], m[c][3]);
+    }
+
+    // a = mat3(view) * mat3(model), the translation never reaches the 3x3
+    __m128 a[3][3];
+    for (int c = 0; c < 3; ++c) {
+      for (int r = 0; r < 3; ++r) {
+        a[c][r] = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(v[0][r], m[c][0]),
+                       _mm_mul_ps(v[1][r], m[c][1])),
+            _mm_mul_ps(v[2][r], m[c][2]));
+      }
+    }
+
+    // inverse transpose columns: a1 x a2, a2 x a0, a0 x a1, over det
+    __m128 n[3][3];
+    for (int c = 0; c < 3; ++c) {
+      const __m128 *p = a[(c + 1) % 3];
+      const __m128 *q = a[(c + 2) % 3];
+      n[c][0] = _mm_sub_ps(_mm_mul_ps(p[1], q[2]), _mm_mul_ps(p[2], q[1]));
+      n[c][1] = _mm_sub_ps(_mm_mul_ps(p[2], q[0]), _mm_mul_ps(p[0], q[2]));
+      n[c][2] = _mm_sub_ps(_mm_mul_ps(p[0], q[1]), _mm_mul_ps(p[1], q[0]));
+    }
+    __m128 det = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(a[0][0], n[0][0]), _mm_mul_ps(a[0][1], n[0][1])),
+        _mm_mul_ps(a[0][2], n[0][2]));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    for (int c = 0; c < 3; ++c) {
+      for (int r = 0; r < 3; ++r)
+        n[c][r] = _mm_mul_ps(n[c][r], invDet);
+    }
+
+    // back to one mat3 (9 floats) per instance: two transposes cover the
+    // first eight floats, the ninth is stored on its own
+    __m128 head[4] = {n[0][0], n[0][1], n[0][2], n[1][0]};
+    __m128 tail[4] = {n[1][1], n[1][2], n[2][0], n[2][1]};
+    _MM_TRANSPOSE4_PS(head[0], head[1], head[2], head[3]);
+    _MM_TRANSPOSE4_PS(tail[0], tail[1], tail[2], tail[3]);
+    float last[4];
+    _mm_storeu_ps(last, n[2][2]);
+
+    for (int lane = 0; lane < 4; ++lane) {
+      float *dst = &out[i + lane][0][0];
+      _mm_storeu_ps(dst, head[lane]);
+      _mm_storeu_ps(dst + 4, tail[lane]);
+      dst[8] = last[lane];
+    }
+  }
+
+  if (indices)
+    normalMatricesScalar(view, models, indices + i, count - i, out + i);
+  else
+    normalMatricesScalar(view, models + i, nullptr, count - i, out + i);
+#else
+  normalMatricesScalar(view, models, indices, count, out);
+#endif
+}
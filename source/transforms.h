@@ -0,0 +1,44 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include "glm/ext/matrix_float3x3.hpp"
+#include "glm/ext/matrix_float4x4.hpp"
+#include "glm/ext/vector_float3.hpp"
+#include "glm/ext/vector_float4.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// Batch instance transforms, GL free like culling.h.
+
+// Instance transform as the instanced object shader reads it: translation,
+// uniform scale and a unit quaternion (x, y, z, w). The shader rebuilds
+// model = translate(position) * scale(scale) * rotate(rotation) and turns
+// normals with the rotation alone, a uniform scale needs no inverse.
+// 32 bytes, a model matrix and its normal matrix are 100.
+struct InstanceTRS {
+  glm::vec3 position;
+  float scale;
+  glm::vec4 rotation;
+};
+static_assert(sizeof(InstanceTRS) == 32, "InstanceTRS must stay packed");
+
+// angle in radians about axis, which need not be normalized
+InstanceTRS makeInstanceTRS(const glm::vec3 &position, float scale,
+                            float angle, const glm::vec3 &axis);
+// glm reference of the model matrix the shader rebuilds
+glm::mat4 instanceMatrix(const InstanceTRS &instance);
+
+// out[i] = transpose(inverse(mat3(view * models[indices[i]]))), the view
+// space normal matrix. indices may be nullptr to take models in order.
+// Four instances at a time with SSE using the cofactor form of the 3x3
+// inverse, so there is no per instance branch.
+void normalMatrices(const glm::mat4 &view, const glm::mat4 *models,
+                    const uint32_t *indices, size_t count, glm::mat3 *out);
+
+// glm reference of the same computation.
+void normalMatricesScalar(const glm::mat4 &view, const glm::mat4 *models,
+                          const uint32_t *indices, size_t count,
+                          glm::mat3 *out);
+
+#endif // !TRANSFORMS_H
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <utility>
@@ -5,11 +6,19 @@
 
 #include "shader.h"
 #include "stb/stb_image.h"
+#include "texturecache.h"
 #include "utilities.h"
 
 GLuint loadCubemap(const std::string &cubmapName, bool flip) {
+  TextureCache &cache = TextureCache::get();
+  std::string key =
+      TextureCache::makeKey("assets/cubemaps/" + cubmapName, flip) + "|cube";
+  GLuint cachedID = 0;
+  TextureCache::Status status = cache.acquire(key, cachedID, false);
+  if (status == TextureCache::Status::Ready)
+    return cachedID;
 
-  stbi_set_flip_vertically_on_load(flip);
+  stbi_set_flip_vertically_on_load_thread(flip);
 
   std::vector<std::string> faces = {
       std::string{"/posx.jpg"}, //
@@ -24,18 +33,34 @@ GLuint loadCubemap(const std::string &cubmapName, bool flip) {
   glGenTextures(1, &textureID);
   glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
+  // a cube map is only complete when every face has the same format, so
+  // the converted faces are used only if all six are there
+  std::vector<CompressedTexture> compressed(faces.size());
+  bool allCompressed = true;
+  for (unsigned int i = 0; i < faces.size() && allCompressed; ++i)
+    allCompressed = loadCompressedTexture(
+        "assets/cubemaps/" + cubmapName + faces[i], flip, compressed[i]);
+
   GLint width = 0, height = 0, nrChannels = 3;
+  size_t bytes = 0;
   for (unsigned int i = 0; i < faces.size(); ++i) {
+    std::string facePath = "assets/cubemaps/" + cubmapName + faces[i];
+    if (allCompressed) {
+      // sampled with GL_LINEAR, the mip chain would never be read
+      bytes += uploadCompressedTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                                       compressed[i], 0, 0);
+      continue;
+    }
+
     unsigned char *data =
-        stbi_load(("assets/cubemaps/" + cubmapName + faces[i]).c_str(), &width,
-                  &height, &nrChannels, 0);
+        stbi_load(facePath.c_str(), &width, &height, &nrChannels, 0);
     if (data) {
       glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height,
                    0, GL_RGB, GL_UNSIGNED_BYTE, data);
+      bytes += (size_t)width * height * 3;
       stbi_image_free(data);
     } else {
-      std::cout << "Cubemap failed to load at path: "
-                << ("assets/cubemaps/" + cubmapName + faces[i]).c_str()
+      std::cout << "Cubemap failed to load at path: " << facePath
                 << std::endl;
       stbi_image_free(data);
     }
@@ -46,9 +71,57 @@ GLuint loadCubemap(const std::string &cubmapName, bool flip) {
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+  if (status == TextureCache::Status::Reserved)
+    cache.publish(key, textureID, bytes);
   return textureID;
 }
 
+size_t uploadCompressedTexture(GLenum target, const CompressedTexture &texture,
+                               size_t firstLevel, size_t lastLevel) {
+  GLenum internalFormat = 0;
+  bool supported = true;
+  switch (texture.format) {
+  case BlockFormat::BC1:
+    internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    supported = GLEW_EXT_texture_compression_s3tc;
+    break;
+  case BlockFormat::BC3:
+    internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    supported = GLEW_EXT_texture_compression_s3tc;
+    break;
+  case BlockFormat::BC5:
+    // RGTC is core since GL 3.0
+    internalFormat = GL_COMPRESSED_RG_RGTC2;
+    break;
+  }
+
+  lastLevel = std::min(lastLevel, texture.levels.size() - 1);
+  size_t bytes = 0;
+  std::vector<uint8_t> rgba;
+  for (size_t level = firstLevel; level <= lastLevel; ++level) {
+    const std::vector<uint8_t> &blocks = texture.levels[level];
+    if (blocks.empty())
+      continue;
+    int width = texture.levelWidth(level);
+    int height = texture.levelHeight(level);
+    if (supported) {
+      glCompressedTexImage2D(target, (GLint)level, internalFormat, width,
+                             height, 0, (GLsizei)blocks.size(),
+                             blocks.data());
+      bytes += blocks.size();
+    } else {
+      rgba.resize((size_t)width * height * 4);
+      decompressImage(texture.format, blocks.data(), width, height,
+                      rgba.data());
+      glTexImage2D(target, (GLint)level, GL_RGBA8, width, height, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, rgba.data());
+      bytes += rgba.size();
+    }
+  }
+  return bytes;
+}
+
 GLuint createCubMapVAO() {
 
   float boxVertices[] = {
@@ -113,28 +186,8 @@ GLuint createCubMapVAO() {
   return VAO;
 }
 
-void ShaderBlockBinding(GLuint UBO, const Shader &shader,
+void ShaderBlockBinding(GLuint UBO, Shader &shader,
                         const std::string &blockName, GLuint bindingPoint) {
-  GLuint blocIndex = glGetUniformBlockIndex(shader.ID, blockName.c_str());
-  if (blocIndex == GL_INVALID_INDEX) {
-    std::cout << "SHADER BLOCK BINDING: INVALID INDEX: " << blockName
-              << std::endl;
-    return;
-  }
-  glUniformBlockBinding(shader.ID, blocIndex, bindingPoint);
+  // the shader keeps the binding to restore it after a hot reload
+  shader.bindUniformBlock(blockName, bindingPoint);
 };
-
-GLuint genUbo(GLuint dataSizeBytes) {
-  GLuint UBO;
-  glGenBuffers(1, &UBO);
-  glBindBuffer(GL_UNIFORM_BUFFER, UBO);
-  glBufferData(GL_UNIFORM_BUFFER, dataSizeBytes, NULL, GL_DYNAMIC_DRAW);
-  glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-  return UBO;
-}
-
-void UboBlocBinding(GLuint UBO, GLuint dataSizeBytes, GLuint bindingPoint) {
-
-  glBindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, UBO, 0, dataSizeBytes);
-}
@@ -2,6 +2,7 @@
 #ifndef UTILITIES_H
 #define UTILITIES_H
 
+#include "compressedtexture.h"
 #include "glew/glew.h"
 #include "glm/gtc/type_ptr.hpp"
 #include "shader.h"
@@ -10,16 +11,14 @@
 GLuint loadCubemap(const std::string &cubmapName, bool flip = false);
 GLuint createCubMapVAO();
 
-void ShaderBlockBinding(GLuint UBO, const Shader &shader,
-                        const std::string &blockName, GLuint bindingPoint);
-GLuint genUbo(GLuint dataSizeBytes);
-void UboBlocBinding(GLuint UBO, GLuint dataSizeBytes, GLuint bindingPoint);
+// Uploads the non-empty levels in [firstLevel, lastLevel] of texture to
+// target (a 2D target or a cube map face) with glCompressedTexImage2D.
+// Without S3TC support the blocks are decoded on the CPU and uploaded as
+// RGBA8. Returns the bytes of GPU memory used.
+size_t uploadCompressedTexture(GLenum target, const CompressedTexture &texture,
+                               size_t firstLevel = 0,
+                               size_t lastLevel = SIZE_MAX);
 
-template <typename T>
-void updateUbo(GLuint UBO, GLuint offsetBytes, const T &data) {
-  glBindBuffer(GL_UNIFORM_BUFFER, UBO);
-  glBufferSubData(GL_UNIFORM_BUFFER, offsetBytes, sizeof(T),
-                  glm::value_ptr(data));
-  glBindBuffer(GL_UNIFORM_BUFFER, 0);
-}
+void ShaderBlockBinding(GLuint UBO, Shader &shader,
+                        const std::string &blockName, GLuint bindingPoint);
 #endif // !UTILITIES_H
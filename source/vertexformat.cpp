@@ -0,0 +1,84 @@
+#include "vertexformat.h"
+#include "model.h"
+
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/gtc/packing.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+glm::vec2 signNotZero(const glm::vec2 &v) {
+  return {v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f};
+}
+
+} // namespace
+
+glm::vec2 octEncode(const glm::vec3 &normal) {
+  float sum = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+  if (sum <= 0.0f)
+    return glm::vec2(0.0f);
+
+  glm::vec2 p = glm::vec2(normal) / sum;
+  if (normal.z < 0.0f)
+    p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * signNotZero(p);
+  return p;
+}
+
+glm::vec3 octDecode(const glm::vec2 &encoded) {
+  glm::vec3 n(encoded, 1.0f - std::fabs(encoded.x) - std::fabs(encoded.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+
+void packVertices(const Vertex *vertices, size_t count, PackedMesh &out) {
+  glm::vec3 lo(0.0f), hi(0.0f);
+  if (count > 0)
+    lo = hi = vertices[0].Position;
+  for (size_t i = 1; i < count; ++i) {
+    lo = glm::min(lo, vertices[i].Position);
+    hi = glm::max(hi, vertices[i].Position);
+  }
+
+  out.offset = (lo + hi) * 0.5f;
+  out.scale = (hi - lo) * 0.5f;
+  // a flat axis still needs a non-zero scale to divide by
+  for (int axis = 0; axis < 3; ++axis)
+    if (out.scale[axis] <= 0.0f)
+      out.scale[axis] = 1.0f;
+
+  out.vertices.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const Vertex &vertex = vertices[i];
+    PackedVertex &packed = out.vertices[i];
+
+    glm::vec3 position = (vertex.Position - out.offset) / out.scale;
+    for (int axis = 0; axis < 3; ++axis)
+      packed.position[axis] = (int16_t)glm::packSnorm1x16(position[axis]);
+    packed.position[3] = 0;
+
+    glm::vec2 normal = octEncode(vertex.Normal);
+    packed.normal[0] = (int16_t)glm::packSnorm1x16(normal.x);
+    packed.normal[1] = (int16_t)glm::packSnorm1x16(normal.y);
+
+    packed.texCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+    packed.texCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+  }
+}
+
+void unpackVertex(const PackedMesh &mesh, size_t index, Vertex &out) {
+  const PackedVertex &packed = mesh.vertices[index];
+  for (int axis = 0; axis < 3; ++axis) {
+    float snorm = glm::unpackSnorm1x16((uint16_t)packed.position[axis]);
+    out.Position[axis] = mesh.offset[axis] + mesh.scale[axis] * snorm;
+  }
+
+  out.Normal = octDecode({glm::unpackSnorm1x16((uint16_t)packed.normal[0]),
+                          glm::unpackSnorm1x16((uint16_t)packed.normal[1])});
+  out.TexCoords = {glm::unpackHalf1x16(packed.texCoords[0]),
+                   glm::unpackHalf1x16(packed.texCoords[1])};
+}
@@ -0,0 +1,42 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include "glm/ext/vector_float2.hpp"
+#include "glm/ext/vector_float3.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Vertex;
+
+// 16 byte vertex, half the size of Vertex:
+//   position   3 x snorm16 inside the mesh bounds (+ 1 pad)
+//   normal     2 x snorm16, octahedral
+//   texCoords  2 x half float
+// The vertex shaders decode it with the mesh's positionScale /
+// positionOffset and octNormals uniforms, see Mesh::setVertexDecode.
+struct PackedVertex {
+  int16_t position[4];
+  int16_t normal[2];
+  uint16_t texCoords[2];
+};
+
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+struct PackedMesh {
+  // decoded position = offset + scale * snorm position
+  glm::vec3 offset{0.0f};
+  glm::vec3 scale{1.0f};
+  std::vector<PackedVertex> vertices;
+};
+
+void packVertices(const Vertex *vertices, size_t count, PackedMesh &out);
+// CPU mirror of the shader decode, for checking the packing
+void unpackVertex(const PackedMesh &mesh, size_t index, Vertex &out);
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2 and back
+glm::vec2 octEncode(const glm::vec3 &normal);
+glm::vec3 octDecode(const glm::vec2 &encoded);
+
+#endif // !VERTEXFORMAT_H